@@ -23,9 +23,13 @@
 #include "chpsim.h"
 #include "prssim.h"
 #include "xycesim.h"
+#include <stdlib.h>
 #include <time.h>
 #include <math.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 /*
 
@@ -63,6 +67,16 @@ ActSimCore::ActSimCore (Process *p)
   for (int i=0; i < TRACE_NUM_FORMATS; i++) {
     _trfn[i] = NULL;
     _tr[i] = NULL;
+    _trw[i] = NULL;
+  }
+  _trace_ring = 0;
+  if (config_exists ("sim.trace_async") &&
+      (config_get_int ("sim.trace_async") == 1)) {
+    _trace_ring = 256*1024/sizeof (unsigned long);
+    if (config_exists ("sim.trace_ring")) {
+      _trace_ring = config_get_int ("sim.trace_ring")*1024/
+	sizeof (unsigned long);
+    }
   }
   
   _black_box_mode = config_get_int ("net.black_box_mode");
@@ -124,12 +138,18 @@ ActSimCore::ActSimCore (Process *p)
   */
   state_counts globals = sp->getGlobals();
 
+  int planes = 0;
+  if (config_exists ("sim.bool_planes") &&
+      config_get_int ("sim.bool_planes") == 1) {
+    planes = 1;
+  }
+
   state = new ActSimState (si->ports.numAllBools() + si->all.numAllBools()
 			   + globals.numAllBools(),
 			   si->ports.numInts() + si->all.numInts() +
 			   globals.numInts(),
 			   si->ports.numChans() +  si->all.numChans() +
-			   globals.numChans());
+			   globals.numChans(), planes);
 
   nfo_len = si->ports.numAllBools() + si->all.numAllBools()
     + globals.numAllBools() + si->ports.numInts() + si->all.numInts()
@@ -138,21 +158,30 @@ ActSimCore::ActSimCore (Process *p)
   nint_start = si->ports.numAllBools() + si->all.numAllBools()
     + globals.numAllBools();
 
-  if (nfo_len > 0) {
-    MALLOC (nfo, int, nfo_len);
-    MALLOC (fo, SimDES **, nfo_len);
-    for (int i=0; i < nfo_len; i++) {
-      nfo[i] = 0;
-      fo[i] = NULL;
-    }
+  MALLOC (fo_start, int, nfo_len + 1);
+  for (int i=0; i <= nfo_len; i++) {
+    fo_start[i] = 0;
   }
-  else {
-    nfo = NULL;
-    fo = NULL;
+  fo = NULL;
+  fo_kind = NULL;
+  MALLOC (fo_nkind, unsigned char, nfo_len + 1);
+  for (int i=0; i <= nfo_len; i++) {
+    fo_nkind[i] = ACTSIM_FO_OTHER;
   }
-  hfo = NULL;
+  A_INIT (_fo_pend);
 
   _seed = 0;
+  _fast_rng = 0;
+  if (config_exists ("sim.fast_rng") &&
+      (config_get_int ("sim.fast_rng") == 1)) {
+    _fast_rng = 1;
+    if (_logtab[1 << ACTSIM_LOGTAB_BITS] == 0) {
+      for (int i=0; i <= (1 << ACTSIM_LOGTAB_BITS); i++) {
+	_logtab[i] = exp ((LN_MAX_VAL*i)/(1 << ACTSIM_LOGTAB_BITS)) - 1;
+      }
+    }
+  }
+  _rngSeed ();
   _rand_min = 1;
   _rand_max = 100;
   _sim_rand_excl = 0;
@@ -167,6 +196,47 @@ ActSimCore::ActSimCore (Process *p)
 
   _W = ihash_new (4);
   _B = ihash_new (4);
+  for (int i=0; i < 3; i++) {
+    _obs[i] = NULL;
+    _obs_len[i] = 0;
+  }
+
+  if (config_exists ("sim.prs.timing_wheel") &&
+      (config_get_int ("sim.prs.timing_wheel") == 1)) {
+    OnePrsSim::useWheel ();
+  }
+  if (config_exists ("sim.prs.delta_cycle") &&
+      (config_get_int ("sim.prs.delta_cycle") == 1)) {
+    OnePrsSim::useDelta ();
+  }
+  _prs_levelize = 0;
+  if (config_exists ("sim.prs.levelize") &&
+      (config_get_int ("sim.prs.levelize") == 1)) {
+    _prs_levelize = 1;
+  }
+  _prs_jit = 0;
+  if (config_exists ("sim.prs.jit") &&
+      (config_get_int ("sim.prs.jit") == 1)) {
+    if (!state->valuePlane()) {
+      warning ("sim.prs.jit needs sim.bool_planes; using the interpreter");
+    }
+    else {
+      _prs_jit = 1;
+      OnePrsSim::useJit (state);
+    }
+  }
+  _sop = NULL;
+  if (config_exists ("sim.prs.sop_count") &&
+      (config_get_int ("sim.prs.sop_count") == 1)) {
+    int minlits = 8;
+    if (config_exists ("sim.prs.sop_min")) {
+      minlits = config_get_int ("sim.prs.sop_min");
+      if (minlits < 1) {
+	minlits = 1;
+      }
+    }
+    _sop = new PrsSopIndex (minlits);
+  }
 
   _initSim();
 
@@ -177,6 +247,18 @@ ActSimCore::ActSimCore (Process *p)
       (config_get_int ("sim.chp.inf_loop_opt") == 1)) {
     _inf_loop_opt = 1;
   }
+
+  _chp_int64 = 1;
+  if (config_exists ("sim.chp.int64_fast") &&
+      (config_get_int ("sim.chp.int64_fast") == 0)) {
+    _chp_int64 = 0;
+  }
+
+  _chp_direct = 0;
+  if (config_exists ("sim.chp.direct_handoff") &&
+      (config_get_int ("sim.chp.direct_handoff") == 1)) {
+    _chp_direct = 1;
+  }
 }
 
 static void _delete_sim_objs (ActInstTable *I, int del)
@@ -262,22 +344,15 @@ ActSimCore::~ActSimCore()
   }
 
   /*-- fanout tables --*/
-  if (nfo) {
-    Assert (fo, "What?");
-    for (int i=0; i < nfo_len; i++) {
-      if (nfo[i] > 0) {
-	Assert (fo[i], "What?");
-	FREE (fo[i]);
-      }
-      else {
-	Assert (!fo[i], "Hmm");
-      }
-    }
+  FREE (fo_start);
+  if (fo) {
     FREE (fo);
-    FREE (nfo);
+    FREE (fo_kind);
   }
-  if (hfo) {
-    ihash_free (hfo);
+  FREE (fo_nkind);
+  A_FREE (_fo_pend);
+  if (_sop) {
+    delete _sop;
   }
 
   /*-- chp objects --*/
@@ -295,12 +370,20 @@ ActSimCore::~ActSimCore()
     FREE (b->v);
   }
   ihash_free (_B);
+  for (int i=0; i < 3; i++) {
+    if (_obs[i]) {
+      FREE (_obs[i]);
+    }
+  }
 
   /*-- instance tables --*/
   _delete_sim_objs (&I, 0);
 
   /*-- close any pending trace files --*/
   for (int i=0; i < TRACE_NUM_FORMATS; i++) {
+    if (_trw[i]) {
+      delete _trw[i];
+    }
     if (_tr[i]) {
       act_trace_close (_tr[i]);
     }
@@ -833,6 +916,7 @@ void ActSimCore::_check_fragmentation (XyceSim *x)
       sim_recordChannel (this, x, un);
       registerFragmented (ch->ct);
       ch->cm = getFragmented (ch->ct);
+      ch->cm->bind (ch);
     }
     delete un;
     delete tmp;
@@ -1390,6 +1474,30 @@ void ActSimCore::_add_all_inst (Scope *sc)
 }
 
 
+double ActSimCore::_logtab[(1 << ACTSIM_LOGTAB_BITS) + 1];
+
+/* splitmix64 expansion of the seed into the xoshiro256** state */
+void ActSimCore::_rngSeed ()
+{
+  unsigned long z = _seed;
+  for (int i=0; i < 4; i++) {
+    unsigned long r;
+    z += 0x9e3779b97f4a7c15UL;
+    r = z;
+    r = (r ^ (r >> 30))*0xbf58476d1ce4e5b9UL;
+    r = (r ^ (r >> 27))*0x94d049bb133111ebUL;
+    _rng[i] = r ^ (r >> 31);
+  }
+}
+
+void ActSimCore::_sopChange (int x, int ov)
+{
+  int nv = state->getBool (x);
+  if (nv != ov) {
+    _sop->update (x, ov, nv);
+  }
+}
+
 void ActSimCore::computeFanout (ActInstTable *I)
 {
   stateinfo_t *si = _cursi;
@@ -1504,6 +1612,10 @@ void ActSimCore::_initSim ()
     Now compute all the fanout dependencies
   */
   computeFanout(&I);
+  _buildFanout ();
+  if (_sop) {
+    _sop->build (this);
+  }
 
   /* 
      Add the initialization environment, if needed:
@@ -1522,22 +1634,22 @@ void ActSimCore::_initSim ()
     int i;
     printf ("*-- bools --\n");
     for (i=0; i < nint_start; i++) {
-      printf ("b[%d] : fo=%d", i, nfo[i]);
-      if (nfo[i] > 0) {
-	for (int j=0; j < nfo[i]; j++) {
+      printf ("b[%d] : fo=%d", i, fo_start[i+1] - fo_start[i]);
+      if (fo_start[i+1] > fo_start[i]) {
+	for (int j=fo_start[i]; j < fo_start[i+1]; j++) {
 	  printf (" ");
-	  dynamic_cast<ActSimObj *>(fo[i][j])->getName()->Print (stdout);
+	  dynamic_cast<ActSimObj *>(fo[j])->getName()->Print (stdout);
 	}
       }
       printf ("\n");
     }
     printf ("*-- ints --\n");
     for (; i < nfo_len; i++) {
-      printf ("i[%d] : fo=%d", i-nint_start, nfo[i]);
-      if (nfo[i] > 0) {
-	for (int j=0; j < nfo[i]; j++) {
+      printf ("i[%d] : fo=%d", i-nint_start, fo_start[i+1] - fo_start[i]);
+      if (fo_start[i+1] > fo_start[i]) {
+	for (int j=fo_start[i]; j < fo_start[i+1]; j++) {
 	  printf (" ");
-	  dynamic_cast<ActSimObj *>(fo[i][j])->getName()->Print (stdout);
+	  dynamic_cast<ActSimObj *>(fo[j])->getName()->Print (stdout);
 	}
       }
       printf ("\n");
@@ -1713,6 +1825,62 @@ int ActSimCore::getLocalOffset (ActId *id, stateinfo_t *si, int *type, int *widt
   return getLocalOffset (c, si, type, width);
 }
 
+
+/*-- event pool --*/
+
+#define ACT_EVENT_SLAB 1024
+#define ACT_EVENT_ALIGN 64
+
+void *ActEvent::_free = NULL;
+size_t ActEvent::_esz = 0;
+
+void *ActEvent::operator new (size_t sz)
+{
+  void *x;
+
+  if (sz != sizeof (ActEvent)) {
+    return ::operator new (sz);
+  }
+  if (!_free) {
+    char *slab;
+    if (_esz == 0) {
+      /* a power of two up to a cache line, so that an event never
+	 straddles two lines; a multiple of the line size beyond that */
+      _esz = sizeof (void *);
+      while (_esz < sz) {
+	_esz <<= 1;
+      }
+      if (_esz > ACT_EVENT_ALIGN) {
+	_esz = ((sz + ACT_EVENT_ALIGN - 1)/ACT_EVENT_ALIGN)*ACT_EVENT_ALIGN;
+      }
+    }
+    if (posix_memalign ((void **)&slab, ACT_EVENT_ALIGN,
+			_esz*ACT_EVENT_SLAB) != 0) {
+      fatal_error ("Could not allocate event pool");
+    }
+    for (int i=ACT_EVENT_SLAB-1; i >= 0; i--) {
+      *((void **)(slab + i*_esz)) = _free;
+      _free = slab + i*_esz;
+    }
+  }
+  x = _free;
+  _free = *((void **)x);
+  return x;
+}
+
+void ActEvent::operator delete (void *p, size_t sz)
+{
+  if (!p) {
+    return;
+  }
+  if (sz != sizeof (ActEvent)) {
+    ::operator delete (p);
+    return;
+  }
+  *((void **)p) = _free;
+  _free = p;
+}
+
 ActSimObj::ActSimObj (ActSimCore *sim, Process *p)
 {
   _sc = sim;
@@ -1791,43 +1959,195 @@ void ActSimCore::incFanout (int off, int type, SimDES *who)
     Assert (off >= 0 && off < nfo_len - nint_start, "What?");
     off = off + nint_start;
   }
-  
-  if (nfo[off] == 0) {
-    /* first entry! */
-    NEW (fo[off], SimDES *);
+
+  A_NEW (_fo_pend, fanout_pair);
+  A_NEXT (_fo_pend).off = off;
+  A_NEXT (_fo_pend).seq = 0;
+  A_NEXT (_fo_pend).who = who;
+  A_INC (_fo_pend);
+}
+
+static int _fo_cmp_who (const void *a, const void *b)
+{
+  const ActSimCore::fanout_pair *x = (const ActSimCore::fanout_pair *) a;
+  const ActSimCore::fanout_pair *y = (const ActSimCore::fanout_pair *) b;
+  if (x->off != y->off) {
+    return x->off < y->off ? -1 : 1;
   }
-  else if (nfo[off] >= 8) {
-    for (int i=nfo[off]-1; i >= 0 && i >= nfo[off]-10; i--) {
-      if (fo[off][i] == who) {
-	return;
-      }
+  if (x->who != y->who) {
+    return (unsigned long)x->who < (unsigned long)y->who ? -1 : 1;
+  }
+  return x->seq - y->seq;
+}
+
+static int _fo_cmp_seq (const void *a, const void *b)
+{
+  const ActSimCore::fanout_pair *x = (const ActSimCore::fanout_pair *) a;
+  const ActSimCore::fanout_pair *y = (const ActSimCore::fanout_pair *) b;
+  if (x->off != y->off) {
+    return x->off < y->off ? -1 : 1;
+  }
+  return x->seq - y->seq;
+}
+
+/*
+  Merge the pending (variable, destination) pairs into the fanout
+  table. Duplicates are dropped, and the destinations of each
+  variable stay in the order in which they were first added.
+*/
+void ActSimCore::_buildFanout ()
+{
+  fanout_pair *p;
+  int n, k, i;
+
+  if (A_LEN (_fo_pend) == 0) {
+    return;
+  }
+  n = fo_start[nfo_len] + A_LEN (_fo_pend);
+  MALLOC (p, fanout_pair, n);
+  k = 0;
+  for (i=0; i < nfo_len; i++) {
+    for (int j=fo_start[i]; j < fo_start[i+1]; j++) {
+      p[k].off = i;
+      p[k].seq = k;
+      p[k].who = fo[j];
+      k++;
     }
-    
-    /* this is a tentative high fanout net */
-    ihash_bucket_t *b;
-    if (!hfo) {
-      hfo = ihash_new (4);
+  }
+  for (i=0; i < A_LEN (_fo_pend); i++) {
+    p[k] = _fo_pend[i];
+    p[k].seq = k;
+    k++;
+  }
+  A_LEN_RAW (_fo_pend) = 0;
+
+  /* remove duplicates */
+  qsort (p, n, sizeof (fanout_pair), _fo_cmp_who);
+  k = 0;
+  for (i=0; i < n; i++) {
+    if (k > 0 && p[k-1].off == p[i].off && p[k-1].who == p[i].who) {
+      continue;
     }
-    b = ihash_lookup (hfo, off);
-    if (!b) {
-      b = ihash_add (hfo, off);
-      b->i = nfo[off]; // the allocated slots
+    p[k++] = p[i];
+  }
+  n = k;
+  qsort (p, n, sizeof (fanout_pair), _fo_cmp_seq);
+
+  /* emit the table */
+  if (fo) {
+    FREE (fo);
+    FREE (fo_kind);
+  }
+  MALLOC (fo, SimDES *, n > 0 ? n : 1);
+  MALLOC (fo_kind, unsigned char, n > 0 ? n : 1);
+  for (i=0; i <= nfo_len; i++) {
+    fo_start[i] = 0;
+  }
+  for (i=0; i < n; i++) {
+    fo_start[p[i].off+1]++;
+    fo[i] = p[i].who;
+    if (dynamic_cast<OnePrsSim *>(fo[i])) {
+      fo_kind[i] = ACTSIM_FO_PRS;
+    }
+    else if (dynamic_cast<ChpSim *>(fo[i])) {
+      fo_kind[i] = ACTSIM_FO_CHP;
+    }
+    else if (dynamic_cast<XyceSim *>(fo[i])) {
+      fo_kind[i] = ACTSIM_FO_XYCE;
     }
-    if (nfo[off] == b->i) {
-      b->i = b->i*2;
-      REALLOC (fo[off], SimDES *, b->i);
+    else {
+      Assert (dynamic_cast<ActSimDES *>(fo[i]), "What?");
+      fo_kind[i] = ACTSIM_FO_OTHER;
     }
   }
-  else {
-    for (int i=nfo[off]-1; i >= 0 ; i--) {
-      if (fo[off][i] == who) {
-	return;
+  for (i=0; i < nfo_len; i++) {
+    fo_start[i+1] += fo_start[i];
+  }
+  for (i=0; i < nfo_len; i++) {
+    fo_nkind[i] = ACTSIM_FO_OTHER;
+    for (int j=fo_start[i]; j < fo_start[i+1]; j++) {
+      if (j == fo_start[i]) {
+	fo_nkind[i] = fo_kind[j];
       }
+      else if (fo_nkind[i] != fo_kind[j]) {
+	fo_nkind[i] = ACTSIM_FO_MIXED;
+	break;
+      }
+    }
+  }
+  FREE (p);
+}
+
+/*
+  Propagate a change on a variable to its fanout. Destinations are
+  visited in table order; the tag on each entry selects a direct
+  call, so the common case of a net that only drives production
+  rules is a loop of non-virtual calls.
+*/
+void ActSimCore::propagateFanout (int off, int type)
+{
+  SimDES **arr;
+  unsigned char *kind;
+  int n;
+
+  if (type != 0) {
+    off += nint_start;
+  }
+  _foSync ();
+  arr = fo + fo_start[off];
+  n = fo_start[off+1] - fo_start[off];
+
+#ifdef DUMP_ALL
+  for (int i=0; i < n; i++) {
+    ActSimObj *obj = dynamic_cast<ActSimObj *>(arr[i]);
+    printf ("   prop: ");
+    if (obj) {
+      if (obj->getName()) {
+	obj->getName()->Print (stdout);
+      }
+      else {
+	printf ("-none-");
+      }
+    }
+    else {
+      printf ("#%p", arr[i]);
+    }
+    printf ("\n");
+  }
+#endif
+
+  switch (fo_nkind[off]) {
+  case ACTSIM_FO_PRS:
+    OnePrsSim::propagateAll (arr, n);
+    return;
+
+  case ACTSIM_FO_CHP:
+    for (int i=0; i < n; i++) {
+      static_cast<ChpSim *>(arr[i])->ChpSim::propagate ();
+    }
+    return;
+
+  default:
+    break;
+  }
+
+  kind = fo_kind + fo_start[off];
+  for (int i=0; i < n; i++) {
+    switch (kind[i]) {
+    case ACTSIM_FO_PRS:
+      static_cast<OnePrsSim *>(arr[i])->OnePrsSim::propagate ();
+      break;
+    case ACTSIM_FO_CHP:
+      static_cast<ChpSim *>(arr[i])->ChpSim::propagate ();
+      break;
+    case ACTSIM_FO_XYCE:
+      static_cast<XyceSim *>(arr[i])->XyceSim::propagate ();
+      break;
+    default:
+      static_cast<ActSimDES *>(arr[i])->propagate ();
+      break;
     }
-    REALLOC (fo[off], SimDES *, nfo[off]+1);
   }
-  fo[off][nfo[off]] = who;
-  nfo[off]++;
 }
 
 void ActSimObj::propagate ()
@@ -1901,7 +2221,9 @@ void ActSimObj::msgPrefix (FILE *fp)
 
 bool _match_hseprs (Event *e)
 {
-  if (dynamic_cast <OnePrsSim *> (e->getObj())) {
+  if (dynamic_cast <OnePrsSim *> (e->getObj()) ||
+      dynamic_cast <PrsSimWheel *> (e->getObj()) ||
+      dynamic_cast <PrsSimDelta *> (e->getObj())) {
     return true;
   }
   ChpSim *x = dynamic_cast <ChpSim *> (e->getObj());
@@ -1927,12 +2249,7 @@ void ActSim::runInit ()
     int v = random() % 2;
     if (getBool (_rand_init[i]) == 2) {
       if (setBool (_rand_init[i], v)) {
-	SimDES **arr = getFO (_rand_init[i], 0);
-	for (int j=0; j < numFanout (_rand_init[i], 0); j++) {
-	  ActSimDES *x = dynamic_cast<ActSimDES *>(arr[j]);
-	  Assert (x, "What?");
-	  x->propagate ();
-	}
+	propagateFanout (_rand_init[i], 0);
       }
     }
   }
@@ -2070,6 +2387,468 @@ void ActSim::runInit ()
 }
 
 
+/*------------------------------------------------------------------------
+ *
+ *  Binary checkpoint/restore
+ *
+ *  The checkpoint holds a fingerprint of the design, the state
+ *  vector, the simulation time and mode, and the state of each
+ *  simulation object (program counters for CHP, pending transitions
+ *  for production rules), visited in instance table order. It is
+ *  only valid for the design and binary that wrote it.
+ *
+ *------------------------------------------------------------------------
+ */
+#define ACTSIM_CKPT_MAGIC   0x6b63736cUL
+#define ACTSIM_CKPT_VERSION 3
+
+static list_t *_ckpt_evlist;
+
+static bool _ckpt_collect (Event *e)
+{
+  list_append (_ckpt_evlist, e);
+  return false;
+}
+
+/* snapshot of the pending event queue */
+static list_t *_ckpt_pending_events (void)
+{
+  _ckpt_evlist = list_new ();
+  SimDES::matchPendingEvent (_ckpt_collect);
+  return _ckpt_evlist;
+}
+
+/* used to move time forward to the checkpoint time */
+class ActSimCkptTick : public SimDES {
+public:
+  int Step (Event */*ev*/) { return 1; }
+};
+static ActSimCkptTick _ckpt_tick;
+
+void ActSim::_saveInst (act_ckpt *ck, ActInstTable *x)
+{
+  if (x->obj) {
+    x->obj->saveState (ck);
+  }
+  if (x->H) {
+    hash_bucket_t *b;
+    hash_iter_t i;
+    hash_iter_init (x->H, &i);
+    while ((b = hash_iter_next (x->H, &i))) {
+      _saveInst (ck, (ActInstTable *) b->v);
+    }
+  }
+}
+
+void ActSim::_restoreInst (act_ckpt *ck, ActInstTable *x)
+{
+  if (x->obj) {
+    x->obj->restoreState (ck);
+  }
+  if (x->H) {
+    hash_bucket_t *b;
+    hash_iter_t i;
+    hash_iter_init (x->H, &i);
+    while ((b = hash_iter_next (x->H, &i))) {
+      _restoreInst (ck, (ActInstTable *) b->v);
+    }
+  }
+}
+
+/*
+  The design a checkpoint belongs to: the top-level process, the
+  state vector sizes, the number of simulation objects of each kind,
+  and a hash of the instance table (instance names and the process
+  type of each object, in table order).
+*/
+#define ACTSIM_CKPT_FNV_PRIME 0x100000001b3UL
+
+static void _ckpt_hash (unsigned long *h, const void *p, size_t n)
+{
+  const unsigned char *c = (const unsigned char *) p;
+  for (size_t i=0; i < n; i++) {
+    *h = (*h ^ c[i]) * ACTSIM_CKPT_FNV_PRIME;
+  }
+}
+
+static void _ckpt_hash_inst (act_ckpt_design *d, ActInstTable *x)
+{
+  if (x->obj) {
+    Process *p = x->obj->getProc ();
+    int k;
+    if (dynamic_cast <ChpSim *> (x->obj)) {
+      k = 0;
+    }
+    else if (dynamic_cast <PrsSim *> (x->obj)) {
+      k = 1;
+    }
+    else {
+      k = 2;
+    }
+    d->nobj[k]++;
+    _ckpt_hash (&d->inst, &k, sizeof (int));
+    if (p) {
+      _ckpt_hash (&d->inst, p->getName (), strlen (p->getName ()) + 1);
+    }
+  }
+  if (x->H) {
+    hash_bucket_t *b;
+    hash_iter_t i;
+    hash_iter_init (x->H, &i);
+    while ((b = hash_iter_next (x->H, &i))) {
+      _ckpt_hash (&d->inst, b->key, strlen (b->key) + 1);
+      _ckpt_hash_inst (d, (ActInstTable *) b->v);
+    }
+  }
+}
+
+void ActSim::_ckptDesign (act_ckpt_design *d)
+{
+  d->top = (simroot ? simroot->getName () : "");
+  d->nbools = state->numBools ();
+  d->nints = state->numInts ();
+  d->nchans = state->numChans ();
+  d->nobj[0] = d->nobj[1] = d->nobj[2] = 0;
+  d->inst = 0xcbf29ce484222325UL;
+  _ckpt_hash_inst (d, &I);
+}
+
+/*
+  Pending events that a checkpoint records: production rule
+  transitions (directly or through the timing wheel), the delta-cycle
+  list, and CHP program counters. Returns a description of the first
+  other kind of event found, or NULL.
+*/
+static const char *_ckpt_unsaved (list_t *l)
+{
+  for (listitem_t *li = list_first (l); li; li = list_next (li)) {
+    Event *e = (Event *) list_value (li);
+    SimDES *o = e->getObj ();
+    OnePrsSim *r;
+    if ((r = dynamic_cast <OnePrsSim *> (o))) {
+      if (!r->isPendingEvent (e)) {
+	return "single-event upset or delay";
+      }
+    }
+    else if (dynamic_cast <XyceSim *> (o)) {
+      return "analog (Xyce)";
+    }
+    else if (!dynamic_cast <PrsSimWheel *> (o) &&
+	     !dynamic_cast <PrsSimDelta *> (o) &&
+	     !dynamic_cast <ChpSim *> (o)) {
+      return "channel trace or other";
+    }
+  }
+  return NULL;
+}
+
+int ActSim::saveSim (FILE *fp)
+{
+  act_ckpt ck;
+  act_ckpt_design d;
+  list_t *l;
+  listitem_t *li;
+  phash_bucket_t *b;
+  phash_iter_t it;
+  const char *msg;
+  BigInt tm = SimDES::CurTime ();
+
+  l = _ckpt_pending_events ();
+  if ((msg = _ckpt_unsaved (l))) {
+    fprintf (stderr, "Checkpoint: %s events are pending and cannot be saved\n", msg);
+    list_free (l);
+    return 0;
+  }
+
+  ck.fp = fp;
+  ck.buf = NULL;
+  ck.len = 0;
+  ck.pos = 0;
+  ck.now = tm.getVal (0);
+  ck.dry = 0;
+  ck.err = 0;
+  ck.dirty = phash_new (4);
+  ck.ndirty = OnePrsSim::deltaPending (ck.dirty);
+  ck.dirty_rule = NULL;
+
+  /* group pending events by object; ChpSim uses this to record
+     which threads are runnable */
+  ck.ev = phash_new (8);
+  for (li = list_first (l); li; li = list_next (li)) {
+    Event *e = (Event *) list_value (li);
+    b = phash_lookup (ck.ev, e->getObj());
+    if (!b) {
+      b = phash_add (ck.ev, e->getObj());
+      b->v = list_new ();
+    }
+    list_iappend ((list_t *)b->v, e->getType());
+  }
+  list_free (l);
+
+  _ckptDesign (&d);
+  ckpt_put_ulong (&ck, ACTSIM_CKPT_MAGIC);
+  ckpt_put_int (&ck, ACTSIM_CKPT_VERSION);
+  ckpt_put_int (&ck, strlen (d.top));
+  ckpt_put (&ck, d.top, strlen (d.top));
+  ckpt_put_int (&ck, d.nbools);
+  ckpt_put_int (&ck, d.nints);
+  ckpt_put_int (&ck, d.nchans);
+  for (int i=0; i < 3; i++) {
+    ckpt_put_int (&ck, d.nobj[i]);
+  }
+  ckpt_put_ulong (&ck, d.inst);
+  ckpt_put_int (&ck, tm.getLen ());
+  for (int i=0; i < tm.getLen (); i++) {
+    ckpt_put_ulong (&ck, tm.getVal (i));
+  }
+  ckpt_put_int (&ck, isResetMode());
+  ckpt_put_int (&ck, ck.ndirty);
+
+  state->saveState (&ck);
+  _saveInst (&ck, &I);
+
+  phash_iter_init (ck.ev, &it);
+  while ((b = phash_iter_next (ck.ev, &it))) {
+    list_free ((list_t *)b->v);
+  }
+  phash_free (ck.ev);
+  phash_free (ck.dirty);
+  return ck.err ? 0 : 1;
+}
+
+/*
+  Parse the checkpoint header and check it against the design d.
+  The saved time is returned in tm[0..*ntm-1]; returns 0 if the
+  checkpoint is not usable.
+*/
+static int _ckpt_header (act_ckpt *ck, act_ckpt_design *d, int *mode,
+			 unsigned long **tm, int *ntm)
+{
+  act_ckpt_design x;
+  int len;
+
+  *tm = NULL;
+  *ntm = 0;
+  if (ckpt_get_ulong (ck) != ACTSIM_CKPT_MAGIC) {
+    ckpt_error (ck, "not an actsim checkpoint file");
+    return 0;
+  }
+  if (ckpt_get_int (ck) != ACTSIM_CKPT_VERSION) {
+    ckpt_error (ck, "unsupported checkpoint version");
+    return 0;
+  }
+  len = ckpt_get_int (ck);
+  if (ck->err || len < 0 || (size_t)len > ck->len - ck->pos) {
+    ckpt_error (ck, "corrupt checkpoint header");
+    return 0;
+  }
+  if ((size_t)len != strlen (d->top) ||
+      memcmp (ck->buf + ck->pos, d->top, len) != 0) {
+    ckpt_error (ck, "checkpoint was saved for a different top-level process");
+    return 0;
+  }
+  ck->pos += len;
+  x.nbools = ckpt_get_int (ck);
+  x.nints = ckpt_get_int (ck);
+  x.nchans = ckpt_get_int (ck);
+  for (int i=0; i < 3; i++) {
+    x.nobj[i] = ckpt_get_int (ck);
+  }
+  x.inst = ckpt_get_ulong (ck);
+  if (ck->err) {
+    return 0;
+  }
+  if (x.nbools != d->nbools || x.nints != d->nints ||
+      x.nchans != d->nchans || x.nobj[0] != d->nobj[0] ||
+      x.nobj[1] != d->nobj[1] || x.nobj[2] != d->nobj[2] ||
+      x.inst != d->inst) {
+    ckpt_error (ck, "checkpoint was saved for a different design");
+    return 0;
+  }
+  *ntm = ckpt_get_int (ck);
+  if (ck->err || *ntm < 1 ||
+      (size_t)*ntm > (ck->len - ck->pos)/sizeof (unsigned long)) {
+    ckpt_error (ck, "corrupt checkpoint header");
+    return 0;
+  }
+  MALLOC (*tm, unsigned long, *ntm);
+  for (int i=0; i < *ntm; i++) {
+    (*tm)[i] = ckpt_get_ulong (ck);
+  }
+  ck->now = (*tm)[0];
+  *mode = ckpt_get_int (ck);
+  ck->ndirty = ckpt_get_int (ck);
+  if (ck->ndirty < 0) {
+    ckpt_error (ck, "corrupt checkpoint header");
+  }
+  return ck->err ? 0 : 1;
+}
+
+/* compare the current simulation time with tm[0..n-1] */
+static int _ckpt_tcmp (const unsigned long *tm, int n)
+{
+  BigInt cur = SimDES::CurTime ();
+  int len = cur.getLen ();
+  for (int i=(len > n ? len : n)-1; i >= 0; i--) {
+    unsigned long a = (i < len ? cur.getVal (i) : 0);
+    unsigned long b = (i < n ? tm[i] : 0);
+    if (a != b) {
+      return (a < b ? -1 : 1);
+    }
+  }
+  return 0;
+}
+
+int ActSim::restoreSim (FILE *fp)
+{
+  act_ckpt ck;
+  act_ckpt_design d;
+  struct stat sb;
+  void *map = NULL;
+  unsigned char *data = NULL;
+  unsigned long *tm = NULL;
+  int ntm;
+  list_t *l;
+  listitem_t *li;
+  int mode;
+  int ret = 0;
+
+  /* map the file if we can, otherwise read it in */
+  fflush (fp);
+  if (fstat (fileno (fp), &sb) == 0 && S_ISREG (sb.st_mode) &&
+      sb.st_size > 0) {
+    map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno (fp), 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+    }
+    else {
+      ck.buf = (const unsigned char *) map;
+      ck.len = sb.st_size;
+    }
+  }
+  if (!map) {
+    size_t sz = 0, max = 65536, n;
+    MALLOC (data, unsigned char, max);
+    while ((n = fread (data + sz, 1, max - sz, fp)) > 0) {
+      sz += n;
+      if (sz == max) {
+	max *= 2;
+	REALLOC (data, unsigned char, max);
+      }
+    }
+    ck.buf = data;
+    ck.len = sz;
+  }
+  ck.fp = NULL;
+  ck.ev = NULL;
+  ck.dirty = NULL;
+  ck.dirty_rule = NULL;
+
+  /*-- check the whole image before changing anything --*/
+  ck.pos = 0;
+  ck.dry = 1;
+  ck.err = 0;
+  _ckptDesign (&d);
+  if (!_ckpt_header (&ck, &d, &mode, &tm, &ntm)) {
+    goto done;
+  }
+  if (_ckpt_tcmp (tm, ntm) > 0) {
+    fprintf (stderr, "Checkpoint: saved at an earlier time than the current simulation time; re-initialize first\n");
+    goto done;
+  }
+  state->restoreState (&ck);
+  if (!ck.err) {
+    _restoreInst (&ck, &I);
+  }
+  if (ck.err) {
+    goto done;
+  }
+
+  /*-- apply it --*/
+  ck.pos = 0;
+  ck.dry = 0;
+  FREE (tm);
+  _ckpt_header (&ck, &d, &mode, &tm, &ntm);
+  if (ck.ndirty > 0) {
+    MALLOC (ck.dirty_rule, OnePrsSim *, ck.ndirty);
+    for (int i=0; i < ck.ndirty; i++) {
+      ck.dirty_rule[i] = NULL;
+    }
+  }
+
+  /* drop all pending events; cancelled timing wheel entries are
+     discarded when their slot drains */
+  OnePrsSim::flushWheel ();
+  OnePrsSim::flushDelta ();
+  l = _ckpt_pending_events ();
+  for (li = list_first (l); li; li = list_next (li)) {
+    Event *e = (Event *) list_value (li);
+    OnePrsSim *o = dynamic_cast <OnePrsSim *> (e->getObj());
+    if (o && o->isPendingEvent (e)) {
+      o->flushPending ();
+      continue;
+    }
+    if (dynamic_cast <PrsSimWheel *> (e->getObj())) {
+      continue;
+    }
+    e->Remove ();
+  }
+  list_free (l);
+
+  /* move time forward; the low word of the difference is a lower
+     bound on it, unless it is zero */
+  while (_ckpt_tcmp (tm, ntm) < 0) {
+    unsigned long lo = SimDES::CurTimeLo();
+    unsigned long dt = tm[0] - lo;
+    if (dt == 0 || dt > (1UL << 30)) {
+      dt = (1UL << 30);
+    }
+    ActEvent::make (&_ckpt_tick, SIM_EV_MKTYPE (0, 0), dt);
+    SimDES::AdvanceTime (dt);
+    if (SimDES::CurTimeLo() == lo) {
+      fprintf (stderr, "Checkpoint: could not advance to the saved time; pending events were dropped\n");
+      goto done;
+    }
+  }
+
+  setMode (mode);
+  state->restoreState (&ck);
+  if (_sop) {
+    _sop->resync (this);
+  }
+  _restoreInst (&ck, &I);
+
+  /* rules that were waiting for a delta-cycle evaluation, in their
+     original order */
+  for (int i=0; i < ck.ndirty; i++) {
+    if (ck.dirty_rule[i]) {
+      ck.dirty_rule[i]->propagate ();
+    }
+  }
+
+  if (ck.pos != ck.len) {
+    warning ("Checkpoint: %lu trailing bytes ignored",
+	     (unsigned long)(ck.len - ck.pos));
+  }
+  ret = 1;
+
+done:
+  if (tm) {
+    FREE (tm);
+  }
+  if (ck.dirty_rule) {
+    FREE (ck.dirty_rule);
+  }
+  if (map) {
+    munmap (map, ck.len);
+  }
+  if (data) {
+    FREE (data);
+  }
+  return ret;
+}
+
+
 void ActSimCore::logFilter (const char *s)
 {
   if (s[0] == '\0') {
@@ -2677,19 +3456,22 @@ void ActSimCore::recordTrace (const watchpt_bucket *w, int type,
 
   BigInt tm = SimDES::CurTime();
   int len = tm.getLen();
-  unsigned long v;
-  unsigned long *ptm;
-  if (len == 1) {
-    v = tm.getVal (0);
-    ptm = &v;
+  unsigned long tbuf[TRACE_WORDS], vbuf[TRACE_WORDS];
+  unsigned long *ptm, *valp;
+  int kind, vlen;
+
+  if (len <= TRACE_WORDS) {
+    ptm = tbuf;
   }
   else {
     MALLOC (ptm, unsigned long, len);
-    for (int i=0; i < len; i++) {
-      ptm[i] = tm.getVal (i);
-    }
   }
-  
+  for (int i=0; i < len; i++) {
+    ptm[i] = tm.getVal (i);
+  }
+
+  valp = vbuf;
+  vlen = 1;
   if (type == 0) {
     int v = val.getVal (0);
     if (v == 0) {
@@ -2701,59 +3483,33 @@ void ActSimCore::recordTrace (const watchpt_bucket *w, int type,
     else if (v == 2) {
       v = ACT_SIG_BOOL_X;
     }
-    for (int fmt=0; fmt < TRACE_NUM_FORMATS; fmt++) {
-      if (!((w->ignore_fmt >> fmt) & 1)) {
-	if (act_trace_has_alt (_trfn[fmt])) {
-	  act_trace_digital_change_alt (_tr[fmt], w->node[fmt],
-					len, ptm, v);
-	}
-	else {
-	  act_trace_digital_change (_tr[fmt], w->node[fmt], cur_time, v);
-	}
-      }
-    }
+    kind = TRW_DIGITAL;
+    vbuf[0] = v;
   }
   else if (type == 1) {
     if (ACT_TRACE_WIDE_NUM (val.getWidth()) <= 1) {
-      for (int fmt=0; fmt < TRACE_NUM_FORMATS; fmt++) {
-	if (!((w->ignore_fmt >> fmt) & 1)) {
-	  if (act_trace_has_alt (_trfn[fmt])) {
-	    act_trace_digital_change_alt (_tr[fmt], w->node[fmt], len, ptm,
-					  val.getVal (0));
-	  }
-	  else {
-	    act_trace_digital_change (_tr[fmt], w->node[fmt], cur_time,
-				      val.getVal (0));
-	  }
-	}
-      }
+      kind = TRW_DIGITAL;
+      vbuf[0] = val.getVal (0);
     }
     else {
-      unsigned long *valp;
-      MALLOC (valp, unsigned long, val.getLen());
-      for (int i=0; i < val.getLen(); i++) {
-	valp[i] = val.getVal (i);
+      kind = TRW_WIDE_DIGITAL;
+      vlen = val.getLen();
+      if (vlen > TRACE_WORDS) {
+	MALLOC (valp, unsigned long, vlen);
       }
-      for (int fmt=0; fmt < TRACE_NUM_FORMATS; fmt++) {
-	if (!((w->ignore_fmt >> fmt) & 1)) {
-	  if (act_trace_has_alt (_trfn[fmt])) {
-	    act_trace_wide_digital_change_alt (_tr[fmt], w->node[fmt], len, ptm,
-					   val.getLen(), valp);
-	  }
-	  else {
-	    act_trace_wide_digital_change (_tr[fmt], w->node[fmt], cur_time,
-					   val.getLen(), valp);
-	  }
-	}
+      for (int i=0; i < vlen; i++) {
+	valp[i] = val.getVal (i);
       }
-      FREE (valp);
     }
   }
   else if (type == 2) {
     if (ACT_TRACE_WIDE_NUM (val.getWidth()) > 1) {
-      unsigned long *valp;
-      MALLOC (valp, unsigned long, ACT_TRACE_WIDE_NUM (val.getWidth()));
-      for (int i=0; i < ACT_TRACE_WIDE_NUM(val.getWidth()); i++) {
+      kind = TRW_WIDE_CHAN;
+      vlen = ACT_TRACE_WIDE_NUM (val.getWidth());
+      if (vlen > TRACE_WORDS) {
+	MALLOC (valp, unsigned long, vlen);
+      }
+      for (int i=0; i < vlen; i++) {
 	if (i < val.getLen()) {
 	  valp[i] = val.getVal (i);
 	}
@@ -2761,40 +3517,28 @@ void ActSimCore::recordTrace (const watchpt_bucket *w, int type,
 	  valp[i] = 0;
 	}
       }
-      for (int fmt = 0; fmt < TRACE_NUM_FORMATS; fmt++) {
-	if (!((w->ignore_fmt >> fmt) & 1)) {
-	  if (act_trace_has_alt (_trfn[fmt])) {
-	    act_trace_wide_chan_change_alt (_tr[fmt], w->node[fmt], len, ptm,
-					    state,
-					    ACT_TRACE_WIDE_NUM (val.getWidth()),
-					    valp);
-	  }
-	  else {
-	    act_trace_wide_chan_change (_tr[fmt], w->node[fmt], cur_time,
-					state,
-					ACT_TRACE_WIDE_NUM (val.getWidth()),
-					valp);
-	  }
-	}
-      }
-      FREE (valp);
     }
     else {
-      for (int fmt = 0; fmt < TRACE_NUM_FORMATS; fmt++) {
-	if (!((w->ignore_fmt >> fmt) & 1)) {
-	  if (act_trace_has_alt (_trfn[fmt])) {
-	    act_trace_chan_change_alt (_tr[fmt], w->node[fmt], len, ptm, state,
-				       val.getVal (0));
-	  }
-	  else {
-	    act_trace_chan_change (_tr[fmt], w->node[fmt], cur_time, state,
-				   val.getVal (0));
-	  }
-	}
+      kind = TRW_CHAN;
+      vbuf[0] = val.getVal (0);
+    }
+  }
+  else {
+    kind = -1;
+  }
+
+  if (kind != -1) {
+    for (int fmt=0; fmt < TRACE_NUM_FORMATS; fmt++) {
+      if (!((w->ignore_fmt >> fmt) & 1)) {
+	traceChange (fmt, kind, w->node[fmt], cur_time, len, ptm,
+		     state, vlen, valp);
       }
     }
   }
-  if (len > 1) {
+  if (valp != vbuf) {
+    FREE (valp);
+  }
+  if (ptm != tbuf) {
     FREE (ptm);
   }
 }
@@ -2806,6 +3550,11 @@ int ActSimCore::initTrace (int fmt, const char *file)
 
   Assert (0 <= fmt && fmt < TRACE_NUM_FORMATS, "Illegal format!");
 
+  /*-- write out any queued changes before the trace is closed --*/
+  if (_trw[fmt]) {
+    delete _trw[fmt];
+    _trw[fmt] = NULL;
+  }
   if (_tr[fmt]) {
     act_trace_close (_tr[fmt]);
   }
@@ -2827,7 +3576,8 @@ int ActSimCore::initTrace (int fmt, const char *file)
   }
 
   if (!_trfn[fmt]) {
-    _trfn[fmt] = act_trace_load_format (_trname[fmt], NULL);
+    _trfn[fmt] = act_trace_load_format (_trname[fmt],
+					trLibrary (_trname[fmt]));
   }
   if (!_trfn[fmt]) {
     return 0;
@@ -2986,6 +3736,9 @@ int ActSimCore::initTrace (int fmt, const char *file)
     }
     act_trace_init_end (_tr[fmt]);
   }
+  if (_trace_ring > 0) {
+    _trw[fmt] = new TraceWriter (_tr[fmt], _trace_ring);
+  }
   return 1;
 }
 
@@ -3071,6 +3824,7 @@ void ActSimCore::checkFragmentation (act_connection *idc, ActId *rid, ActSimObj
 	  sim_recordChannel (this, obj, tmp);
 	  registerFragmented (ch->ct);
 	  ch->cm = getFragmented (ch->ct);
+	  ch->cm->bind (ch);
 	  setsi (mysi);
 
 	  ActId *xtmp = tmp;
@@ -32,9 +32,11 @@
 #include <stdlib.h>
 #include <math.h>
 #include <common/int.h>
+#include <type_traits>
 #include "actsim_ext.h"
 #include "state.h"
 #include "channel.h"
+#include "trwriter.h"
 
 #define E_CHP_VARBOOL  (E_NEWEND + 1)
 #define E_CHP_VARINT   (E_NEWEND + 2)
@@ -52,6 +54,10 @@
 #define E_CHP_VARSTRUCT_DEREF (E_NEWEND + 10)
 #define E_CHP_VARSTRUCT       (E_NEWEND + 11)
 
+/* Boolean at global offset u.x.val; u.x.extra is its act_connection,
+   for messages. Used in channel methods bound to a channel. */
+#define E_CHP_VARBOOL_GLOBAL  (E_NEWEND + 12)
+
 /*
  *
  * Core simulation library
@@ -73,7 +79,9 @@ class OnePrsSim;
 
 class ActSimState {
 public:
-  ActSimState (int bools, int ints, int chans);
+  /* planes=1 stores Boolean values and X bits in separate dense
+     bit planes, with the special/mask flags kept apart */
+  ActSimState (int bools, int ints, int chans, int planes = 0);
   ~ActSimState ();
 
   BigInt *getInt (int x);
@@ -94,8 +102,8 @@ public:
    * @return true 
    * @return false 
    */
-  inline bool isSpecialBool (int x) { return bitset_tst (bits, 6*x+2); }
-  void mkSpecialBool (int x) { bitset_set (bits, 6*x+2); }
+  inline bool isSpecialBool (int x) { return bitset_tst (bits, _fl (x, 2)); }
+  void mkSpecialBool (int x) { bitset_set (bits, _fl (x, 2)); }
 
   /**
    * @brief Set the value of the node
@@ -130,7 +138,7 @@ public:
    * @return true The true value is hidden
    * @return false The value displayed is not externally forced
    */
-  inline bool isMasked (unsigned int x) { return bitset_tst(bits, 6*x+3); }
+  inline bool isMasked (unsigned int x) { return bitset_tst(bits, _fl (x, 3)); }
 
   /**
    * @brief Restore the true value of the node
@@ -145,9 +153,22 @@ public:
 
   act_channel_state *getChan (int x);
   int numChans () { return nchans; }
+  int numBools () { return nbools; }
+  int numInts () { return nints; }
+
+  /* value and X planes; NULL unless the bit-plane layout is used */
+  const unsigned long *valuePlane () { return _pv; }
+  const unsigned long *xPlane () { return _px; }
+
+  /* number of Booleans with value v (0, 1, or 2 for X) */
+  int countBools (int v);
 
   void *allocState (int sz);
 
+  /* binary checkpoint of the state vector */
+  void saveState (act_ckpt *ck);
+  void restoreState (act_ckpt *ck);
+
   void mkHazard (int v) {
     if (!hazards && nbools > 0) {
       hazards = bitset_new (nbools);
@@ -166,8 +187,20 @@ public:
 
 private:
   bitset_t *hazards;		/* hazard information */
-  bitset_t *bits;		/* Booleans */
+  bitset_t *bits;		/* Booleans: 6 flag bits per node, or
+				   only the special/mask flags (4 per
+				   node) in the bit-plane layout */
   int nbools;			/* # of Booleans */
+
+  unsigned int _planes:1;	/* bit-plane layout in use */
+  unsigned long *_pv;		/* value plane */
+  unsigned long *_px;		/* X plane */
+
+  /* index of flag f >= 2 for node x in bits */
+  inline int _fl (int x, int f) { return _planes ? 4*x + (f-2) : 6*x + f; }
+  int _tst (int x, int f);
+  void _set (int x, int f);
+  void _clr (int x, int f);
   
   BigInt *ival;			/* integers */
   int nints;			/* number of integers */
@@ -180,12 +213,49 @@ private:
 };
 
 
+/* kinds of fanout destinations, used to dispatch propagate() */
+#define ACTSIM_FO_OTHER 0
+#define ACTSIM_FO_PRS   1	/* OnePrsSim */
+#define ACTSIM_FO_CHP   2	/* ChpSim */
+#define ACTSIM_FO_XYCE  3	/* XyceSim */
+#define ACTSIM_FO_MIXED 4
+
 class ActSimDES : public SimDES {
 public:
   virtual ~ActSimDES() { };
   virtual void propagate () { };
 };
 
+
+/*
+ * Pool for simulation events. Events are carved out of cache-line
+ * aligned slabs and recycled through a freelist instead of going
+ * through malloc/free on every transition.
+ *
+ * The SimDES core deletes an event through an Event pointer once it
+ * has been dispatched, so that delete only reaches
+ * ActEvent::operator delete if Event has a virtual destructor.
+ */
+class ActEvent : public Event {
+public:
+  ActEvent (SimDES *s, int type, int delay) : Event (s, type, delay) { }
+
+  static void *operator new (size_t sz);
+  static void operator delete (void *p, size_t sz);
+
+  /* schedule an event of <type> on <s> after <delay> */
+  static Event *make (SimDES *s, int type, int delay) {
+    return new ActEvent (s, type, delay);
+  }
+
+private:
+  static void *_free;		// freelist, linked through the first word
+  static size_t _esz;		// rounded element size
+};
+
+static_assert (std::has_virtual_destructor<Event>::value,
+	       "the event pool needs a virtual Event destructor");
+
 class ActSimObj;
 
 struct ActInstTable {
@@ -225,6 +295,10 @@ public:
   virtual void propagate ();
   virtual void computeFanout() { printf ("should not be here\n"); }
 
+  /* checkpoint any per-object simulation state */
+  virtual void saveState (act_ckpt *) { }
+  virtual void restoreState (act_ckpt *) { }
+
   /* manipulate object watchpoint, using local index values */
   void addWatchPoint (int type, int idx, const char *name);
   void toggleBreakPt (int type, int idx, const char *name);
@@ -327,6 +401,7 @@ public:
 class ChpSimGraph;
 class ChpSim;
 class PrsSim;
+class PrsSopIndex;
 class XyceSim;
 
 /*
@@ -369,7 +444,15 @@ class ActSimCore {
    * @return true Value change succeeded
    * @return false Value change failed, likely because of a constraint violation
    */
-  bool setBool (int x, int v) { return state->setBool (x, v); }
+  bool setBool (int x, int v) {
+    if (!_sop) {
+      return state->setBool (x, v);
+    }
+    int ov = state->getBool (x);
+    bool ret = state->setBool (x, v);
+    _sopChange (x, ov);
+    return ret;
+  }
 
   /**
    * @brief Set the node to a forced value and mask the currently displayed value
@@ -386,7 +469,15 @@ class ActSimCore {
    * @param x Global offset of the node
    * @param v Value to force the node to
    */
-  void setForced (int x, int v) { state->setForced (x, v); }
+  void setForced (int x, int v) {
+    if (!_sop) {
+      state->setForced (x, v);
+      return;
+    }
+    int ov = state->getBool (x);
+    state->setForced (x, v);
+    _sopChange (x, ov);
+  }
 
   /**
    * @brief Test if the current node is masked by a forced value
@@ -406,7 +497,15 @@ class ActSimCore {
    * @return true The node was successfully unmasked
    * @return false The node was not masked to begin with
    */
-  bool unmask (int x) { return state->unmask (x); }
+  bool unmask (int x) {
+    if (!_sop) {
+      return state->unmask (x);
+    }
+    int ov = state->getBool (x);
+    bool ret = state->unmask (x);
+    _sopChange (x, ov);
+    return ret;
+  }
 
   /**
    * @brief The node has metadata attached to it (like constraints)
@@ -460,9 +559,21 @@ class ActSimCore {
 #endif
 
   void incFanout (int off, int type, SimDES *who);
-  int numFanout (int off, int type) { if (type == 0) return nfo[off]; else return nfo[off+nint_start];
-}
-  SimDES **getFO (int off, int type) { if (type == 0) { return fo[off]; } else { return fo[off+nint_start]; } }
+  struct fanout_pair {
+    int off;			// variable
+    int seq;			// insertion order
+    SimDES *who;		// destination
+  };
+  void propagateFanout (int off, int type);
+  int numFanout (int off, int type) { if (type != 0) { off += nint_start; } _foSync (); return fo_start[off+1] - fo_start[off]; }
+  /* destinations of a variable, and their number in *n; valid until
+     the next incFanout() */
+  SimDES **getFanout (int off, int type, int *n) {
+    if (type != 0) { off += nint_start; }
+    _foSync ();
+    *n = fo_start[off+1] - fo_start[off];
+    return fo + fo_start[off];
+  }
     
   void logFilter (const char *s);
   int isFiltered (const char *s);
@@ -470,13 +581,14 @@ class ActSimCore {
   void setMode (int mode) { _prs_sim_mode = mode; }
   void setRandom () { _sim_rand = 1; }
   void setNoRandom() { _sim_rand = 0; }
+  int isRandom() { return _sim_rand; }
   void setRandom (int min, int max) {
     _sim_rand = 2; _rand_min = min; _rand_max = max;
   }
   void setLocalRandom (int min, int max) {
     _sim_rand = 3; _rand_min = min; _rand_max = max;
   }
-  void setRandomSeed (unsigned seed) { _seed = seed; }
+  void setRandomSeed (unsigned seed) { _seed = seed; _rngSeed (); }
   void setRandomChoice (int v) { _sim_rand_excl = v; }
   int isRandomChoice() { return _sim_rand_excl; }
   int isResetMode() { return _prs_sim_mode; }
@@ -492,12 +604,62 @@ class ActSimCore {
 
 #define LN_MAX_VAL 11.0903548889591  /* log(1 << 16) */
 
+/*
+ * sim.fast_rng: delays are drawn from a per-simulator xoshiro256**
+ * generator, and the log-uniform distribution is read from a table
+ * indexed by the top ACTSIM_LOGTAB_BITS of the sample and linearly
+ * interpolated with the rest. Otherwise rand_r() is used as before,
+ * and a given seed produces the same delays as earlier versions.
+ */
+#define ACTSIM_LOGTAB_BITS 12
+
+  inline unsigned long _rngNext () {
+    unsigned long *x = _rng;
+    unsigned long r = x[1]*5;
+    unsigned long t = x[1] << 17;
+    r = ((r << 7) | (r >> 57))*9;
+    x[2] ^= x[0];
+    x[3] ^= x[1];
+    x[1] ^= x[2];
+    x[0] ^= x[3];
+    x[2] ^= t;
+    x[3] = (x[3] << 45) | (x[3] >> 19);
+    return r;
+  }
+
+  /* log-uniform over [0, 1 << 16) */
+  inline unsigned long _randLog () {
+    if (!_fast_rng) {
+      double d = (0.0 + rand_r (&_seed))/RAND_MAX;
+      return exp(d*LN_MAX_VAL)-1;
+    }
+    unsigned long r = _rngNext ();
+    unsigned long k = r >> (64 - ACTSIM_LOGTAB_BITS);
+    double f = (r & ((1UL << (64 - ACTSIM_LOGTAB_BITS)) - 1))*
+      (1.0/(1UL << (64 - ACTSIM_LOGTAB_BITS)));
+    return _logtab[k] + f*(_logtab[k+1] - _logtab[k]);
+  }
+
+  /* uniform over [lo, hi] */
+  inline unsigned long _randRange (int lo, int hi) {
+    if (!_fast_rng) {
+      double d = (0.0 + rand_r (&_seed))/RAND_MAX;
+      return lo + d*(hi - lo);
+    }
+    if (hi <= lo) {
+      return lo;
+    }
+    return lo + (((_rngNext () >> 32)*(unsigned long)(hi - lo + 1)) >> 32);
+  }
+
   inline int getRandom (int range) {
+    if (_fast_rng) {
+      return ((_rngNext () >> 32)*(unsigned long)range) >> 32;
+    }
     return rand_r (&_seed) % range;
   }
 
   inline int getDelay (int delay) {
-    double d;
     unsigned long val;
 
     // check if randomness was turned off or the bound is 0
@@ -506,15 +668,13 @@ class ActSimCore {
     }
     // if global randomness was selected, select a value from the absolute range
     else if (_sim_rand == 1) {
-      d = (0.0 + rand_r (&_seed))/RAND_MAX;
-      val = exp(d*LN_MAX_VAL)-1;
+      val = _randLog ();
     }
     // if globally constrained random was selected, select something between the global bounds
     // if we are in locally constrained random mode, whatever called this does not support it,
     // use the global bounds instead
     else if (_sim_rand == 2 || _sim_rand == 3) {
-      d = (0.0 + rand_r (&_seed))/RAND_MAX;
-      val = _rand_min + d*(_rand_max - _rand_min);
+      val = _randRange (_rand_min, _rand_max);
     }
     else {
       val = 0;
@@ -524,7 +684,6 @@ class ActSimCore {
   }
 
   inline int getDelay (int lower_bound, int upper_bound) {
-    double d;
     unsigned long val;
 
     // check if randomness was turned off or both bounds are 0
@@ -533,18 +692,15 @@ class ActSimCore {
     }
     // if global randomness was selected, select a value from the absolute range
     else if (_sim_rand == 1) {
-      d = (0.0 + rand_r (&_seed))/RAND_MAX;
-      val = exp(d*LN_MAX_VAL)-1;
+      val = _randLog ();
     }
     // if globally constrained random was selected, select something between the global bounds
     else if (_sim_rand == 2) {
-      d = (0.0 + rand_r (&_seed))/RAND_MAX;
-      val = _rand_min + d*(_rand_max - _rand_min);
+      val = _randRange (_rand_min, _rand_max);
     }
     // if locally constrained random was selected, select something between the local bounds
     else if (_sim_rand == 3) {
-      d = (0.0 + rand_r (&_seed))/RAND_MAX;
-      val = lower_bound + d*(upper_bound - lower_bound);
+      val = _randRange (lower_bound, upper_bound);
     }
     else {
       val = 0;
@@ -553,7 +709,14 @@ class ActSimCore {
     return val;
   }
 
+  int fastRng() { return _fast_rng; }
+
   int infLoopOpt() { return _inf_loop_opt; }
+  int chpInt64() { return _chp_int64; }
+  int chpDirect() { return _chp_direct; }
+  int prsLevelize() { return _prs_levelize; }
+  int prsJit() { return _prs_jit; }
+  PrsSopIndex *prsSop() { return _sop; }
 
   void computeFanout (ActInstTable *inst);
 
@@ -583,12 +746,23 @@ class ActSimCore {
     for (int i=0; i < TRACE_NUM_FORMATS; i++) {
       w->node[i] = NULL;
     }
+    _obsUpdate (type, off);
+  }
+
+  /* is there a watchpoint or breakpoint on this object? */
+  inline int isObserved (int type, unsigned long off) {
+    if (type == 3) { type = 2; }
+    return ((off >> 6) < _obs_len[type]) &&
+      ((_obs[type][off >> 6] >> (off & 63)) & 1);
   }
 
   inline const watchpt_bucket *chkWatchPt (int type, unsigned long off) {
     ihash_bucket_t *b;
     watchpt_bucket *w;
     if (type == 3) { type = 2; }
+    if (!isObserved (type, off)) {
+      return nullptr;
+    }
     b = ihash_lookup (_W, ((unsigned long)type) | (off << 2));
     if (b) {
       w = (watchpt_bucket *) b->v;
@@ -609,12 +783,16 @@ class ActSimCore {
       ihash_delete (_W, ((unsigned long)type) | (off << 2));
       FREE (w->s);
       FREE (w);
+      _obsUpdate (type, off);
     }
   }
 
   inline const char *chkBreakPt (int type, unsigned long off) {
     ihash_bucket_t *b;
     if (type == 3) { type = 2; }
+    if (!isObserved (type, off)) {
+      return nullptr;
+    }
     b = ihash_lookup (_B, ((unsigned long)type) | (off << 2));
     if (b) {
       return (char *)b->v;
@@ -636,13 +814,33 @@ class ActSimCore {
       b = ihash_add (_B, ((unsigned long)type) | (off << 2));
       b->v = Strdup (name);
     }
+    _obsUpdate (type, off);
   }
 
+/* time and value words that callers of traceChange() keep on the
+   stack; wider values need a heap buffer */
+#define TRACE_WORDS 4
+
   int initTrace (int fmt, const  char *name); // clear when it is NULL
   act_trace_t *getTrace (int fmt) { return _tr[fmt]; }
   void recordTrace (const watchpt_bucket *w, int type,
 		    act_chan_state_t chan_state, const BigInt &val);
 
+  /* write a change (TRW_...) to the trace in slot fmt; goes through
+     the background writer when sim.trace_async is set */
+  void traceChange (int fmt, int kind, void *node, float tm,
+		    int tlen, unsigned long *ptm,
+		    int state, int vlen, unsigned long *val) {
+    if (_trw[fmt]) {
+      _trw[fmt]->change (kind, node, tm, tlen, ptm, state, vlen, val);
+    }
+    else {
+      TraceWriter::emit (_tr[fmt], kind, node, tm, tlen, ptm,
+			 state, vlen, val);
+    }
+  }
+  TraceWriter *getTraceWriter (int fmt) { return _trw[fmt]; }
+
   void setTimescale (float tm) { _int_to_float_timescale = tm*1e-12; }
   float getTimescale() { return _int_to_float_timescale; }
 
@@ -676,6 +874,17 @@ class ActSimCore {
     return -1;
   }
 
+  /* shared library for the trace formats that come with actsim
+     (ctrace/); NULL for formats found by the trace library itself */
+  static const char *trLibrary (const char *s) {
+    static char buf[1024];
+    if (strcmp (s, "ctr") == 0 && getenv ("ACT_HOME")) {
+      snprintf (buf, 1024, "%s/lib/libactsimtrace_sh.so", getenv ("ACT_HOME"));
+      return buf;
+    }
+    return NULL;
+  }
+
   int useOrAllocTrIndex (const char *s) {
     /* have we loaded this format already? */
     int i = trIndex (s);
@@ -686,7 +895,7 @@ class ActSimCore {
     /* is there an open slot to load the format? */
     for (i=0; i < TRACE_NUM_FORMATS; i++) {
       if (!_trname[i]) {
-	_trfn[i] = act_trace_load_format (s, NULL);
+	_trfn[i] = act_trace_load_format (s, trLibrary (s));
 	if (!_trfn[i]) {
 	  return -1;
 	}
@@ -699,7 +908,8 @@ class ActSimCore {
        one? */
     for (i=0; i < TRACE_NUM_FORMATS; i++) {
       if (!_tr[i]) {
-	act_extern_trace_func_t *tmp = act_trace_load_format (s, NULL);
+	act_extern_trace_func_t *tmp =
+	  act_trace_load_format (s, trLibrary (s));
 	if (!tmp) {
 	  return -1;
 	}
@@ -731,11 +941,25 @@ protected:
 
   int nfo_len;
   int nint_start;
-  int *nfo;			// nbools + nint length (=nfo_len), contains
-				// fanout count for each variable
-  
-  SimDES ***fo;			// fanout destinations
-  struct iHashtable *hfo;	// for high fanout nets
+  /*
+    Fanout tables, in compressed-sparse-row form: the destinations
+    of variable i (bools first, then ints from nint_start) are
+    fo[fo_start[i]] ... fo[fo_start[i+1]-1]. incFanout() only
+    records (variable, destination) pairs; the table is built from
+    them in one pass by _buildFanout(). Pairs added after that are
+    merged in on the next lookup, which rebuilds fo[]; readers take
+    the count and the pointer from a single lookup (getFanout()).
+  */
+  int *fo_start;		// nfo_len + 1 entries
+  SimDES **fo;			// fanout destinations
+  unsigned char *fo_kind;	// ACTSIM_FO_... for each entry of fo[]
+  unsigned char *fo_nkind;	// per variable: the kind shared by all
+				// its destinations, or ACTSIM_FO_MIXED
+
+  A_DECL (fanout_pair, _fo_pend); // pairs not yet in fo[]
+
+  void _buildFanout ();
+  void _foSync () { if (A_LEN (_fo_pend) > 0) { _buildFanout (); } }
 
   struct iHashtable *map;	/* map from process pointer to
 				   process_info */
@@ -782,8 +1006,37 @@ protected:
   struct iHashtable *_W;		/* watchpoints */
   struct iHashtable *_B;		/* breakpoints */
 
+  /* one bit per bool/int/chan: set if the object is in _W or _B, so
+     that unobserved objects do not need a hash lookup */
+  unsigned long *_obs[3];
+  unsigned long _obs_len[3];	/* # of words in _obs[] */
+
+  inline void _obsUpdate (int type, unsigned long off) {
+    unsigned long key = ((unsigned long)type) | (off << 2);
+    unsigned long w = off >> 6;
+    if (w >= _obs_len[type]) {
+      unsigned long len = (_obs_len[type] == 0 ? 4 : _obs_len[type]);
+      while (len <= w) {
+	len = 2*len;
+      }
+      REALLOC (_obs[type], unsigned long, len);
+      for (unsigned long i=_obs_len[type]; i < len; i++) {
+	_obs[type][i] = 0;
+      }
+      _obs_len[type] = len;
+    }
+    if (ihash_lookup (_W, key) || ihash_lookup (_B, key)) {
+      _obs[type][w] |= (1UL << (off & 63));
+    }
+    else {
+      _obs[type][w] &= ~(1UL << (off & 63));
+    }
+  }
+
   act_extern_trace_func_t *_trfn[TRACE_NUM_FORMATS];
   act_trace_t *_tr[TRACE_NUM_FORMATS];
+  TraceWriter *_trw[TRACE_NUM_FORMATS]; // background writer, or NULL
+  int _trace_ring;		// ring words per writer; 0 = synchronous
   static char *_trname[TRACE_NUM_FORMATS];
   float _int_to_float_timescale; // units to convert integer units
 				 // to time
@@ -833,11 +1086,24 @@ protected:
   unsigned int _on_warning:2;	/* 0 = nothing, 1 = break, 2 = exit */
 
   unsigned int _inf_loop_opt:1;	/* turn on infinite loop optimization */
+  unsigned int _chp_int64:1;	/* 64-bit CHP expression fast path */
+  unsigned int _chp_direct:1;	/* complete blocked channel peers
+				   without a wake-up event */
+  unsigned int _prs_levelize:1;	/* levelized combinational prs cones */
+  unsigned int _prs_jit:1;	/* compiled prs rule evaluation */
+
+  PrsSopIndex *_sop;		/* counted SOP networks, or NULL */
+  void _sopChange (int x, int ov);
 
   unsigned int _rand_min, _rand_max;
   
   unsigned _seed;		 /* random seed, if used */
 
+  unsigned int _fast_rng:1;	 /* xoshiro256** instead of rand_r */
+  unsigned long _rng[4];	 /* xoshiro256** state, from _seed */
+  static double _logtab[(1 << ACTSIM_LOGTAB_BITS) + 1];
+  void _rngSeed ();
+
   int _black_box_mode;
 
   A_DECL (int, _rand_init);
@@ -863,14 +1129,20 @@ public:
 
    
 
-  void saveSim (FILE *);
-  void restoreSim (FILE *);
+  int saveSim (FILE *);		// 0 if the checkpoint could not
+				// be written
+  int restoreSim (FILE *);	// 0 if the checkpoint was not usable;
+				// the simulation is then unchanged
 
   ActInstTable *getInstTable () { return &I; }
 
   
 private:
   list_t *_init_simobjs;
+
+  void _ckptDesign (act_ckpt_design *d);
+  void _saveInst (act_ckpt *ck, ActInstTable *x);
+  void _restoreInst (act_ckpt *ck, ActInstTable *x);
 };
 
 void sim_recordChannel (ActSimCore *sc, ActSimObj *c, ActId *id);
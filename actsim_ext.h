@@ -33,4 +33,31 @@ typedef struct expr_res {
 
 #define ACT_EXPR_RES_PRINTF "l"
 
+/*
+ * Wide-argument interface (version 2). Functions listed in the
+ * sim.extern_wide table instead of sim.extern are called as
+ *
+ *    void fn (int nargs, expr_argw *args, expr_argw *ret);
+ *
+ * Each argument is passed at the declared width of the port, as an
+ * array of 64-bit words with the least significant word first. A
+ * structure is passed as its fields flattened in declaration order.
+ * The words of ret are sized for the return type of the function
+ * and are cleared before the call; the function fills them in.
+ * Buffers are owned by the simulator and are only valid during the
+ * call; each call in progress has its own.
+ */
+#define ACTSIM_EXT_ABI_VERSION 2
+
+typedef struct expr_resw {
+  unsigned long *v;		/* value, least significant word first */
+  int nwords;			/* # of words in v */
+  int width;			/* bitwidth */
+} expr_resw;
+
+typedef struct expr_argw {
+  int nvals;			/* 1, or # of fields for a structure */
+  expr_resw *vals;
+} expr_argw;
+
 #endif /* __ACTSIM__EXT_H__ */
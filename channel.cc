@@ -386,6 +386,225 @@ void ChanMethods::_compile (int idx, act_chp_lang *hse)
 }
 
 
+/*
+ * Copy of e with channel Booleans read by global offset. Constants
+ * and self/selfack are shared with e. Returns NULL if e uses
+ * something that is not handled here; the method then evaluates e
+ * itself.
+ */
+static void _chan_free_lowered (Expr *e);
+
+static Expr *_chan_lower (act_channel_state *ch, Expr *e)
+{
+  Expr *ret;
+  ihash_bucket_t *b;
+  act_connection *c;
+  ActId *xid;
+
+  if (!e) return NULL;
+  switch (e->type) {
+  case E_TRUE:
+  case E_FALSE:
+  case E_INT:
+  case E_REAL:
+  case E_SELF:
+  case E_SELF_ACK:
+    return e;
+
+  case E_VAR:
+    xid = (ActId *) e->u.e.l;
+    if (!xid->Rest() && strcmp (xid->getName(), "self") == 0) {
+      return NULL;
+    }
+    c = xid->Canonical (ch->ct->CurScope());
+    b = ihash_lookup (ch->fH, (long)c);
+    if (!b) {
+      return NULL;
+    }
+    NEW (ret, Expr);
+    ret->type = E_CHP_VARBOOL_GLOBAL;
+    ret->u.x.val = b->i;
+    ret->u.x.extra = (unsigned long) c;
+    return ret;
+
+  case E_AND:
+  case E_OR:
+  case E_PLUS:
+  case E_MINUS:
+  case E_MULT:
+  case E_DIV:
+  case E_MOD:
+  case E_LSL:
+  case E_LSR:
+  case E_ASR:
+  case E_XOR:
+  case E_LT:
+  case E_GT:
+  case E_LE:
+  case E_GE:
+  case E_EQ:
+  case E_NE:
+    NEW (ret, Expr);
+    *ret = *e;
+    ret->u.e.l = _chan_lower (ch, e->u.e.l);
+    ret->u.e.r = _chan_lower (ch, e->u.e.r);
+    if (!ret->u.e.l || !ret->u.e.r) {
+      _chan_free_lowered (ret);
+      return NULL;
+    }
+    return ret;
+
+  case E_UMINUS:
+  case E_COMPLEMENT:
+  case E_NOT:
+    NEW (ret, Expr);
+    *ret = *e;
+    ret->u.e.l = _chan_lower (ch, e->u.e.l);
+    if (!ret->u.e.l) {
+      _chan_free_lowered (ret);
+      return NULL;
+    }
+    return ret;
+
+  case E_BUILTIN_BOOL:
+  case E_BUILTIN_INT:
+    NEW (ret, Expr);
+    *ret = *e;
+    ret->u.e.l = _chan_lower (ch, e->u.e.l);
+    if (e->u.e.r) {
+      ret->u.e.r = _chan_lower (ch, e->u.e.r);
+    }
+    if (!ret->u.e.l || (e->u.e.r && !ret->u.e.r)) {
+      _chan_free_lowered (ret);
+      return NULL;
+    }
+    return ret;
+
+  case E_QUERY:
+    NEW (ret, Expr);
+    *ret = *e;
+    NEW (ret->u.e.r, Expr);
+    *ret->u.e.r = *e->u.e.r;
+    ret->u.e.l = _chan_lower (ch, e->u.e.l);
+    ret->u.e.r->u.e.l = _chan_lower (ch, e->u.e.r->u.e.l);
+    ret->u.e.r->u.e.r = _chan_lower (ch, e->u.e.r->u.e.r);
+    if (!ret->u.e.l || !ret->u.e.r->u.e.l || !ret->u.e.r->u.e.r) {
+      _chan_free_lowered (ret);
+      return NULL;
+    }
+    return ret;
+
+  default:
+    return NULL;
+  }
+}
+
+static void _chan_free_lowered (Expr *e)
+{
+  if (!e) return;
+  switch (e->type) {
+  case E_CHP_VARBOOL_GLOBAL:
+    break;
+
+  case E_UMINUS:
+  case E_COMPLEMENT:
+  case E_NOT:
+    _chan_free_lowered (e->u.e.l);
+    break;
+
+  case E_QUERY:
+    _chan_free_lowered (e->u.e.l);
+    _chan_free_lowered (e->u.e.r->u.e.l);
+    _chan_free_lowered (e->u.e.r->u.e.r);
+    FREE (e->u.e.r);
+    break;
+
+  case E_TRUE:
+  case E_FALSE:
+  case E_INT:
+  case E_REAL:
+  case E_SELF:
+  case E_SELF_ACK:
+    /* shared with the original expression */
+    return;
+
+  default:
+    /* binary operators and builtins */
+    _chan_free_lowered (e->u.e.l);
+    _chan_free_lowered (e->u.e.r);
+    break;
+  }
+  FREE (e);
+}
+
+void ChanMethods::bind (act_channel_state *ch)
+{
+  ihash_bucket_t *b;
+  act_connection *c;
+
+  if (ch->prog || !ch->fH) {
+    return;
+  }
+  MALLOC (ch->prog, chan_prog, ACT_NUM_STD_METHODS);
+  for (int idx=0; idx < ACT_NUM_STD_METHODS; idx++) {
+    chan_prog *p = &ch->prog[idx];
+    p->n = A_LEN (_ops[idx].op);
+    p->gid = NULL;
+    p->e = NULL;
+    if (p->n == 0) {
+      continue;
+    }
+    MALLOC (p->gid, int, p->n);
+    MALLOC (p->e, Expr *, p->n);
+    for (int i=0; i < p->n; i++) {
+      p->gid[i] = -1;
+      p->e[i] = NULL;
+      switch (_ops[idx].op[i].type) {
+      case CHAN_OP_BOOL_T:
+      case CHAN_OP_BOOL_F:
+	c = _ops[idx].op[i].var->Canonical (ch->ct->CurScope ());
+	b = ihash_lookup (ch->fH, (long)c);
+	if (!b) {
+	  fatal_error ("%s: Internal error binding method %d",
+		       ch->ct->getName(), idx);
+	}
+	p->gid[i] = b->i;
+	break;
+
+      case CHAN_OP_SELF:
+      case CHAN_OP_SELFACK:
+      case CHAN_OP_SEL:
+	p->e[i] = _chan_lower (ch, _ops[idx].op[i].e);
+	break;
+
+      default:
+	break;
+      }
+    }
+  }
+}
+
+void ChanMethods::unbind (act_channel_state *ch)
+{
+  if (!ch->prog) {
+    return;
+  }
+  for (int idx=0; idx < ACT_NUM_STD_METHODS; idx++) {
+    chan_prog *p = &ch->prog[idx];
+    if (p->n == 0) {
+      continue;
+    }
+    for (int i=0; i < p->n; i++) {
+      _chan_free_lowered (p->e[i]);
+    }
+    FREE (p->gid);
+    FREE (p->e);
+  }
+  FREE (ch->prog);
+  ch->prog = NULL;
+}
+
+
 int ChanMethods::runProbe (ActSimCore *sim,
 			   act_channel_state *ch,
 			   int idx)
@@ -419,15 +638,20 @@ int ChanMethods::runMethod (ActSimCore *sim,
 			    int idx,
 			    int from)
 {
-  ihash_bucket_t *b;
-  act_connection *c;
   int v;
+  int off;
   BigInt r;
+  chan_prog *p;
   
   if (!ch->_dummy) {
     ch->_dummy = new ChpSim (NULL, NULL, sim, NULL);
     ch->_dummy->setFrag (ch);
   }
+  if (!ch->prog) {
+    bind (ch);
+    Assert (ch->prog, "Channel method run before fragment registration");
+  }
+  p = &ch->prog[idx];
 
   ch->_dummy->setNameAlias (ch->inst_id);
   while (from < A_LEN (_ops[idx].op)) {
@@ -442,34 +666,29 @@ int ChanMethods::runMethod (ActSimCore *sim,
 
     case CHAN_OP_BOOL_T:
     case CHAN_OP_BOOL_F:
-      c = _ops[idx].op[from].var->Canonical (ch->ct->CurScope ());
-      b = ihash_lookup (ch->fH, (long)c);
-      if (!b) {
-	fatal_error ("%s: Internal error running method %d", ch->ct->getName(),
-		     idx);
-      }
-      v = ch->_dummy->getBool (b->i);
+      off = p->gid[from];
+      v = ch->_dummy->getBool (off);
       if (_ops[idx].op[from].type == CHAN_OP_BOOL_T) {
 	if (v != 1) {
 #ifdef DUMP_ALL
-	  printf ("nm:g#%d := 1\n", b->i);
+	  printf ("nm:g#%d := 1\n", off);
 #endif	  
-	  ch->_dummy->setBool (b->i, 1);
+	  ch->_dummy->setBool (off, 1);
 	  v = -1;
 	}
       }
       else {
 	if (v != 0) {
-	  ch->_dummy->setBool (b->i, 0);
+	  ch->_dummy->setBool (off, 0);
 #ifdef DUMP_ALL
-	  printf ("nm:g#%d := 0\n", b->i);
+	  printf ("nm:g#%d := 0\n", off);
 #endif	  
 	  v = -1;
 	}
       }
       if (v == -1) {
 	const ActSim::watchpt_bucket *nm;
-	if ((nm = sim->chkWatchPt (0, b->i))) {
+	if ((nm = sim->chkWatchPt (0, off))) {
           BigInt tmpv;
 	  ch->_dummy->msgPrefix ();
 	  printf (" %s := %c\n", nm->s, _ops[idx].op[from].type == CHAN_OP_BOOL_T ?
@@ -477,28 +696,28 @@ int ChanMethods::runMethod (ActSimCore *sim,
           tmpv = (_ops[idx].op[from].type == CHAN_OP_BOOL_T ? 1 : 0);
           sim->recordTrace (nm, 0, ACT_CHAN_IDLE, tmpv);
 	}
-	ch->_dummy->boolProp (b->i);
+	ch->_dummy->boolProp (off);
       }
       from++;
       break;
 
     case CHAN_OP_SELF:
       /* expression evaluation!!! */
-      r = ch->_dummy->exprEval (_ops[idx].op[from].e);
+      r = ch->_dummy->exprEval (p->e[from] ? p->e[from] : _ops[idx].op[from].e);
       ch->data.setSingle (r);
       from++;
       break;
 
     case CHAN_OP_SELFACK:
       /* expression evaluation!!! */
-      r = ch->_dummy->exprEval (_ops[idx].op[from].e);
+      r = ch->_dummy->exprEval (p->e[from] ? p->e[from] : _ops[idx].op[from].e);
       ch->data2.setSingle (r);
       from++;
       break;
       
     case CHAN_OP_SEL:
       /* expression evaluation! */
-      r = ch->_dummy->exprEval (_ops[idx].op[from].e);
+      r = ch->_dummy->exprEval (p->e[from] ? p->e[from] : _ops[idx].op[from].e);
       if (r.getVal (0)) {
 	from++;
       }
@@ -534,6 +753,7 @@ act_channel_state::act_channel_state(expr_multires &vinit)
   data = vinit;
   data2 = vinit;
   w = new WaitForOne(0);
+  waiter = NULL;
   probe = NULL;
   fragmented = 0;
   sfrag_st = 0;
@@ -544,6 +764,7 @@ act_channel_state::act_channel_state(expr_multires &vinit)
   ct = NULL;
   fH = NULL;
   cm = NULL;
+  prog = NULL;
   _dummy = NULL;
   use_flavors = 0;
   send_flavor = 0;
@@ -555,5 +776,6 @@ act_channel_state::act_channel_state(expr_multires &vinit)
 
 act_channel_state::~act_channel_state()
 {
+  ChanMethods::unbind (this);
   delete w;
 }
@@ -26,6 +26,7 @@
 
 class ChanMethods;
 class ChpSim;
+struct chan_prog;
 
 struct act_channel_state {
   /* vinit : initializer for value */
@@ -75,6 +76,7 @@ struct act_channel_state {
   Channel *ct;			// channel type
   ActId *inst_id;		// instance
   ChanMethods *cm;		// fill in channel methods
+  chan_prog *prog;		// cm bound to this channel, per method
   ChpSim *_dummy;
 
   int width;			// bitwidth
@@ -84,6 +86,7 @@ struct act_channel_state {
 				// sender arrives before receive is posted.
   unsigned long count;          // number of completed channel actions
   WaitForOne *w;
+  ChpSim *waiter;		// CHP process last blocked on w
   WaitForOne *probe;		// probe wake-up
 };
 
@@ -161,6 +164,18 @@ struct chan_ops {
   A_DECL (one_chan_op, op);
 };
 
+/*
+ * A method bound to one channel instance: Boolean operands resolved
+ * to global offsets, and guard/self expressions rewritten to read
+ * channel Booleans by offset. Built once by ChanMethods::bind(), so
+ * running a method does no name lookups.
+ */
+struct chan_prog {
+  int n;			// # of ops
+  int *gid;			// per op: BOOL_T/BOOL_F offset, else -1
+  Expr **e;			// per op: lowered SEL/SELF/SELFACK expr
+};
+
 class ChanMethods {
 public:
   ChanMethods (Channel *ch);
@@ -169,6 +184,13 @@ public:
   /* returns -1 when done, otherwise id for resuming */
   int runMethod (ActSimCore *sim, act_channel_state *ch, int idx, int from);
   int runProbe (ActSimCore *sim, act_channel_state *ch, int idx);
+
+  /* resolve the methods for channel ch, once its fragment table is
+     complete */
+  void bind (act_channel_state *ch);
+
+  /* release the bound methods of ch */
+  static void unbind (act_channel_state *ch);
   
 private:
   void _compile (int idx, act_chp_lang *hse);
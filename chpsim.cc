@@ -20,6 +20,7 @@
  **************************************************************************
  */
 #include <stdio.h>
+#include <utility>
 #include <common/config.h>
 #include "chpsim.h"
 #include <common/simdes.h>
@@ -37,6 +38,10 @@ int ChpSimGraph::max_pending_count = 0;
 int ChpSimGraph::max_stats = 0;
 struct Hashtable *ChpSimGraph::labels = NULL;
 
+unsigned long ChpSim::_ev_next = 0;
+unsigned long ChpSim::_ev_wake = 0;
+unsigned long ChpSim::_ev_direct = 0;
+
 extern ActSim *glob_sim;
 
 /*
@@ -54,71 +59,54 @@ class ChanTraceDelayed : public SimDES {
     BigInt xtm = SimDES::CurTime();
     float tm = glob_sim->curTimeMetricUnits ();
     int len = xtm.getLen();
-    unsigned long tval;
-    unsigned long *ptm;
-    if (len == 1) {
-      tval = xtm.getVal (0);
-      ptm = &tval;
+    unsigned long tbuf[TRACE_WORDS], vbuf[TRACE_WORDS];
+    unsigned long *ptm, *value;
+    int kind, vlen;
+
+    if (len <= TRACE_WORDS) {
+      ptm = tbuf;
     }
     else {
       MALLOC (ptm, unsigned long, len);
-      for (int i=0; i < len; i++) {
-	ptm[i] = xtm.getVal (i);
-      }
     }
-    unsigned long *value;
-    value = NULL;
+    for (int i=0; i < len; i++) {
+      ptm[i] = xtm.getVal (i);
+    }
+    value = vbuf;
+    vlen = 1;
     if (_has_val) {
       if (_v.getLen() > 1) {
-	MALLOC (value, unsigned long, _v.getLen());
-	for (int i=0; i < _v.getLen(); i++) {
+	kind = TRW_WIDE_CHAN;
+	vlen = _v.getLen();
+	if (vlen > TRACE_WORDS) {
+	  MALLOC (value, unsigned long, vlen);
+	}
+	for (int i=0; i < vlen; i++) {
 	  value[i] = _v.getVal (i);
 	}
       }
+      else {
+	kind = TRW_CHAN;
+	vbuf[0] = _v.getVal (0);
+      }
+    }
+    else {
+      kind = TRW_CHAN;
+      vbuf[0] = 0;
     }
     
     for (int fmt=0; fmt < TRACE_NUM_FORMATS; fmt++) {
       act_trace_t *tr = glob_sim->getTrace (fmt);
       if (tr && !((_n->ignore_fmt >> fmt) & 1)) {
-	if (act_trace_has_alt (tr->t)) {
-	  if (_has_val) {
-	    if (_v.getLen() == 1) {
-	      act_trace_chan_change_alt (tr, _n->node[fmt], len, ptm,
-					 ACT_CHAN_VALUE, _v.getVal (0));
-	    }
-	    else {
-	      act_trace_wide_chan_change_alt (tr, _n->node[fmt], len, ptm,
-					      ACT_CHAN_VALUE,
-					      _v.getLen(), value);
-	    }
-	  }
-	  else {
-	    act_trace_chan_change_alt (tr, _n->node[fmt], len, ptm,
-				       ACT_CHAN_IDLE, 0);
-	  }
-	}
-	else {
-	  if (_has_val) {
-	    if (_v.getLen() == 1) {
-	      act_trace_chan_change (tr, _n->node[fmt], tm,
-				     ACT_CHAN_VALUE, _v.getVal (0));
-	    }
-	    else {
-	      act_trace_wide_chan_change (tr, _n->node[fmt], tm,
-					  ACT_CHAN_VALUE, _v.getLen(), value);
-	    }
-	  }
-	  else {
-	    act_trace_chan_change (tr, _n->node[fmt], tm, ACT_CHAN_IDLE, 0);
-	  }
-	}
+	glob_sim->traceChange (fmt, kind, _n->node[fmt], tm, len, ptm,
+			       _has_val ? ACT_CHAN_VALUE : ACT_CHAN_IDLE,
+			       vlen, value);
       }
     }
-    if (len > 1) {
+    if (ptm != tbuf) {
       FREE (ptm);
     }
-
-    if (_has_val && _v.getLen() > 1) {
+    if (value != vbuf) {
       FREE (value);
     }
     
@@ -380,6 +368,8 @@ ChpSim::ChpSim (chpsimgraph_info *cgi,
 
   _deadlock_pc = NULL;
   _stalled_pc = list_new ();
+  _true_gd = NULL;
+  _true_gd_max = 0;
   _probe = NULL;
   _savedc = c;
   _energy_cost = 0;
@@ -389,6 +379,7 @@ ChpSim::ChpSim (chpsimgraph_info *cgi,
   _cureval = NULL;
   _frag_ch = NULL;
   _hse_mode = 0;		/* default is CHP */
+  _peer_brk = 0;
   
   _maxstats = max_stats;
   if (_maxstats > 0) {
@@ -449,9 +440,11 @@ ChpSim::ChpSim (chpsimgraph_info *cgi,
     _pc = (ChpSimGraph **)
       sim->getState()->allocState (sizeof (ChpSimGraph *)*_npc);
     _holes = (int *) sim->getState()->allocState (sizeof (int)*_npc);
+    MALLOC (_pc_tm, unsigned long, _npc);
     for (int i=0; i < _npc; i++) {
       _pc[i] = NULL;
       _holes[i] = i;
+      _pc_tm[i] = 0;
     }
     _holes[0] = -1;
 
@@ -464,9 +457,11 @@ ChpSim::ChpSim (chpsimgraph_info *cgi,
     else {
       _tot = NULL;
     }
+    _maxcnt = max_cnt;
 
     Assert (_npc >= 1, "What?");
     _pc[0] = g;
+    _root = g;
     _statestk = list_new ();
     _initEvent ();
     if (cgi) {
@@ -475,7 +470,10 @@ ChpSim::ChpSim (chpsimgraph_info *cgi,
   }
   else {
     _pc = NULL;
+    _pc_tm = NULL;
     _npc = 0;
+    _maxcnt = 0;
+    _root = NULL;
   }
 
 }
@@ -515,6 +513,12 @@ ChpSim::~ChpSim()
   if (_maxstats > 0) {
     FREE (_stats);
   }
+  if (_pc_tm) {
+    FREE (_pc_tm);
+  }
+  if (_true_gd) {
+    FREE (_true_gd);
+  }
 }
 
 int ChpSim::_nextEvent (int pc, int bw_cost)
@@ -523,13 +527,23 @@ int ChpSim::_nextEvent (int pc, int bw_cost)
     pc = _updatepc (pc);
   }
   if (_pc[pc]) {
-    new Event (this, SIM_EV_MKTYPE (pc,0) /* pc */,
-	       _sc->getDelay (_pc[pc]->stmt->delay_cost + bw_cost));
+    int d = _sc->getDelay (_pc[pc]->stmt->delay_cost + bw_cost);
+    ActEvent::make (this, SIM_EV_MKTYPE (pc,0) /* pc */, d);
+    _pc_tm[pc] = CurTimeLo() + d;
+    _ev_next++;
     return 1;
   }
   return 0;
 }
 
+void ChpSim::eventStats (unsigned long *next, unsigned long *wake,
+			 unsigned long *direct)
+{
+  *next = _ev_next;
+  *wake = _ev_wake;
+  *direct = _ev_direct;
+}
+
 void ChpSim::_initEvent ()
 {
   _nextEvent (0, 0);
@@ -814,8 +828,14 @@ int ChpSim::computeOffset (const struct chpsimderef *d)
     return d->offset;
   }
   for (int i=0; i < d->range->nDims(); i++) {
-    BigInt res = exprEval (d->chp_idx[i]);
-    d->idx[i] = res.getVal(0);
+    unsigned long v;
+    if (d->idx_bc[i] && _bcEval (d->idx_bc[i], &v)) {
+      d->idx[i] = v;
+    }
+    else {
+      BigInt res = exprEval (d->chp_idx[i]);
+      d->idx[i] = res.getVal(0);
+    }
   }
   int x = d->range->Offset (d->idx);
   if (x == -1) {
@@ -1091,7 +1111,33 @@ static bool _matchme (Event *ev)
 
 int ChpSim::Step (Event *ev)
 {
-  int ev_type = ev->getType ();
+  return _step (ev->getType ());
+}
+
+/*
+  Complete the channel action that process c->waiter has blocked on
+  at peer_pc, as if it had been woken up. The peer runs the rest of
+  its send/receive right away and schedules its next statement, so no
+  wake-up event is needed. Returns 0 if the peer cannot be completed
+  this way, and the caller should notify it instead.
+*/
+int ChpSim::_handoff (act_channel_state *c, int peer_pc)
+{
+  ChpSim *p = c->waiter;
+
+  if (!_sc->chpDirect() || !p || p == this || !c->w->isWaiting (p)) {
+    return 0;
+  }
+  c->w->DelObject (p);
+  _ev_direct++;
+  if (!p->_step (SIM_EV_MKTYPE (peer_pc, 1))) {
+    _peer_brk = 1;
+  }
+  return 1;
+}
+
+int ChpSim::_step (int ev_type)
+{
   int pc = SIM_EV_TYPE (ev_type);
   int flag = SIM_EV_FLAGS (ev_type);
   int forceret = 0;
@@ -1131,7 +1177,8 @@ int ChpSim::Step (Event *ev)
 
   if (!_hse_mode && _sc->isResetMode() && _proc != NULL) {
     /*-- this is a real process: wait for run mode --*/
-    new Event (this, SIM_EV_MKTYPE (pc, 0), 10);
+    ActEvent::make (this, SIM_EV_MKTYPE (pc, 0), 10);
+    _pc_tm[pc] = CurTimeLo() + 10;
     return 1;
   }
 
@@ -1220,7 +1267,24 @@ int ChpSim::Step (Event *ev)
       }
     }
     else {
-      v = exprEval (stmt->u.assign.e);
+      unsigned long fv;
+      if (stmt->u.assign.isint <= 64 && stmt->u.assign.bc &&
+	  _bcEval (stmt->u.assign.bc, &fv)) {
+	/* the result is truncated to the variable width below */
+	if (stmt->u.assign.isint == 0) {
+	  v.setWidth (1);
+	}
+	else {
+	  v.setWidth (stmt->u.assign.isint);
+	  if (stmt->u.assign.isint < 64) {
+	    fv &= (1UL << stmt->u.assign.isint) - 1;
+	  }
+	}
+	v.setVal (0, fv);
+      }
+      else {
+	v = exprEval (stmt->u.assign.e);
+      }
 #ifdef DUMP_ALL
       printf ("%lu (w=%d)", v.getVal (0), v.getWidth());
 #endif
@@ -1292,7 +1356,14 @@ int ChpSim::Step (Event *ev)
 	    vs = exprStruct (stmt->u.sendrecv.e);
 	  }
 	  else {
-	    v = exprEval (stmt->u.sendrecv.e);
+	    unsigned long fv;
+	    if (stmt->u.sendrecv.bc && _bcEval (stmt->u.sendrecv.bc, &fv)) {
+	      v.setWidth (stmt->u.sendrecv.bc->width);
+	      v.setVal (0, fv);
+	    }
+	    else {
+	      v = exprEval (stmt->u.sendrecv.e);
+	    }
 	    vs.setSingle (v);
 	  }
 	}
@@ -1312,6 +1383,10 @@ int ChpSim::Step (Event *ev)
       rv = varSend (pc, flag, stmt->u.sendrecv.chvar, goff,
 		    stmt->u.sendrecv.flavor, vs, stmt->u.sendrecv.is_structx,
 		    &xchg, &frag, &skipwrite);
+      if (_peer_brk) {
+	_peer_brk = 0;
+	_breakpt = 1;
+      }
 
       if (stmt->u.sendrecv.is_structx) {
 	if (!rv && xchg.nvals > 0) {
@@ -1408,7 +1483,15 @@ int ChpSim::Step (Event *ev)
 	      xchg = exprStruct (stmt->u.sendrecv.e);
 	    }
 	    else {
-	      v = exprEval (stmt->u.sendrecv.e);
+	      unsigned long fv;
+	      if (stmt->u.sendrecv.bc &&
+		  _bcEval (stmt->u.sendrecv.bc, &fv)) {
+		v.setWidth (stmt->u.sendrecv.bc->width);
+		v.setVal (0, fv);
+	      }
+	      else {
+		v = exprEval (stmt->u.sendrecv.e);
+	      }
 	      xchg.setSingle (v); 
 	    }
 	  }
@@ -1424,6 +1507,10 @@ int ChpSim::Step (Event *ev)
       rv = varRecv (pc, flag, stmt->u.sendrecv.chvar, goff,
 		    stmt->u.sendrecv.flavor, &vs,
 		    stmt->u.sendrecv.is_structx, xchg, &frag, &skipwrite);
+      if (_peer_brk) {
+	_peer_brk = 0;
+	_breakpt = 1;
+      }
       
       if (!rv && vs.nvals > 0) {
 	v = vs.v[0];
@@ -1575,9 +1662,8 @@ int ChpSim::Step (Event *ev)
     {
       chpsimcond *gc;
       int cnt = 0;
-      list_t *ch_list = NULL;
+      int ntrue = 0;
       int choice = -1;
-      BigInt res;
 
 #ifdef DUMP_ALL
       if (stmt->type == CHPSIM_COND || stmt->type == CHPSIM_CONDARB) {
@@ -1612,43 +1698,41 @@ int ChpSim::Step (Event *ev)
 
       gc = &stmt->u.cond.c;
       cnt = 0;
-      ch_list = list_new ();
       while (gc) {
 	if (gc->g) {
-	  res = exprEval (gc->g);
-	  if (res.getVal (0) != 0) {
-	    list_iappend (ch_list, cnt);
+	  if (_exprTrue (gc)) {
+	    if (ntrue == _true_gd_max) {
+	      _true_gd_max = (_true_gd_max == 0 ? 8 : 2*_true_gd_max);
+	      REALLOC (_true_gd, int, _true_gd_max);
+	    }
+	    _true_gd[ntrue++] = cnt;
 	  }
 	  cnt++;
 	}
 	gc = gc->next;
       }
 
-      if (list_length (ch_list) > 1) {
+      if (ntrue > 1) {
 	if (stmt->type != CHPSIM_CONDARB) {
 	  msgPrefix (actsim_log_fp());
-	  actsim_log ("** ERROR ** multiple (%d) guards true, mutex violation.\n", list_length (ch_list));
+	  actsim_log ("** ERROR ** multiple (%d) guards true, mutex violation.\n", ntrue);
 	  actsim_log_flush ();
 	}
 	else {
 	  if (_sc->isRandomChoice ()) {
-	    choice = _sc->getRandom (list_length (ch_list));
+	    choice = _sc->getRandom (ntrue);
 	  }
 	}
       }
 
       cnt = 0;
-      if (!list_isempty (ch_list)) {
+      if (ntrue > 0) {
 	/* at least one true guard */
 	if (choice == -1) {
-	  choice = list_ivalue (list_first (ch_list));
+	  choice = _true_gd[0];
 	}
 	else {
-	  while (choice > 0) {
-	    list_delete_ihead (ch_list);
-	    choice--;
-	  }
-	  choice = list_delete_ihead (ch_list);
+	  choice = _true_gd[choice];
 	}
       }
       gc = &stmt->u.cond.c;
@@ -1671,7 +1755,6 @@ int ChpSim::Step (Event *ev)
 	cnt++;
 	gc = gc->next;
       }
-      list_free (ch_list);
       /* all guards false */
       if (!gc) {
 	if (stmt->type == CHPSIM_COND || stmt->type == CHPSIM_CONDARB) {
@@ -1870,7 +1953,7 @@ int ChpSim::varSend (int pc, int wakeup, int id, int off, int flavor,
     Assert (c->sender_probe == 0, "What?");
 
     if (bidir) {
-      *xchg = c->data;
+      *xchg = std::move (c->data);
       *skipwrite = c->skip_action;
       c->skip_action = 0;
     }
@@ -1883,14 +1966,20 @@ int ChpSim::varSend (int pc, int wakeup, int id, int off, int flavor,
     printf (" [waiting-recv %d]", c->recv_here-1);
 #endif
     // blocked receive, because there was no data
-    c->data = v;
+    c->data = std::move (v);
     if (bidir) {
-      *xchg = c->data2;
+      *xchg = std::move (c->data2);
       *skipwrite = c->skip_action;
       c->skip_action = 0;
     }
-    c->w->Notify (c->recv_here-1);
-    c->recv_here = 0;
+    {
+      int rpc = c->recv_here-1;
+      c->recv_here = 0;
+      if (!_handoff (c, rpc)) {
+	c->w->Notify (rpc);
+	_ev_wake++;
+      }
+    }
     if (c->send_here != 0) {
       act_connection *x;
       int dy;
@@ -1926,7 +2015,7 @@ int ChpSim::varSend (int pc, int wakeup, int id, int off, int flavor,
       c->receiver_probe = 0;
     }
     // we need to wait for the receive to show up
-    c->data2 = v;
+    c->data2 = std::move (v);
     if (c->send_here != 0) {
       act_connection *x;
       int dy;
@@ -1949,6 +2038,7 @@ int ChpSim::varSend (int pc, int wakeup, int id, int off, int flavor,
     if (!c->w->isWaiting (this)) {
       c->w->AddObject (this);
     }
+    c->waiter = this;
     return 1;
   }
 }
@@ -2091,7 +2181,7 @@ int ChpSim::varRecv (int pc, int wakeup, int id, int off, int flavor,
     printf (" [recv-wakeup %d]", pc);
 #endif
     //v->v[0].v = c->data;
-    *v = c->data;
+    *v = std::move (c->data);
     *skipwrite = c->skip_action;
     c->skip_action = 0;
     if (c->recv_here != 0) {
@@ -2119,14 +2209,20 @@ int ChpSim::varRecv (int pc, int wakeup, int id, int off, int flavor,
 #ifdef DUMP_ALL    
     printf (" [waiting-send %d]", c->send_here-1);
 #endif    
-    *v = c->data2;
+    *v = std::move (c->data2);
     *skipwrite = c->skip_action;
     c->skip_action = 0;
     if (bidir) {
-      c->data = xchg;
+      c->data = std::move (xchg);
+    }
+    {
+      int spc = c->send_here-1;
+      c->send_here = 0;
+      if (!_handoff (c, spc)) {
+	c->w->Notify (spc);
+	_ev_wake++;
+      }
     }
-    c->w->Notify (c->send_here-1);
-    c->send_here = 0;
     Assert (c->recv_here == 0 && c->receiver_probe == 0 &&
 	    c->sender_probe == 0, "What?");
     return 0;
@@ -2166,8 +2262,9 @@ int ChpSim::varRecv (int pc, int wakeup, int id, int off, int flavor,
     if (!c->w->isWaiting (this)) {
       c->w->AddObject (this);
     }
+    c->waiter = this;
     if (bidir) {
-      c->data2 = xchg;
+      c->data2 = std::move (xchg);
     }
     return 1;
   }
@@ -2250,15 +2347,406 @@ expr_multires ChpSim::varChanEvalStruct (int id, int type)
 }
 
 
-void ChpSim::_run_chp (Function *f, act_chp_lang_t *c)
+/*
+ * Frame layout for a CHP function, computed on the first call: one
+ * slot per local and port. A frame holds the values of all the
+ * slots. Frames are recycled through a per-function free list, so a
+ * call allocates nothing once its recursion depth has been reached
+ * before.
+ */
+struct chpsim_fslot {
+  Data *d;			/* structure type, or NULL */
+  void *zero;			/* initial value: BigInt or expr_multires */
+};
+
+/* an assignment to (part of) a structure in a function body */
+struct chpsim_fasgn {
+  int off;			/* offset of the field, -1 = all of it */
+  int isstruct;			/* the field is itself a structure */
+};
+
+struct chpsim_fdesc {
+  int nslots;
+  struct chpsim_fslot *slot;
+  struct Hashtable *H;		/* name -> slot */
+  struct pHashtable *idH;	/* ActId in the function body -> slot */
+  struct pHashtable *asgn;	/* structure assignment -> chpsim_fasgn */
+  int *port;			/* slot for each port */
+  int self;			/* slot for the return value */
+  struct chpsim_frame *free;	/* frames not in use */
+
+  /* external functions */
+  void *ext;			/* C function, once resolved */
+  int ext_abi;			/* 1 = expr_res, 2 = wide */
+  expr_res *extargs;		/* argument buffer for abi 1 */
+};
+
+struct chpsim_frame {
+  struct chpsim_fdesc *fd;
+  void **v;			/* value of each slot */
+  expr_argw *wargs;		/* external abi 2: argument buffers,
+				   the last entry is the return value */
+  struct chpsim_frame *next;
+};
+
+typedef expr_res (*EXTFUNC) (int nargs, expr_res *args);
+typedef void (*EXTFUNCW) (int nargs, expr_argw *args, expr_argw *ret);
+struct ExtLibs *_chp_ext = NULL;
+static struct ExtLibs *_chp_ext_wide = NULL;
+static int _chp_ext_wide_read = 0;
+
+static struct pHashtable *_chp_fdesc = NULL;
+
+/* resolve the field of every structure assignment in c */
+static void _fdesc_asgn (struct chpsim_fdesc *fd, act_chp_lang_t *c)
 {
   listitem_t *li;
+  act_chp_gc_t *gc;
   hash_bucket_t *b;
+  phash_bucket_t *pb;
+  struct chpsim_fasgn *a;
+  InstType *it;
+  int sz;
+
+  if (!c) return;
+  switch (c->type) {
+  case ACT_CHP_SEMI:
+  case ACT_CHP_COMMA:
+    for (li = list_first (c->u.semi_comma.cmd); li; li = list_next (li)) {
+      _fdesc_asgn (fd, (act_chp_lang_t *) list_value (li));
+    }
+    break;
+
+  case ACT_CHP_SELECT:
+  case ACT_CHP_SELECT_NONDET:
+  case ACT_CHP_LOOP:
+  case ACT_CHP_DOLOOP:
+    for (gc = c->u.gc; gc; gc = gc->next) {
+      _fdesc_asgn (fd, gc->s);
+    }
+    break;
+
+  case ACT_CHP_ASSIGN:
+    b = hash_lookup (fd->H, c->u.assign.id->getName());
+    if (!b || !fd->slot[b->i].d) {
+      break;
+    }
+    NEW (a, struct chpsim_fasgn);
+    if (!c->u.assign.id->Rest()) {
+      a->off = -1;
+      a->isstruct = 1;
+    }
+    else {
+      it = NULL;
+      a->off = fd->slot[b->i].d->getStructOffset (c->u.assign.id->Rest(),
+						   &sz, &it);
+      if (a->off < 0) {
+	fatal_error ("Function assignment to `%s': unknown field",
+		     c->u.assign.id->getName());
+      }
+      a->isstruct = (it && TypeFactory::isStructure (it)) ? 1 : 0;
+    }
+    pb = phash_add (fd->asgn, c);
+    pb->v = a;
+    break;
+
+  default:
+    break;
+  }
+}
+
+static struct chpsim_fdesc *_get_fdesc (Function *f)
+{
+  phash_bucket_t *pb;
+  hash_bucket_t *b;
+  struct chpsim_fdesc *fd;
+  ActInstiter it(f->CurScope());
+  int i;
+
+  if (!_chp_fdesc) {
+    _chp_fdesc = phash_new (4);
+  }
+  pb = phash_lookup (_chp_fdesc, f);
+  if (pb) {
+    return (struct chpsim_fdesc *) pb->v;
+  }
+
+  NEW (fd, struct chpsim_fdesc);
+  fd->nslots = 0;
+  fd->slot = NULL;
+  fd->H = hash_new (4);
+  fd->idH = phash_new (4);
+  fd->asgn = phash_new (4);
+  fd->free = NULL;
+  fd->ext = NULL;
+  fd->ext_abi = 0;
+  fd->extargs = NULL;
+
+  for (it = it.begin(); it != it.end(); it++) {
+    ValueIdx *vx = (*it);
+    if (TypeFactory::isParamType (vx->t)) continue;
+
+    if (vx->t->arrayInfo()) {
+      warning ("Ignoring arrays for now...");
+    }
+
+    REALLOC (fd->slot, struct chpsim_fslot, fd->nslots + 1);
+    b = hash_add (fd->H, vx->getName());
+    b->i = fd->nslots;
+    if (TypeFactory::isStructure (vx->t)) {
+      Data *xd = dynamic_cast<Data *> (vx->t->BaseType());
+      fd->slot[fd->nslots].d = xd;
+      fd->slot[fd->nslots].zero = new expr_multires (xd);
+    }
+    else {
+      BigInt *x = new BigInt;
+      x->setVal (0, 0);
+      x->setWidth (TypeFactory::bitWidth (vx->t));
+      fd->slot[fd->nslots].d = NULL;
+      fd->slot[fd->nslots].zero = x;
+    }
+    fd->nslots++;
+  }
+
+  if (f->getNumPorts() > 0) {
+    MALLOC (fd->port, int, f->getNumPorts());
+  }
+  else {
+    fd->port = NULL;
+  }
+  for (i=0; i < f->getNumPorts(); i++) {
+    b = hash_lookup (fd->H, f->getPortName (i));
+    Assert (b, "What?");
+    fd->port[i] = b->i;
+  }
+  b = hash_lookup (fd->H, "self");
+  fd->self = (b ? b->i : -1);
+
+  if (!f->isExternal() && f->getlang() && f->getlang()->getchp()) {
+    _fdesc_asgn (fd, f->getlang()->getchp()->c);
+  }
+
+  pb = phash_add (_chp_fdesc, f);
+  pb->v = fd;
+  return fd;
+}
+
+/* get a frame for a call to f, with ports bound to the arguments */
+static struct chpsim_frame *_frame_get (Function *f, void **vargs)
+{
+  struct chpsim_fdesc *fd = _get_fdesc (f);
+  struct chpsim_frame *fr;
+  int i;
+
+  if (fd->free) {
+    fr = fd->free;
+    fd->free = fr->next;
+  }
+  else {
+    NEW (fr, struct chpsim_frame);
+    fr->fd = fd;
+    fr->wargs = NULL;
+    MALLOC (fr->v, void *, fd->nslots ? fd->nslots : 1);
+    for (i=0; i < fd->nslots; i++) {
+      if (fd->slot[i].d) {
+	fr->v[i] = new expr_multires (fd->slot[i].d);
+      }
+      else {
+	fr->v[i] = new BigInt;
+      }
+    }
+  }
+  fr->next = NULL;
+
+  for (i=0; i < fd->nslots; i++) {
+    if (fd->slot[i].d) {
+      *((expr_multires *)fr->v[i]) = *((expr_multires *)fd->slot[i].zero);
+    }
+    else {
+      *((BigInt *)fr->v[i]) = *((BigInt *)fd->slot[i].zero);
+    }
+  }
+
+  for (i=0; i < f->getNumPorts(); i++) {
+    int j = fd->port[i];
+    if (fd->slot[j].d) {
+      *((expr_multires *)fr->v[j]) = *((expr_multires *)vargs[i]);
+    }
+    else {
+      BigInt *x = (BigInt *)fr->v[j];
+      int w = x->getWidth ();
+      *x = *((BigInt *)vargs[i]);
+      x->setWidth (w);
+      x->toStatic ();
+    }
+  }
+  return fr;
+}
+
+static void _frame_put (struct chpsim_frame *fr)
+{
+  fr->next = fr->fd->free;
+  fr->fd->free = fr;
+}
+
+/* slot for a variable of the function body, or -1 */
+static int _frame_slot (struct chpsim_frame *fr, ActId *id)
+{
+  phash_bucket_t *pb;
+  hash_bucket_t *b;
+
+  pb = phash_lookup (fr->fd->idH, id);
+  if (!pb) {
+    b = hash_lookup (fr->fd->H, id->getName());
+    if (!b) {
+      return -1;
+    }
+    pb = phash_add (fr->fd->idH, id);
+    pb->i = b->i;
+  }
+  return pb->i;
+}
+
+/*
+ * Find the C implementation of an external function. Functions in
+ * the sim.extern_wide table use the wide-argument interface; the
+ * rest are looked up in sim.extern.
+ */
+static void _ext_resolve (Function *f, struct chpsim_fdesc *fd)
+{
+  if (!_chp_ext_wide_read) {
+    _chp_ext_wide_read = 1;
+    if (config_exists ("sim.extern_wide.libs")) {
+      _chp_ext_wide = act_read_extern_table ("sim.extern_wide");
+    }
+  }
+  if (_chp_ext_wide) {
+    fd->ext = act_find_dl_func (_chp_ext_wide, f->getns(), f->getName());
+    fd->ext_abi = 2;
+  }
+  if (!fd->ext) {
+    if (!_chp_ext) {
+      _chp_ext = act_read_extern_table ("sim.extern");
+    }
+    fd->ext = act_find_dl_func (_chp_ext, f->getns(), f->getName());
+    fd->ext_abi = 1;
+  }
+  if (!fd->ext) {
+    fatal_error ("Function `%s%s' missing chp body as well as external definition.",
+		 f->getns() == ActNamespace::Global() ? "" :
+		 f->getns()->Name(true) + 2,
+		 f->getName());
+  }
+  if (fd->ext_abi == 1) {
+    for (int i=0; i < f->getNumPorts(); i++) {
+      if (TypeFactory::isStructure (f->getPortType (i))) {
+	fatal_error ("External function calls cannot have structure arguments");
+      }
+    }
+    if (f->getNumPorts() > 0) {
+      MALLOC (fd->extargs, expr_res, f->getNumPorts());
+    }
+  }
+}
+
+static void _ext_wide_alloc (expr_argw *a, void *x, int is_struct)
+{
+  BigInt *v;
+  
+  if (is_struct) {
+    a->nvals = ((expr_multires *)x)->nvals;
+    v = ((expr_multires *)x)->v;
+  }
+  else {
+    a->nvals = 1;
+    v = (BigInt *)x;
+  }
+  MALLOC (a->vals, expr_resw, a->nvals ? a->nvals : 1);
+  for (int i=0; i < a->nvals; i++) {
+    a->vals[i].width = v[i].getWidth();
+    a->vals[i].nwords = (a->vals[i].width + 63)/64;
+    if (a->vals[i].nwords < 1) {
+      a->vals[i].nwords = 1;
+    }
+    MALLOC (a->vals[i].v, unsigned long, a->vals[i].nwords);
+  }
+}
+
+static void _ext_wide_put (expr_argw *a, void *x, int is_struct)
+{
+  BigInt *v = (is_struct ? ((expr_multires *)x)->v : (BigInt *)x);
+  for (int i=0; i < a->nvals; i++) {
+    for (int j=0; j < a->vals[i].nwords; j++) {
+      a->vals[i].v[j] = (j < v[i].getLen() ? v[i].getVal (j) : 0);
+    }
+  }
+}
+
+static void _ext_wide_get (expr_argw *a, void *x, int is_struct)
+{
+  BigInt *v = (is_struct ? ((expr_multires *)x)->v : (BigInt *)x);
+  for (int i=0; i < a->nvals; i++) {
+    int w = a->vals[i].width;
+    for (int j=0; j < a->vals[i].nwords && j < v[i].getLen(); j++) {
+      unsigned long val = a->vals[i].v[j];
+      /* drop any bits the function set above the declared width */
+      if (j == (w-1)/64 && (w % 64) != 0) {
+	val &= (1UL << (w % 64)) - 1;
+      }
+      v[i].setVal (j, val);
+    }
+  }
+}
+
+/*
+ * Call an external function with the wide-argument interface. The
+ * arguments are taken from the ports of the frame, and the result is
+ * left in its return slot. The word buffers belong to the frame, so
+ * each active call has its own.
+ */
+static void _ext_call_wide (Function *f, struct chpsim_frame *fr)
+{
+  struct chpsim_fdesc *fd = fr->fd;
+  expr_argw *wargs;
+  int n = f->getNumPorts();
+  int i, j;
+
+  if (fd->self < 0) {
+    fatal_error ("External function `%s': no return value?", f->getName());
+  }
+  if (!fr->wargs) {
+    MALLOC (fr->wargs, expr_argw, n + 1);
+    for (i=0; i < n; i++) {
+      j = fd->port[i];
+      _ext_wide_alloc (&fr->wargs[i], fr->v[j], fd->slot[j].d ? 1 : 0);
+    }
+    _ext_wide_alloc (&fr->wargs[n], fr->v[fd->self],
+		     fd->slot[fd->self].d ? 1 : 0);
+  }
+  wargs = fr->wargs;
+  for (i=0; i < n; i++) {
+    j = fd->port[i];
+    _ext_wide_put (&wargs[i], fr->v[j], fd->slot[j].d ? 1 : 0);
+  }
+  for (i=0; i < wargs[n].nvals; i++) {
+    for (j=0; j < wargs[n].vals[i].nwords; j++) {
+      wargs[n].vals[i].v[j] = 0;
+    }
+  }
+  (*((EXTFUNCW)fd->ext)) (n, wargs, &wargs[n]);
+  _ext_wide_get (&wargs[n], fr->v[fd->self],
+		 fd->slot[fd->self].d ? 1 : 0);
+}
+
+
+void ChpSim::_run_chp (Function *f, act_chp_lang_t *c)
+{
+  listitem_t *li;
+  int slot;
   BigInt *x, res;
   expr_multires *xm, resm;
   act_chp_gc_t *gc;
-  struct Hashtable *state = ((struct Hashtable *)stack_peek (_statestk));
-  InstType *xit;
+  struct chpsim_frame *fr = ((struct chpsim_frame *)stack_peek (_statestk));
   
   if (!c) return;
   switch (c->type) {
@@ -2408,29 +2896,26 @@ void ChpSim::_run_chp (Function *f, act_chp_lang_t *c)
       fatal_error ("Dots not permitted in functions!");
     }
 #endif    
-    b = hash_lookup (state, c->u.assign.id->getName());
-    if (!b) {
+    slot = _frame_slot (fr, c->u.assign.id);
+    if (slot < 0) {
       fatal_error ("Variable `%s' not found?!", c->u.assign.id->getName());
     }
-    xit = f->CurScope()->Lookup (c->u.assign.id->getName());
-    if (TypeFactory::isStructure (xit)) {
+    if (fr->fd->slot[slot].d) {
       /* this is either a structure or a part of structure assignment */
-      xm = (expr_multires *)b->v;
-
-      /* check if this is a structure! */
-      xit = f->CurScope()->FullLookup (c->u.assign.id, NULL);
-      if (TypeFactory::isStructure (xit)) {
+      struct chpsim_fasgn *a;
+      xm = (expr_multires *)fr->v[slot];
+      a = (struct chpsim_fasgn *) phash_lookup (fr->fd->asgn, c)->v;
+      if (a->isstruct) {
 	resm = exprStruct (c->u.assign.e);
-	xm->setField (c->u.assign.id->Rest(), &resm);
+	xm->setField (a->off, &resm);
       }
       else {
 	res = exprEval (c->u.assign.e);
-	xm->setField (c->u.assign.id->Rest(), &res);
+	xm->setField (a->off, &res);
       }
-      delete xit;
     }
     else {
-      x = (BigInt *) b->v;
+      x = (BigInt *) fr->v[slot];
       res = exprEval (c->u.assign.e);
       res.setWidth (x->getWidth());
       *x = res;
@@ -2444,149 +2929,54 @@ void ChpSim::_run_chp (Function *f, act_chp_lang_t *c)
   }
 }
 
-typedef expr_res (*EXTFUNC) (int nargs, expr_res *args);
-struct ExtLibs *_chp_ext = NULL;
-
 BigInt ChpSim::funcEval (Function *f, int nargs, void **vargs)
 {
-  struct Hashtable *lstate;
-  hash_bucket_t *b;
-  hash_iter_t iter;
-  BigInt *x;
-  expr_multires *xm;
+  struct chpsim_frame *fr;
   BigInt ret;
-  ActInstiter it(f->CurScope());
-
-  /*-- allocate state and bindings --*/
-  lstate = hash_new (4);
-
-  for (it = it.begin(); it != it.end(); it++) {
-    ValueIdx *vx = (*it);
-    if (TypeFactory::isParamType (vx->t)) continue;
-
-    if (vx->t->arrayInfo()) {
-      warning ("Ignoring arrays for now...");
-    }
-
-    b = hash_add (lstate, vx->getName());
-
-    if (TypeFactory::isStructure (vx->t)) {
-      expr_multires *x2;
-      Data *xd = dynamic_cast<Data *> (vx->t->BaseType());
-      NEW (x2, expr_multires);
-      new (x2) expr_multires (xd);
-      b->v = x2;
-    }
-    else {
-      NEW (x, BigInt);
-      new (x) BigInt;
-      x->setVal (0, 0);
-      x->setWidth (TypeFactory::bitWidth (vx->t));
-      b->v = x;
-    }
-  }
 
   if (nargs != f->getNumPorts()) {
     fatal_error ("Function `%s': invalid number of arguments", f->getName());
   }
 
-  for (int i=0; i < f->getNumPorts(); i++) {
-    int w;
-    b = hash_lookup (lstate, f->getPortName (i));
-    Assert (b, "What?");
-
-    if (TypeFactory::isStructure (f->getPortType (i))) {
-      xm = (expr_multires *)b->v;
-      *xm = *((expr_multires *)vargs[i]);
-    }
-    else {
-      x = (BigInt *) b->v;
-      w = x->getWidth ();
-      *x = *((BigInt *)vargs[i]);
-      x->setWidth (w);
-      x->toStatic ();
-    }
-  }
-
   /* --- run body -- */
   if (f->isExternal()) {
-    EXTFUNC extcall = NULL;
-
-    if (!_chp_ext) {
-      _chp_ext = act_read_extern_table ("sim.extern");
-    }
-    extcall = (EXTFUNC) act_find_dl_func (_chp_ext, f->getns(), f->getName());
+    struct chpsim_fdesc *fd = _get_fdesc (f);
 
-    if (!extcall) {
-      fatal_error ("Function `%s%s' missing chp body as well as external definition.",
-		   f->getns() == ActNamespace::Global() ? "" :
-		   f->getns()->Name(true) + 2,
-		   f->getName());
+    if (!fd->ext) {
+      _ext_resolve (f, fd);
     }
-
-    expr_res *extargs = NULL;
-    expr_res extret;
-    if (nargs > 0) {
-      MALLOC (extargs, expr_res, nargs);
+    if (fd->ext_abi == 1) {
+      expr_res extret;
       for (int i=0; i < nargs; i++) {
-	if (TypeFactory::isStructure (f->getPortType (i))) {
-	  fatal_error ("External function calls cannot have structure arguments");
-	}
-	extargs[i].width = ((BigInt *)vargs[i])->getWidth ();
-	extargs[i].v = ((BigInt *)vargs[i])->getVal (0);
-      }
-    }
-    extret = (*extcall) (nargs, extargs);
-    if (nargs > 0) {
-      FREE (extargs);
-    }
-    BigInt tmp;
-    tmp.setWidth (extret.width);
-    tmp.setVal (0, extret.v);
-
-    hash_iter_init (lstate, &iter);
-    while ((b = hash_iter_next (lstate, &iter))) {
-      ValueIdx *vx = f->CurScope()->LookupVal (b->key);
-      Assert (vx, "How is this possible?");
-      if (TypeFactory::isStructure (vx->t)) {
-	((expr_multires *)b->v)->~expr_multires();
+	fd->extargs[i].width = ((BigInt *)vargs[i])->getWidth ();
+	fd->extargs[i].v = ((BigInt *)vargs[i])->getVal (0);
       }
-      else {
-	((BigInt *)b->v)->~BigInt();
-      }
-      FREE (b->v);
+      extret = (*((EXTFUNC)fd->ext)) (nargs, fd->extargs);
+      ret.setWidth (extret.width);
+      ret.setVal (0, extret.v);
+      return ret;
     }
-    hash_free (lstate);
-    
-    return tmp;
+    fr = _frame_get (f, vargs);
+    _ext_call_wide (f, fr);
+    ret = *((BigInt *)fr->v[fd->self]);
+    _frame_put (fr);
+    return ret;
   }
-  
+
+  fr = _frame_get (f, vargs);
+
   act_chp *c = f->getlang()->getchp();
   Scope *_tmp = _cureval;
-  stack_push (_statestk, lstate);
+  stack_push (_statestk, fr);
   _cureval = f->CurScope();
   _run_chp (f, c->c);
   _cureval = _tmp;
   stack_pop (_statestk);
 
   /* -- return result -- */
-  b = hash_lookup (lstate, "self");
-  x = (BigInt *)b->v;
-  ret = *x;
-
-  hash_iter_init (lstate, &iter);
-  while ((b = hash_iter_next (lstate, &iter))) {
-    ValueIdx *vx = f->CurScope()->LookupVal (b->key);
-    Assert (vx, "How is this possible?");
-    if (TypeFactory::isStructure (vx->t)) {
-      ((expr_multires *)b->v)->~expr_multires();
-    }
-    else {
-      ((BigInt *)b->v)->~BigInt();
-    }
-    FREE (b->v);
-  }
-  hash_free (lstate);
+  Assert (fr->fd->self >= 0, "What?");
+  ret = *((BigInt *)fr->v[fr->fd->self]);
+  _frame_put (fr);
 
   return ret;
 }
@@ -2609,6 +2999,139 @@ static int _ceil_log2 (int w)
   return i;
 }
   
+#define MASK64(w) ((w) >= 64 ? ~0UL : ((1UL << (w)) - 1))
+
+/* CHP bytecode opcodes */
+enum {
+  BC_CONST,			/* dst := k */
+  BC_BOOL,			/* dst := bool x */
+  BC_INT,			/* dst := int x & k */
+  BC_DBOOL,			/* dst := bool d */
+  BC_DINT,			/* dst := int d & k */
+  BC_AND, BC_OR, BC_XOR,	/* dst := a op b */
+  BC_PLUS, BC_MULT,
+  BC_MINUS,			/* dst := (a - b) & k */
+  BC_LSR,
+  BC_LT, BC_GT, BC_LE, BC_GE, BC_EQ, BC_NE,
+  BC_NOT,			/* dst := ~a & k */
+  BC_JZ,			/* if a == 0, goto x */
+  BC_JMP			/* goto x */
+};
+
+/*
+ * Run a compiled expression (see chpsim_bc_compile). Returns 0 if a
+ * value is X or an operation overflows 64 bits; the caller then falls
+ * back to exprEval.
+ */
+int ChpSim::_bcEval (struct chpsim_bc *bc, unsigned long *v)
+{
+  unsigned long reg[CHPSIM_BC_MAXREG];
+  struct chpsim_bc_op *op, *end;
+  unsigned long x;
+
+  op = bc->op;
+  end = bc->op + bc->nops;
+  while (op < end) {
+    switch (op->op) {
+    case BC_CONST:
+      reg[op->dst] = op->k;
+      break;
+
+    case BC_BOOL:
+      x = _sc->getBool (getGlobalOffset (op->x, 0));
+      if (x == 2) {
+	return 0;
+      }
+      reg[op->dst] = x;
+      break;
+
+    case BC_INT:
+      reg[op->dst] = _sc->getInt (getGlobalOffset (op->x, 1))->getVal (0)
+	& op->k;
+      break;
+
+    case BC_DBOOL:
+      x = _sc->getBool (getGlobalOffset (computeOffset (op->d), 0));
+      if (x == 2) {
+	return 0;
+      }
+      reg[op->dst] = x;
+      break;
+
+    case BC_DINT:
+      reg[op->dst] =
+	_sc->getInt (getGlobalOffset (computeOffset (op->d), 1))->getVal (0)
+	& op->k;
+      break;
+
+    case BC_AND: reg[op->dst] = reg[op->a] & reg[op->b]; break;
+    case BC_OR:  reg[op->dst] = reg[op->a] | reg[op->b]; break;
+    case BC_XOR: reg[op->dst] = reg[op->a] ^ reg[op->b]; break;
+
+    case BC_PLUS:
+      if (__builtin_add_overflow (reg[op->a], reg[op->b], &reg[op->dst])) {
+	return 0;
+      }
+      break;
+
+    case BC_MULT:
+      if (__builtin_mul_overflow (reg[op->a], reg[op->b], &reg[op->dst])) {
+	return 0;
+      }
+      break;
+
+    case BC_MINUS:
+      reg[op->dst] = (reg[op->a] - reg[op->b]) & op->k;
+      break;
+
+    case BC_LSR:
+      reg[op->dst] = (reg[op->b] >= 64 ? 0 : reg[op->a] >> reg[op->b]);
+      break;
+
+    case BC_LT: reg[op->dst] = (reg[op->a] < reg[op->b]);  break;
+    case BC_GT: reg[op->dst] = (reg[op->a] > reg[op->b]);  break;
+    case BC_LE: reg[op->dst] = (reg[op->a] <= reg[op->b]); break;
+    case BC_GE: reg[op->dst] = (reg[op->a] >= reg[op->b]); break;
+    case BC_EQ: reg[op->dst] = (reg[op->a] == reg[op->b]); break;
+    case BC_NE: reg[op->dst] = (reg[op->a] != reg[op->b]); break;
+
+    case BC_NOT:
+      reg[op->dst] = ~reg[op->a] & op->k;
+      break;
+
+    case BC_JZ:
+      if (reg[op->a] == 0) {
+	op = bc->op + op->x;
+	continue;
+      }
+      break;
+
+    case BC_JMP:
+      op = bc->op + op->x;
+      continue;
+
+    default:
+      fatal_error ("Unknown CHP bytecode op %d", op->op);
+      break;
+    }
+    op++;
+  }
+  *v = reg[0];
+  return 1;
+}
+
+/* evaluate a guard */
+int ChpSim::_exprTrue (chpsimcond *gc)
+{
+  unsigned long v;
+
+  if (gc->bc && _bcEval (gc->bc, &v)) {
+    return (v != 0);
+  }
+  BigInt res = exprEval (gc->g);
+  return (res.getVal (0) != 0);
+}
+
 BigInt ChpSim::exprEval (Expr *e)
 {
   BigInt l, r;
@@ -2932,18 +3455,17 @@ BigInt ChpSim::exprEval (Expr *e)
       ActId *xid = (ActId *) e->u.e.l;
 
       if (_statestk) {
-	struct Hashtable *state = ((struct Hashtable *)stack_peek (_statestk));
-	Assert (state,"what?");
-	hash_bucket_t *b = hash_lookup (state, xid->getName());
-	Assert (b, "what?");
-	Assert (_cureval, "What?");
-	InstType *xit = _cureval->Lookup (xid->getName());
-	if (TypeFactory::isStructure (xit)) {
-	  expr_multires *x2 = (expr_multires *)b->v;
+	struct chpsim_frame *fr =
+	  ((struct chpsim_frame *)stack_peek (_statestk));
+	Assert (fr,"what?");
+	int slot = _frame_slot (fr, xid);
+	Assert (slot >= 0, "what?");
+	if (fr->fd->slot[slot].d) {
+	  expr_multires *x2 = (expr_multires *)fr->v[slot];
 	  l = *(x2->getField (xid->Rest()));
 	}
 	else {
-	  l = *((BigInt *)b->v);
+	  l = *((BigInt *)fr->v[slot]);
 	}
       }
       else if (_frag_ch) {
@@ -2975,6 +3497,20 @@ BigInt ChpSim::exprEval (Expr *e)
     }
     break;
 
+  case E_CHP_VARBOOL_GLOBAL:
+    l.setWidth (1);
+    l.setVal (0, _sc->getBool (e->u.x.val));
+    if (_sc->getBool (e->u.x.val) == 2) {
+      ActId *tid;
+      msgPrefix ();
+      printf ("CHP model: Boolean variable `");
+      tid = ((act_connection *)e->u.x.extra)->toid();
+      tid->Print (stdout);
+      delete tid;
+      printf ("' is X\n");
+    }
+    break;
+
   case E_CHP_VARSTRUCT:
     fatal_error ("fixme");
     break;
@@ -2986,18 +3522,17 @@ BigInt ChpSim::exprEval (Expr *e)
 
       Assert (!list_isempty (_statestk), "What?");
 
-      struct Hashtable *state = ((struct Hashtable *)stack_peek (_statestk));
-      Assert (state,"what?");
-      hash_bucket_t *b = hash_lookup (state, xid->getName());
-      Assert (b, "what?");
-      Assert (_cureval, "What?");
-      InstType *xit = _cureval->Lookup (xid->getName());
-      if (TypeFactory::isStructure (xit)) {
-	expr_multires *x2 = (expr_multires *)b->v;
+      struct chpsim_frame *fr =
+	((struct chpsim_frame *)stack_peek (_statestk));
+      Assert (fr,"what?");
+      int slot = _frame_slot (fr, xid);
+      Assert (slot >= 0, "what?");
+      if (fr->fd->slot[slot].d) {
+	expr_multires *x2 = (expr_multires *)fr->v[slot];
 	l = *(x2->getField (xid->Rest()));
       }
       else {
-	l = *((BigInt *)b->v);
+	l = *((BigInt *)fr->v[slot]);
       }
 
       hi = (long)e->u.e.r->u.e.r->u.ival.v;
@@ -3174,107 +3709,46 @@ expr_multires ChpSim::varStruct (struct chpsimderef *d)
 
 expr_multires ChpSim::funcStruct (Function *f, int nargs, void **vargs)
 {
-  struct Hashtable *lstate;
-  hash_bucket_t *b;
-  BigInt *x;
-  expr_multires *xm;
+  struct chpsim_frame *fr;
   expr_multires ret;
-  ActInstiter it(f->CurScope());
-  InstType *ret_type = f->getRetType ();
-  Data *d;
 
-  Assert (TypeFactory::isStructure (ret_type), "What?");
-  d = dynamic_cast<Data *> (ret_type->BaseType());
-  Assert (d, "What?");
-  /*-- allocate state and bindings --*/
-  lstate = hash_new (4);
-
-  for (it = it.begin(); it != it.end(); it++) {
-    ValueIdx *vx = (*it);
-    if (TypeFactory::isParamType (vx->t)) continue;
-
-    if (vx->t->arrayInfo()) {
-      warning ("Ignoring arrays for now...");
-    }
-    
-    b = hash_add (lstate, vx->getName());
-    if (TypeFactory::isStructure (vx->t)) {
-      expr_multires *x2;
-      Data *xd = dynamic_cast<Data *> (vx->t->BaseType());
-      x2 = new expr_multires (xd);
-      b->v = x2;
-      //printf ("allocated struct (%s), nvals = %d, ptr = %p\n",
-      //vx->getName(), x2->nvals, x2->v);
-    }
-    else {
-      NEW (x, BigInt);
-      new (x) BigInt;
-      x->setVal (0,0);
-      x->setWidth (TypeFactory::bitWidth (vx->t));
-      x->toStatic ();
-      b->v = x;
-    }
-  }
+  Assert (TypeFactory::isStructure (f->getRetType ()), "What?");
 
   if (nargs != f->getNumPorts()) {
     fatal_error ("Function `%s': invalid number of arguments", f->getName());
   }
 
-  for (int i=0; i < f->getNumPorts(); i++) {
-    int w;
-    b = hash_lookup (lstate, f->getPortName (i));
-    Assert (b, "What?");
+  /* --- run body -- */
+  if (f->isExternal()) {
+    struct chpsim_fdesc *fd = _get_fdesc (f);
 
-    if (TypeFactory::isStructure (f->getPortType (i))) {
-      xm = (expr_multires *)b->v;
-      *xm = *((expr_multires *)vargs[i]);
+    if (!fd->ext) {
+      _ext_resolve (f, fd);
     }
-    else {
-      x = (BigInt *) b->v;
-      w = x->getWidth ();
-      *x = *((BigInt *)vargs[i]);
-      x->setWidth (w);
-      x->toStatic ();
+    if (fd->ext_abi == 1) {
+      fatal_error ("External function cannot return a structure!");
     }
+    fr = _frame_get (f, vargs);
+    _ext_call_wide (f, fr);
+    ret = *((expr_multires *)fr->v[fd->self]);
+    _frame_put (fr);
+    return ret;
   }
 
-  /* --- run body -- */
-  if (f->isExternal()) {
-    fatal_error ("External function cannot return a structure!");
-  }
-  
+  fr = _frame_get (f, vargs);
+
   act_chp *c = f->getlang()->getchp();
   Scope *_tmp = _cureval;
-  stack_push (_statestk, lstate);
+  stack_push (_statestk, fr);
   _cureval = f->CurScope();
   _run_chp (f, c->c);
   _cureval = _tmp;
   stack_pop (_statestk);
 
   /* -- return result -- */
-  b = hash_lookup (lstate, "self");
-  ret = *((expr_multires *)b->v);
-
-  //printf ("ret: %d, %p\n", ret.nvals, ret.v);
-
-  for (it = it.begin(); it != it.end(); it++) {
-    ValueIdx *vx = (*it);
-    if (TypeFactory::isParamType (vx->t)) continue;
-
-    if (vx->t->arrayInfo()) {
-      warning ("Ignoring arrays for now...");
-    }
-    
-    b = hash_lookup (lstate, vx->getName());
-    if (TypeFactory::isStructure (vx->t)) {
-      expr_multires *x2 = (expr_multires *)b->v;
-      delete x2;
-    }
-    else {
-      FREE (b->v);
-    }
-  }
-  hash_free (lstate);
+  Assert (fr->fd->self >= 0, "What?");
+  ret = *((expr_multires *)fr->v[fr->fd->self]);
+  _frame_put (fr);
 
   return ret;
 }
@@ -3295,12 +3769,12 @@ expr_multires ChpSim::exprStruct (Expr *e)
   case E_VAR:
     {
       Assert (!list_isempty (_statestk), "What?");
-      struct Hashtable *state = ((struct Hashtable *)stack_peek (_statestk));
-      Assert (state, "what?");
-      hash_bucket_t *b = hash_lookup (state, ((ActId*)e->u.e.l)->getName());
-      Assert (b, "what?");
-      //printf ("looked up state: %s\n", ((ActId *)e->u.e.l)->getName());
-      res = *((expr_multires *)b->v);
+      struct chpsim_frame *fr =
+	((struct chpsim_frame *)stack_peek (_statestk));
+      Assert (fr, "what?");
+      int slot = _frame_slot (fr, (ActId *)e->u.e.l);
+      Assert (slot >= 0, "what?");
+      res = *((expr_multires *)fr->v[slot]);
       if (((ActId *)e->u.e.l)->Rest()) {
 	/*
 	  ok, now re-construct a new expr_multires as a set of
@@ -3869,14 +4343,19 @@ ChpSimGraph *ChpSimGraph::completed (int pc, int *tot, int *done)
 
 static Expr *expr_to_chp_expr (Expr *e, ActSimCore *s, int *flags);
 static void _free_chp_expr (Expr *e);
+static struct chpsim_bc *chpsim_bc_compile (Expr *e, ActSimCore *s,
+					    int need_width);
+static void chpsim_bc_free (struct chpsim_bc *bc);
 
 static void _free_deref (struct chpsimderef *d)
 {
   if (d->range) {
     for (int i=0; i < d->range->nDims(); i++) {
       _free_chp_expr (d->chp_idx[i]);
+      chpsim_bc_free (d->idx_bc[i]);
     }
     FREE (d->chp_idx);
+    FREE (d->idx_bc);
     FREE (d->idx);
   }
   else {
@@ -3970,11 +4449,13 @@ static struct chpsimderef *_mk_deref (ActId *id, ActSimCore *s, int *type,
   Assert (d->range->nDims() > 0, "What?");
   MALLOC (d->idx, int, d->range->nDims());
   MALLOC (d->chp_idx, Expr *, d->range->nDims());
+  MALLOC (d->idx_bc, struct chpsim_bc *, d->range->nDims());
   
   /* now convert array deref into a chp array deref! */
   for (int i = 0; i < d->range->nDims(); i++) {
     int flags = 0;
     d->chp_idx[i] = expr_to_chp_expr (id->arrayInfo()->getDeref(i), s, &flags);
+    d->idx_bc[i] = chpsim_bc_compile (d->chp_idx[i], s, 0);
     d->idx[i] = -1;
   }
 
@@ -4010,11 +4491,13 @@ _mk_deref_struct (ActId *id, ActSimCore *s)
   Assert (d->range->nDims() > 0, "What?");
   MALLOC (d->idx, int, d->range->nDims());
   MALLOC (d->chp_idx, Expr *, d->range->nDims());
+  MALLOC (d->idx_bc, struct chpsim_bc *, d->range->nDims());
   
   /* now convert array deref into a chp array deref! */
   for (int i = 0; i < d->range->nDims(); i++) {
     int flags = 0;
     d->chp_idx[i] = expr_to_chp_expr (id->arrayInfo()->getDeref(i), s, &flags);
+    d->idx_bc[i] = chpsim_bc_compile (d->chp_idx[i], s, 0);
     d->idx[i] = -1;
   }
   
@@ -4564,6 +5047,237 @@ static Expr *expr_to_chp_expr (Expr *e, ActSimCore *s, int *flags)
   return ret;
 }
 
+/*
+ * Lower a CHP expression (after expr_to_chp_expr) to bytecode. The
+ * intermediate values in exprEval are dynamic BigInts and hold the
+ * exact value of each sub-expression, so the bytecode matches it as
+ * long as every value fits in 64 bits. Expressions that need
+ * exprEval (wide values, structures, function calls, ...) are not
+ * compiled. The decisions that only depend on the expression
+ * (widths, E_MINUS masks, constants, variable offsets) are made once
+ * here.
+ */
+struct chpsim_bc_build {
+  ActSimCore *sc;
+  int nregs;
+  A_DECL (struct chpsim_bc_op, op);
+};
+
+static struct chpsim_bc_op *_bc_emit (struct chpsim_bc_build *b, int op,
+				      int dst)
+{
+  struct chpsim_bc_op *x;
+  A_NEW (b->op, struct chpsim_bc_op);
+  x = &A_NEXT (b->op);
+  A_INC (b->op);
+  x->op = op;
+  x->dst = dst;
+  x->a = 0;
+  x->b = 0;
+  x->x = 0;
+  x->k = 0;
+  x->d = NULL;
+  return x;
+}
+
+/* compute e into register r; *w is the width of the result, or -1 */
+static int _bc_gen (struct chpsim_bc_build *b, Expr *e, int r, int *w)
+{
+  struct chpsim_bc_op *x;
+  unsigned long v;
+  int wl, wr, op, jz, jmp;
+
+  if (r >= CHPSIM_BC_MAXREG) {
+    return 0;
+  }
+  if (r + 1 > b->nregs) {
+    b->nregs = r + 1;
+  }
+
+  switch (e->type) {
+  case E_TRUE:
+  case E_FALSE:
+    x = _bc_emit (b, BC_CONST, r);
+    x->k = (e->type == E_TRUE ? 1 : 0);
+    *w = 1;
+    return 1;
+
+  case E_INT:
+    if (e->u.ival.v_extra) {
+      return 0;
+    }
+    x = _bc_emit (b, BC_CONST, r);
+    x->k = e->u.ival.v;
+    v = e->u.ival.v;
+    wl = 0;
+    while (v) {
+      v = v >> 1;
+      wl++;
+    }
+    *w = (wl == 0 ? 1 : wl);
+    return 1;
+
+  case E_AND:
+  case E_OR:
+  case E_XOR:
+  case E_PLUS:
+  case E_MULT:
+    if (e->u.e.l->type == E_INT || e->u.e.l->type == E_TRUE ||
+	e->u.e.l->type == E_FALSE || e->u.e.l->type == E_QUERY) {
+      return 0;
+    }
+    /* fall through */
+  case E_MINUS:
+  case E_LSR:
+  case E_LT:
+  case E_GT:
+  case E_LE:
+  case E_GE:
+  case E_EQ:
+  case E_NE:
+    if (!_bc_gen (b, e->u.e.l, r, &wl) ||
+	!_bc_gen (b, e->u.e.r, r + 1, &wr)) {
+      return 0;
+    }
+    *w = -1;
+    v = 0;
+    switch (e->type) {
+    case E_AND: op = BC_AND; break;
+    case E_OR:  op = BC_OR;  break;
+    case E_XOR: op = BC_XOR; break;
+    case E_PLUS: op = BC_PLUS; break;
+    case E_MULT: op = BC_MULT; break;
+    case E_MINUS:
+      {
+	phash_bucket_t *pb = b->sc->exprWidth (e);
+	if (!pb || pb->i > 64) {
+	  return 0;
+	}
+	op = BC_MINUS;
+	v = MASK64 (pb->i);
+      }
+      break;
+    case E_LSR: op = BC_LSR; *w = wl; break;
+    case E_LT: op = BC_LT; *w = 1; break;
+    case E_GT: op = BC_GT; *w = 1; break;
+    case E_LE: op = BC_LE; *w = 1; break;
+    case E_GE: op = BC_GE; *w = 1; break;
+    case E_EQ: op = BC_EQ; *w = 1; break;
+    default:   op = BC_NE; *w = 1; break;
+    }
+    x = _bc_emit (b, op, r);
+    x->a = r;
+    x->b = r + 1;
+    x->k = v;
+    return 1;
+
+  case E_NOT:
+  case E_COMPLEMENT:
+    if (!_bc_gen (b, e->u.e.l, r, &wl) || wl < 0) {
+      return 0;
+    }
+    if (wl < (long)e->u.e.r) {
+      wl = (long)e->u.e.r;
+    }
+    if (wl > 64) {
+      return 0;
+    }
+    x = _bc_emit (b, BC_NOT, r);
+    x->a = r;
+    x->k = MASK64 (wl);
+    *w = wl;
+    return 1;
+
+  case E_QUERY:
+    if (!_bc_gen (b, e->u.e.l, r, &wl)) {
+      return 0;
+    }
+    jz = A_LEN (b->op);
+    x = _bc_emit (b, BC_JZ, r);
+    x->a = r;
+    if (!_bc_gen (b, e->u.e.r->u.e.l, r, &wl)) {
+      return 0;
+    }
+    jmp = A_LEN (b->op);
+    _bc_emit (b, BC_JMP, r);
+    b->op[jz].x = A_LEN (b->op);
+    if (!_bc_gen (b, e->u.e.r->u.e.r, r, &wr)) {
+      return 0;
+    }
+    b->op[jmp].x = A_LEN (b->op);
+    *w = (wl == wr ? wl : -1);
+    return 1;
+
+  case E_CHP_VARBOOL:
+    x = _bc_emit (b, BC_BOOL, r);
+    x->x = e->u.x.val;
+    *w = 1;
+    return 1;
+
+  case E_CHP_VARINT:
+    if (e->u.x.extra > 64) {
+      return 0;
+    }
+    x = _bc_emit (b, BC_INT, r);
+    x->x = e->u.x.val;
+    x->k = MASK64 (e->u.x.extra);
+    *w = e->u.x.extra;
+    return 1;
+
+  case E_CHP_VARBOOL_DEREF:
+  case E_CHP_VARINT_DEREF:
+    {
+      struct chpsimderef *d = (struct chpsimderef *)e->u.e.l;
+      if (d->width > 64) {
+	return 0;
+      }
+      x = _bc_emit (b, e->type == E_CHP_VARBOOL_DEREF ? BC_DBOOL : BC_DINT,
+		    r);
+      x->d = d;
+      x->k = MASK64 (d->width);
+      *w = d->width;
+    }
+    return 1;
+
+  default:
+    break;
+  }
+  return 0;
+}
+
+/* need_width: only compile e if the width of the result is known */
+static struct chpsim_bc *chpsim_bc_compile (Expr *e, ActSimCore *s,
+					    int need_width)
+{
+  struct chpsim_bc_build b;
+  struct chpsim_bc *ret;
+  int w;
+
+  if (!e || !s->chpInt64()) {
+    return NULL;
+  }
+  b.sc = s;
+  b.nregs = 0;
+  A_INIT (b.op);
+  if (!_bc_gen (&b, e, 0, &w) || (need_width && w < 0)) {
+    A_FREE (b.op);
+    return NULL;
+  }
+  NEW (ret, struct chpsim_bc);
+  ret->nops = A_LEN (b.op);
+  ret->nregs = b.nregs;
+  ret->width = w;
+  ret->op = b.op;
+  return ret;
+}
+
+static void chpsim_bc_free (struct chpsim_bc *bc)
+{
+  if (!bc) return;
+  FREE (bc->op);
+  FREE (bc);
+}
+
 static chpsimstmt *gc_to_chpsim (act_chp_gc_t *gc, ActSimCore *s)
 {
   chpsimcond *tmp;
@@ -4597,6 +5311,7 @@ static chpsimstmt *gc_to_chpsim (act_chp_gc_t *gc, ActSimCore *s)
     }
     tmp->next = NULL;
     tmp->g = expr_to_chp_expr (gc->g, s, &flags);
+    tmp->bc = chpsim_bc_compile (tmp->g, s, 0);
     gc = gc->next;
   }
 
@@ -4703,6 +5418,7 @@ chpsimgraph_info *ChpSimGraph::buildChpSimGraph (ActSimCore *sc,
 	  }
 	  tmp->next = NULL;
 	  tmp->g = expr_to_chp_expr (e, sc, &flags);
+	  tmp->bc = chpsim_bc_compile (tmp->g, sc, 0);
 
 	  // then label
 	  li = list_next (li);
@@ -4986,12 +5702,17 @@ ChpSimGraph *ChpSimGraph::_buildChpSimGraph (ActSimCore *sc,
 	ret->stmt->u.sendrecv.width = -1;
       }
       ret->stmt->u.sendrecv.e = NULL;
+      ret->stmt->u.sendrecv.bc = NULL;
       ret->stmt->u.sendrecv.d = NULL;
       ret->stmt->u.sendrecv.is_structx = 0;
 
       if (c->u.comm.e) {
 	int flags = 0;
 	ret->stmt->u.sendrecv.e = expr_to_chp_expr (c->u.comm.e, sc, &flags);
+	if (!ch_struct) {
+	  ret->stmt->u.sendrecv.bc =
+	    chpsim_bc_compile (ret->stmt->u.sendrecv.e, sc, 1);
+	}
       }
       if (c->u.comm.var) {
 	ActId *id = c->u.comm.var;
@@ -5084,6 +5805,7 @@ ChpSimGraph *ChpSimGraph::_buildChpSimGraph (ActSimCore *sc,
       }
 
       ret->stmt->u.sendrecv.e = NULL;
+      ret->stmt->u.sendrecv.bc = NULL;
       ret->stmt->u.sendrecv.d = NULL;
       ret->stmt->u.sendrecv.is_structx = 0;
 
@@ -5096,6 +5818,8 @@ ChpSimGraph *ChpSimGraph::_buildChpSimGraph (ActSimCore *sc,
 	}
 	else {
 	  ret->stmt->u.sendrecv.is_structx = 1;
+	  ret->stmt->u.sendrecv.bc =
+	    chpsim_bc_compile (ret->stmt->u.sendrecv.e, sc, 1);
 	}
       }
       if (c->u.comm.var) {
@@ -5240,6 +5964,13 @@ ChpSimGraph *ChpSimGraph::_buildChpSimGraph (ActSimCore *sc,
 	ret->stmt->u.assign.is_struct = 0;
       }
       ret->stmt->u.assign.e = expr_to_chp_expr (c->u.assign.e, sc, &flags);
+      if (ret->stmt->u.assign.is_struct) {
+	ret->stmt->u.assign.bc = NULL;
+      }
+      else {
+	ret->stmt->u.assign.bc = chpsim_bc_compile (ret->stmt->u.assign.e,
+						    sc, 0);
+      }
 
       if (ret->stmt->u.assign.is_struct) {
 	if (ActBooleanizePass::isDynamicRef (sc->cursi()->bnl, c->u.assign.id))  {
@@ -5561,6 +6292,337 @@ void ChpSim::dumpState (FILE *fp)
   fprintf (fp, "\n");
 }
 
+/*
+ * Checkpoint numbering of the nodes of a ChpSimGraph. The numbering
+ * is built on first use and shared by all instances that run the
+ * same graph.
+ */
+struct chpsim_ckpt_map {
+  struct pHashtable *H;		/* node -> index */
+  A_DECL (ChpSimGraph *, n);	/* index -> node */
+};
+
+static struct pHashtable *_ckpt_maps = NULL;
+
+static void _ckpt_number (chpsim_ckpt_map *m, ChpSimGraph *g)
+{
+  phash_bucket_t *b;
+  int cnt;
+
+  if (!g || phash_lookup (m->H, g)) {
+    return;
+  }
+  b = phash_add (m->H, g);
+  b->i = A_LEN (m->n);
+  A_NEW (m->n, ChpSimGraph *);
+  A_NEXT (m->n) = g;
+  A_INC (m->n);
+
+  if (g->stmt) {
+    switch (g->stmt->type) {
+    case CHPSIM_FORK:
+      for (int i=0; i < g->stmt->u.fork; i++) {
+	_ckpt_number (m, g->all[i]);
+      }
+      break;
+
+    case CHPSIM_COND:
+    case CHPSIM_CONDARB:
+    case CHPSIM_LOOP:
+      cnt = 0;
+      for (struct chpsimcond *x = &g->stmt->u.cond.c; x; x = x->next) {
+	_ckpt_number (m, g->all[cnt]);
+	cnt++;
+      }
+      break;
+
+    default:
+      break;
+    }
+  }
+  _ckpt_number (m, g->next);
+}
+
+static chpsim_ckpt_map *_ckpt_getmap (ChpSimGraph *root)
+{
+  phash_bucket_t *b;
+  chpsim_ckpt_map *m;
+
+  if (!_ckpt_maps) {
+    _ckpt_maps = phash_new (8);
+  }
+  b = phash_lookup (_ckpt_maps, root);
+  if (b) {
+    return (chpsim_ckpt_map *) b->v;
+  }
+  NEW (m, chpsim_ckpt_map);
+  m->H = phash_new (16);
+  A_INIT (m->n);
+  _ckpt_number (m, root);
+  b = phash_add (_ckpt_maps, root);
+  b->v = m;
+  return m;
+}
+
+static void _ckpt_put_list (act_ckpt *ck, list_t *l)
+{
+  ckpt_put_int (ck, l ? list_length (l) : 0);
+  if (l) {
+    for (listitem_t *li = list_first (l); li; li = list_next (li)) {
+      ckpt_put_int (ck, list_ivalue (li));
+    }
+  }
+}
+
+/*
+  Each thread is saved as the index of its graph node, together with
+  the pending event for it (if any) and the time it is due. Threads
+  blocked on a channel are re-attached to the channel on restore;
+  threads waiting on guards or probes simply re-evaluate them.
+*/
+void ChpSim::saveState (act_ckpt *ck)
+{
+  chpsim_ckpt_map *m;
+  phash_bucket_t *b;
+  list_t *ev;
+  int n;
+
+  ckpt_put_int (ck, _npc);
+  if (_npc == 0) {
+    return;
+  }
+  m = _ckpt_getmap (_root);
+  ckpt_put_int (ck, A_LEN (m->n));
+  ckpt_put_int (ck, _pcused);
+  for (int i=0; i < _npc; i++) {
+    if (_pc[i]) {
+      b = phash_lookup (m->H, _pc[i]);
+      Assert (b, "Program counter not in the program graph?");
+      ckpt_put_int (ck, b->i);
+    }
+    else {
+      ckpt_put_int (ck, -1);
+    }
+    ckpt_put_int (ck, _holes[i]);
+  }
+  ckpt_put_int (ck, _maxcnt);
+  for (int i=0; i < _maxcnt; i++) {
+    ckpt_put_int (ck, _tot[i]);
+  }
+  ckpt_put_int (ck, _maxstats);
+  for (int i=0; i < _maxstats; i++) {
+    ckpt_put_ulong (ck, _stats[i]);
+  }
+  _ckpt_put_list (ck, _stalled_pc);
+  _ckpt_put_list (ck, _deadlock_pc);
+
+  b = ck->ev ? phash_lookup (ck->ev, this) : NULL;
+  ev = b ? (list_t *) b->v : NULL;
+  n = 0;
+  if (ev) {
+    for (listitem_t *li = list_first (ev); li; li = list_next (li)) {
+      if (SIM_EV_TYPE (list_ivalue (li)) < _npc) {
+	n++;
+      }
+    }
+  }
+  ckpt_put_int (ck, n);
+  if (ev) {
+    for (listitem_t *li = list_first (ev); li; li = list_next (li)) {
+      int pc = SIM_EV_TYPE (list_ivalue (li));
+      int flag = SIM_EV_FLAGS (list_ivalue (li));
+      unsigned long tm;
+      if (pc >= _npc) {
+	/* shared variable wake-up; stalled threads are retried */
+	continue;
+      }
+      tm = ck->now;
+      if (flag == 0 && _pc_tm[pc] > tm) {
+	tm = _pc_tm[pc];
+      }
+      ckpt_put_int (ck, pc);
+      ckpt_put_int (ck, flag);
+      ckpt_put_ulong (ck, tm);
+    }
+  }
+}
+
+void ChpSim::restoreState (act_ckpt *ck)
+{
+  chpsim_ckpt_map *m;
+  int n, pc, flag, idx;
+  unsigned long tm;
+  char *waiting;
+
+  if (ckpt_get_int (ck) != _npc) {
+    ckpt_error (ck, "CHP process does not match the design");
+    return;
+  }
+  if (_npc == 0) {
+    return;
+  }
+  m = _ckpt_getmap (_root);
+  if (ckpt_get_int (ck) != A_LEN (m->n)) {
+    ckpt_error (ck, "CHP process does not match the design");
+    return;
+  }
+
+  /*-- detach the current threads from anything they are waiting on --*/
+  for (int i=0; !ck->dry && i < _npc; i++) {
+    if (!_pc[i] || !_pc[i]->stmt) {
+      continue;
+    }
+    switch (_pc[i]->stmt->type) {
+    case CHPSIM_SEND:
+    case CHPSIM_RECV:
+      {
+	act_channel_state *c;
+	c = _sc->getChan (getGlobalOffset (_pc[i]->stmt->u.sendrecv.chvar, 2));
+	if (c->w->isWaiting (this)) {
+	  c->w->DelObject (this);
+	}
+      }
+      break;
+
+    case CHPSIM_COND:
+    case CHPSIM_CONDARB:
+    case CHPSIM_LOOP:
+      _add_waitcond (&_pc[i]->stmt->u.cond.c, i, 1);
+      break;
+
+    default:
+      break;
+    }
+  }
+  if (!ck->dry) {
+    if (sWaiting()) {
+      sRemove ();
+    }
+    list_free (_stalled_pc);
+    _stalled_pc = list_new ();
+    if (_deadlock_pc) {
+      list_free (_deadlock_pc);
+      _deadlock_pc = NULL;
+    }
+  }
+
+  /*-- program counters --*/
+  n = ckpt_get_int (ck);
+  if (!ck->dry) {
+    _pcused = n;
+  }
+  for (int i=0; i < _npc; i++) {
+    idx = ckpt_get_int (ck);
+    n = ckpt_get_int (ck);
+    if (idx < -1 || idx >= A_LEN (m->n)) {
+      ckpt_error (ck, "corrupt CHP program counter");
+      return;
+    }
+    if (!ck->dry) {
+      _pc[i] = (idx == -1) ? NULL : m->n[idx];
+      _holes[i] = n;
+    }
+  }
+  if (ckpt_get_int (ck) != _maxcnt) {
+    ckpt_error (ck, "CHP process does not match the design");
+    return;
+  }
+  for (int i=0; i < _maxcnt; i++) {
+    n = ckpt_get_int (ck);
+    if (!ck->dry) {
+      _tot[i] = n;
+    }
+  }
+  if (ckpt_get_int (ck) != _maxstats) {
+    ckpt_error (ck, "CHP process does not match the design");
+    return;
+  }
+  for (int i=0; i < _maxstats; i++) {
+    tm = ckpt_get_ulong (ck);
+    if (!ck->dry) {
+      _stats[i] = tm;
+    }
+  }
+
+  /* threads that need to run again: stalled ones retry now */
+  MALLOC (waiting, char, _npc);
+  for (int i=0; i < _npc; i++) {
+    waiting[i] = (_pc[i] ? 1 : 0);
+  }
+  n = ckpt_get_int (ck);
+  for (int i=0; i < n; i++) {
+    pc = ckpt_get_int (ck);
+    if (ck->err || pc < 0 || pc >= _npc) {
+      ckpt_error (ck, "corrupt CHP program counter");
+      FREE (waiting);
+      return;
+    }
+    waiting[pc] = 0;
+    if (!ck->dry) {
+      ActEvent::make (this, SIM_EV_MKTYPE (pc, 0), 0);
+    }
+  }
+  n = ckpt_get_int (ck);
+  for (int i=0; i < n; i++) {
+    pc = ckpt_get_int (ck);
+    if (ck->err || pc < 0 || pc >= _npc) {
+      ckpt_error (ck, "corrupt CHP program counter");
+      FREE (waiting);
+      return;
+    }
+    waiting[pc] = 0;
+    if (!ck->dry) {
+      if (!_deadlock_pc) {
+	_deadlock_pc = list_new ();
+      }
+      list_iappend (_deadlock_pc, pc);
+    }
+  }
+  n = ckpt_get_int (ck);
+  for (int i=0; i < n; i++) {
+    pc = ckpt_get_int (ck);
+    flag = ckpt_get_int (ck);
+    tm = ckpt_get_ulong (ck);
+    if (ck->err || pc < 0 || pc >= _npc || tm < ck->now) {
+      ckpt_error (ck, "corrupt CHP program counter");
+      FREE (waiting);
+      return;
+    }
+    waiting[pc] = 0;
+    if (!ck->dry) {
+      ActEvent::make (this, SIM_EV_MKTYPE (pc, flag), tm - ck->now);
+      _pc_tm[pc] = tm;
+    }
+  }
+  if (ck->dry) {
+    FREE (waiting);
+    return;
+  }
+
+  /* remaining threads are blocked; channel waits are re-attached,
+     probes are re-posted by evaluating the guards again */
+  for (int i=0; i < _npc; i++) {
+    if (!waiting[i] || !_pc[i]->stmt) {
+      continue;
+    }
+    if (_pc[i]->stmt->type == CHPSIM_SEND ||
+	_pc[i]->stmt->type == CHPSIM_RECV) {
+      act_channel_state *c;
+      c = _sc->getChan (getGlobalOffset (_pc[i]->stmt->u.sendrecv.chvar, 2));
+      if ((c->send_here == i+1 && !c->sender_probe) ||
+	  (c->recv_here == i+1 && !c->receiver_probe)) {
+	if (!c->w->isWaiting (this)) {
+	  c->w->AddObject (this);
+	}
+	c->waiter = this;
+	continue;
+      }
+    }
+    ActEvent::make (this, SIM_EV_MKTYPE (i, 0), 0);
+  }
+  FREE (waiting);
+}
+
 void ChpSim::dumpStats (FILE *fp)
 {
   if (_maxstats > 0) {
@@ -5627,10 +6689,12 @@ ChpSimGraph::~ChpSimGraph ()
 	int nguards = 1;
 	int nw;
 	_free_chp_expr (stmt->u.cond.c.g);
+	chpsim_bc_free (stmt->u.cond.c.bc);
 	x = stmt->u.cond.c.next;
 	while (x) {
 	  struct chpsimcond *t;
 	  _free_chp_expr (x->g);
+	  chpsim_bc_free (x->bc);
 	  t = x->next;
 	  FREE (x);
 	  x = t;
@@ -5666,6 +6730,7 @@ ChpSimGraph::~ChpSimGraph ()
     case CHPSIM_ASSIGN:
       _free_deref (&stmt->u.assign.d);
       _free_chp_expr (stmt->u.assign.e);
+      chpsim_bc_free (stmt->u.assign.bc);
       break;
 
     case CHPSIM_NOP:
@@ -5676,6 +6741,7 @@ ChpSimGraph::~ChpSimGraph ()
       if (stmt->u.sendrecv.e) {
 	_free_chp_expr (stmt->u.sendrecv.e);
       }
+      chpsim_bc_free (stmt->u.sendrecv.bc);
       if (stmt->u.sendrecv.d) {
 	_free_deref (stmt->u.sendrecv.d);
       }
@@ -5800,76 +6866,22 @@ int ChpSim::_structure_assign (struct chpsimderef *d, expr_multires *v)
 
 void ChpSim::boolProp (int glob_off)
 {
-  SimDES **arr;
-  arr = _sc->getFO (glob_off, 0);
-
 #ifdef DUMP_ALL
 #if 0
   printf ("  >>> propagate %d\n", _sc->numFanout (glob_off, 0));
 #endif
 #endif
-  for (int i=0; i < _sc->numFanout (glob_off, 0); i++) {
-    ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-    Assert (p, "What?");
-#ifdef DUMP_ALL
-#if 0
-      printf ("   prop: ");
-      {
-	ActSimObj *obj = dynamic_cast<ActSimObj *>(p);
-	if (obj) {
-	  if (obj->getName()) {
-	    obj->getName()->Print (stdout);
-	  }
-	  else {
-	    printf ("-none-");
-	  }
-	}
-	else {
-	  printf ("#%p", p);
-	}
-      }
-      printf ("\n");
-#endif
-#endif
-    p->propagate ();
-  }
+  _sc->propagateFanout (glob_off, 0);
 }
 
 void ChpSim::intProp (int glob_off)
 {
-  SimDES **arr;
-  arr = _sc->getFO (glob_off, 1);
-
 #ifdef DUMP_ALL
 #if 0
   printf ("  >>> propagate %d\n", _sc->numFanout (glob_off, 0));
 #endif
 #endif
-  for (int i=0; i < _sc->numFanout (glob_off, 1); i++) {
-    ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-    Assert (p, "What?");
-#ifdef DUMP_ALL
-#if 0
-      printf ("   prop: ");
-      {
-	ActSimObj *obj = dynamic_cast<ActSimObj *>(p);
-	if (obj) {
-	  if (obj->getName()) {
-	    obj->getName()->Print (stdout);
-	  }
-	  else {
-	    printf ("-none-");
-	  }
-	}
-	else {
-	  printf ("#%p", p);
-	}
-      }
-      printf ("\n");
-#endif
-#endif
-    p->propagate ();
-  }
+  _sc->propagateFanout (glob_off, 1);
 }
 
 
@@ -5986,17 +6998,17 @@ int ChpSim::chkWatchBreakPt (int type, int loff, int goff, const BigInt& v,
 	  if (umode == 1) {
 	    _sc->recordTrace (nm, 2, ACT_CHAN_SEND_BLOCKED, v);
 	    ChanTraceDelayed *obj = new ChanTraceDelayed (nm, v);
-	    new Event (obj, SIM_EV_MKTYPE (0, 0), 1);
+	    ActEvent::make (obj, SIM_EV_MKTYPE (0, 0), 1);
 	  }
 	  else {
 	    _sc->recordTrace (nm, 2, ACT_CHAN_VALUE, v);
 	    ChanTraceDelayed *obj = new ChanTraceDelayed (nm);
-	    new Event (obj, SIM_EV_MKTYPE (0, 0), 1);
+	    ActEvent::make (obj, SIM_EV_MKTYPE (0, 0), 1);
 	  }
 	}
 	else {
 	  ChanTraceDelayed *obj = new ChanTraceDelayed (nm);
-	  new Event (obj, SIM_EV_MKTYPE (0, 0), 1);
+	  ActEvent::make (obj, SIM_EV_MKTYPE (0, 0), 1);
 	  printf ("%s : send complete\n", nm->s);
 	}
 	
@@ -6189,7 +7201,7 @@ void ChpSim::awakenDeadlockedGC ()
     while (!list_isempty (_deadlock_pc)) {
       x = list_delete_ihead (_deadlock_pc);
       if (_pc[x]) {
-	new Event (this, SIM_EV_MKTYPE (x,0), 0);
+	ActEvent::make (this, SIM_EV_MKTYPE (x,0), 0);
       }
     }
   }
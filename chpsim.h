@@ -29,8 +29,11 @@
 
 /*--- CHP simulation data structures ---*/
 
+struct chpsim_bc;
+
 struct chpsimcond {
   Expr *g;
+  struct chpsim_bc *bc;		/* compiled guard, if any */
   struct chpsimcond *next;
 };
 
@@ -47,6 +50,8 @@ struct chpsimcond {
 struct chpsimderef {
   Array *range;			// if NULL, then offset is the id
   Expr **chp_idx;
+  struct chpsim_bc **idx_bc;	// compiled chp_idx, NULL entries
+				// go through exprEval
   int *idx;			// for structures, we use this
 				// array. Length is 3x the # of items
 				// in the struct. Format: offset,
@@ -62,6 +67,30 @@ struct chpsimderef {
   act_connection *cx;
 };
 
+/*
+ * Compiled form of a CHP expression that fits in 64 bits. Each
+ * instruction works on a small file of unsigned long registers;
+ * variables are named by their local offset and array references by
+ * their chpsimderef, so one program is shared by all instances of a
+ * process. The result is left in register 0.
+ */
+#define CHPSIM_BC_MAXREG 32
+
+struct chpsim_bc_op {
+  unsigned char op;		/* opcode (BC_...) */
+  unsigned char dst, a, b;	/* registers */
+  int x;			/* local offset or jump target */
+  unsigned long k;		/* constant or result mask */
+  struct chpsimderef *d;	/* array reference, if any */
+};
+
+struct chpsim_bc {
+  int nops;
+  int nregs;
+  int width;			/* width of the result, -1 if unknown */
+  struct chpsim_bc_op *op;
+};
+
 struct chpsimstmt {
   int type;
   int delay_cost;
@@ -84,6 +113,7 @@ struct chpsimstmt {
 				   */
       unsigned int is_struct:1;	// 1 if structure, 0 otherwise
       Expr *e;
+      struct chpsim_bc *bc;	/* compiled e, if any */
       struct chpsimderef d;	/* variable deref */
     } assign;			/* var := e */
     struct {
@@ -96,6 +126,7 @@ struct chpsimstmt {
 				 // 2 if bidir and struct
       int width;		 // channel width
       Expr *e;			// outgoing expression, if any
+      struct chpsim_bc *bc;	// compiled e, if any
       struct chpsimderef *d;	// variable, if any
     } sendrecv;
   } u;
@@ -176,6 +207,11 @@ class ChpSim : public ActSimObj {
 
   int Step (Event *ev);		/* run a step of the simulation */
 
+  /* CHP event counts: continuation events, channel wake-up events,
+     and wake-ups replaced by a direct hand-off */
+  static void eventStats (unsigned long *next, unsigned long *wake,
+			  unsigned long *direct);
+
   void reStart (ChpSimGraph *g, int maxcnt);
   
   int jumpTo (const char *s);
@@ -189,6 +225,8 @@ class ChpSim : public ActSimObj {
   void zeroInit ();
 
   void dumpState (FILE *fp);
+  void saveState (act_ckpt *ck);
+  void restoreState (act_ckpt *ck);
   unsigned long getEnergy (void);
   double getLeakage (void);
   unsigned long getArea (void);
@@ -220,9 +258,15 @@ class ChpSim : public ActSimObj {
   ChpSimGraph **_pc;		/* current PC state of simulation */
   int *_holes;			/* available slots in the _pc array */
   int *_tot;			/* current pending concurrent count */
+  int _maxcnt;			/* size of _tot[] */
+  unsigned long *_pc_tm;	/* time of the next scheduled event
+				   for each _pc[] slot */
+  ChpSimGraph *_root;		/* start of the program */
 
   list_t *_deadlock_pc;
   list_t *_stalled_pc;
+  int *_true_gd;		/* indices of true guards in a selection */
+  int _true_gd_max;		/* size of _true_gd[] */
   act_chp_lang_t *_savedc;
 
   unsigned long _energy_cost;
@@ -246,6 +290,9 @@ class ChpSim : public ActSimObj {
   int _maxstats;
   int _hse_mode;		// is this a HSE?
 
+  int _bcEval (struct chpsim_bc *bc, unsigned long *v);
+  int _exprTrue (chpsimcond *gc);
+
   BigInt funcEval (Function *, int, void **);
   BigInt varEval (int id, int type);
   expr_multires varChanEvalStruct (int id, int type);
@@ -275,6 +322,12 @@ class ChpSim : public ActSimObj {
   void _remove_me (int pc);
 
   int _nextEvent (int pc, int bw_delay);
+  int _step (int ev_type);
+  int _handoff (act_channel_state *c, int peer_pc);
+  int _peer_brk;		/* a peer completed by _handoff() hit
+				   a breakpoint */
+
+  static unsigned long _ev_next, _ev_wake, _ev_direct;
   void _initEvent ();
   void _zeroAllIntsChans (ChpSimGraph *g);
   void _zeroStructure (struct chpsimderef *d);
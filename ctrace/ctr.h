@@ -0,0 +1,167 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_CTR_H__
+#define __ACT_CTR_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Columnar trace format ("ctr").
+ *
+ *   [header]
+ *   [blocks]            each block holds changes of one signal
+ *   [signal directory]  one ctr_sig per signal
+ *   [block index]       per signal, its blocks in time order
+ *   [string table]      signal names
+ *
+ * Blocks are CTR_BLOCK bytes (a single change wider than that gets
+ * a block of a multiple of CTR_BLOCK bytes). A block starts with a
+ * ctr_blkhdr, followed by nchg changes:
+ *
+ *   varint  time - time of the previous change in the block
+ *   bool:   1 byte, 0/1/2 (= X)
+ *   int:    nw varints, each word XOR the previous value
+ *   chan:   1 byte state; for CTR_CHAN_VALUE, nw varints as above
+ *   analog: 1 varint, float bits XOR the previous value
+ *
+ * The previous value and time are zero at the start of every block,
+ * so any block can be decoded on its own. To read a time window, a
+ * reader looks up the last block of each signal that starts at or
+ * before the window in the block index and decodes from there.
+ *
+ * Times are integers in units of dt seconds. All fields are in host
+ * byte order.
+ */
+
+#define CTR_MAGIC   "ACTCTR1"
+#define CTR_VERSION 1
+#define CTR_BLOCK   2048
+
+#define CTR_BOOL    0
+#define CTR_INT     1
+#define CTR_CHAN    2
+#define CTR_ANALOG  3
+
+#define CTR_CHAN_IDLE         0
+#define CTR_CHAN_RECV_BLOCKED 1
+#define CTR_CHAN_SEND_BLOCKED 2
+#define CTR_CHAN_VALUE        3
+
+/* # of 64-bit words holding a value of the given width */
+#define CTR_NW(type,width) \
+  (((type) == CTR_INT || (type) == CTR_CHAN) && (width) > 64 ? \
+   ((width) + 63)/64 : 1)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t blksz;		/* CTR_BLOCK */
+  uint64_t nsig;
+  uint64_t nblk;		/* total # of blocks */
+  uint64_t dir_off;		/* signal directory */
+  uint64_t str_off;		/* string table */
+  uint64_t t_end;		/* time of the last change */
+  double dt;			/* seconds per time unit */
+  uint64_t pad[8];
+} ctr_hdr;
+
+typedef struct {
+  uint32_t type;		/* CTR_BOOL, ... */
+  uint32_t width;
+  uint64_t name;		/* offset in the string table */
+  uint64_t nblk;
+  uint64_t blk_off;		/* offset of its ctr_blkent array */
+} ctr_sig;
+
+typedef struct {
+  uint64_t t_first, t_last;	/* times of the first/last change */
+  uint64_t off;			/* file offset of the block */
+  uint32_t len;			/* block size in bytes */
+  uint32_t nchg;		/* # of changes */
+} ctr_blkent;
+
+typedef struct {
+  uint32_t sig;
+  uint32_t nchg;
+  uint64_t t_first, t_last;
+  uint32_t used;		/* bytes of changes after the header */
+  uint32_t pad;
+} ctr_blkhdr;
+
+
+/*-- reader --*/
+
+typedef struct {
+  int fd;
+  unsigned char *base;		/* mmap'ed file */
+  uint64_t len;
+  const ctr_hdr *h;
+  const ctr_sig *sig;
+  const char *str;
+} ctr_file;
+
+/* position in the change stream of one signal */
+typedef struct {
+  const ctr_file *f;
+  int s, type, nw;
+  const ctr_blkent *blk;	/* block index of the signal */
+  uint64_t nblk, b;		/* current block */
+  const unsigned char *p;	/* next change in block b */
+  uint32_t left;		/* changes left in block b */
+
+  int valid;			/* cur holds a value */
+  uint64_t t;			/* current value */
+  int state;
+  uint64_t *val;
+
+  int more;			/* nxt holds the next change */
+  uint64_t nt;
+  int nstate;
+  uint64_t *nval;
+} ctr_iter;
+
+ctr_file *ctr_open (const char *name); /* NULL on error */
+void ctr_close (ctr_file *f);
+
+int ctr_nsig (const ctr_file *f);
+const char *ctr_name (const ctr_file *f, int s);
+int ctr_type (const ctr_file *f, int s);
+int ctr_width (const ctr_file *f, int s);
+int ctr_find (const ctr_file *f, const char *name); /* -1 if missing */
+
+/* position the iterator at time t0: valid is set if the signal has
+   a value at t0 (its last change at or before t0) */
+void ctr_iter_init (ctr_iter *it, const ctr_file *f, int s, uint64_t t0);
+
+/* advance to the next change; returns 0 at the end of the stream */
+int ctr_iter_next (ctr_iter *it);
+void ctr_iter_free (ctr_iter *it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ACT_CTR_H__ */
@@ -0,0 +1,320 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "ctr.h"
+
+/*
+ * Extract a time window of a ctr trace file as VCD.
+ *
+ * Each selected signal is positioned at the start of the window
+ * through the block index, and the per-signal streams are merged in
+ * time order, so the work done is proportional to the size of the
+ * window rather than the size of the file.
+ *
+ * Channels are written as vectors of the channel width: the value
+ * while a value is on the channel, z when idle, and x when a sender
+ * or receiver is blocked.
+ */
+
+static void usage (const char *s)
+{
+  fprintf (stderr, "Usage: %s [-l] [-s <start>] [-e <end>] [-o <out.vcd>] <file.ctr> [signal ...]\n", s);
+  fprintf (stderr, "  -l : list signals and exit\n");
+  fprintf (stderr, "  -s : start of the window (default 0)\n");
+  fprintf (stderr, "  -e : end of the window (default: end of the trace)\n");
+  fprintf (stderr, "  -o : output file (default: stdout)\n");
+  fprintf (stderr, " Times are in trace time units. With no signals, all signals are extracted.\n");
+  exit (1);
+}
+
+static const char *_tname[] = { "bool", "int", "chan", "analog" };
+
+/* VCD identifier for signal index i */
+static void vcd_id (char *buf, int i)
+{
+  int n = 0;
+  do {
+    buf[n++] = '!' + (i % 94);
+    i /= 94;
+  } while (i > 0);
+  buf[n] = '\0';
+}
+
+/* VCD timescale for dt seconds; *mult is set to the factor to apply
+   to trace times */
+static const char *vcd_timescale (double dt, uint64_t *mult)
+{
+  static char buf[32];
+  static const char *units[] = { "fs", "ps", "ns", "us", "ms", "s" };
+  double u = 1e-15;
+
+  *mult = 1;
+  if (dt <= 0) {
+    return "1 ps";
+  }
+  for (int i=0; i < 6; i++, u *= 1000) {
+    for (int m=1; m <= 100; m *= 10) {
+      if (fabs (dt - m*u) <= 1e-6*dt) {
+	snprintf (buf, 32, "%d %s", m, units[i]);
+	return buf;
+      }
+    }
+  }
+  *mult = llround (dt/1e-15);
+  if (*mult == 0) {
+    *mult = 1;
+  }
+  return "1 fs";
+}
+
+/* min-heap of iterators, ordered by the time of their next change;
+   ties go to the lower index to keep the output deterministic */
+#define HLESS(a,b) (it[a].nt < it[b].nt || (it[a].nt == it[b].nt && (a) < (b)))
+
+static void heap_push (int *heap, int *n, const ctr_iter *it, int x)
+{
+  int i = (*n)++;
+  while (i > 0 && HLESS (x, heap[(i-1)/2])) {
+    heap[i] = heap[(i-1)/2];
+    i = (i-1)/2;
+  }
+  heap[i] = x;
+}
+
+static void heap_pop (int *heap, int *n, const ctr_iter *it)
+{
+  int x = heap[--(*n)];
+  int i = 0;
+  while (2*i+1 < *n) {
+    int c = 2*i+1;
+    if (c+1 < *n && HLESS (heap[c+1], heap[c])) {
+      c++;
+    }
+    if (!HLESS (heap[c], x)) {
+      break;
+    }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = x;
+}
+
+static void vcd_value (FILE *fp, const ctr_iter *it, int width,
+		       const char *id)
+{
+  switch (it->type) {
+  case CTR_BOOL:
+    fprintf (fp, "%c%s\n", it->val[0] == 0 ? '0' : (it->val[0] == 1 ? '1' : 'x'), id);
+    break;
+
+  case CTR_ANALOG:
+    {
+      float f;
+      uint32_t b = it->val[0];
+      memcpy (&f, &b, sizeof (float));
+      fprintf (fp, "r%.16g %s\n", (double)f, id);
+    }
+    break;
+
+  case CTR_CHAN:
+    if (it->state == CTR_CHAN_IDLE) {
+      fprintf (fp, "bz %s\n", id);
+      break;
+    }
+    else if (it->state != CTR_CHAN_VALUE) {
+      fprintf (fp, "bx %s\n", id);
+      break;
+    }
+    /* fallthrough */
+  case CTR_INT:
+    {
+      int i, first = 1;
+      fputc ('b', fp);
+      for (i=width-1; i >= 0; i--) {
+	int bit = (it->val[i/64] >> (i % 64)) & 1;
+	if (bit || !first || i == 0) {
+	  fputc ('0' + bit, fp);
+	  first = 0;
+	}
+      }
+      fprintf (fp, " %s\n", id);
+    }
+    break;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  ctr_file *f;
+  int ch;
+  int list = 0;
+  uint64_t t0 = 0, t1 = ~(uint64_t)0;
+  const char *out = NULL;
+  FILE *fp;
+  int nsel, *sel;
+  ctr_iter *it;
+  uint64_t mult, last;
+  char id[8];
+  int *heap, nheap;
+
+  while ((ch = getopt (argc, argv, "ls:e:o:")) != -1) {
+    switch (ch) {
+    case 'l':
+      list = 1;
+      break;
+    case 's':
+      t0 = strtoull (optarg, NULL, 0);
+      break;
+    case 'e':
+      t1 = strtoull (optarg, NULL, 0);
+      break;
+    case 'o':
+      out = optarg;
+      break;
+    default:
+      usage (argv[0]);
+      break;
+    }
+  }
+  if (optind >= argc) {
+    usage (argv[0]);
+  }
+  f = ctr_open (argv[optind]);
+  if (!f) {
+    return 1;
+  }
+
+  if (list) {
+    printf ("# %d signals, %llu blocks, end time %llu, dt %g s\n",
+	    ctr_nsig (f), (unsigned long long) f->h->nblk,
+	    (unsigned long long) f->h->t_end, f->h->dt);
+    for (int i=0; i < ctr_nsig (f); i++) {
+      printf ("%s %s %d %llu\n", ctr_name (f, i),
+	      _tname[ctr_type (f, i) & 3], ctr_width (f, i),
+	      (unsigned long long) f->sig[i].nblk);
+    }
+    ctr_close (f);
+    return 0;
+  }
+
+  /*-- signals --*/
+  if (optind + 1 < argc) {
+    nsel = argc - optind - 1;
+    sel = (int *) malloc (sizeof (int)*nsel);
+    for (int i=0; i < nsel; i++) {
+      sel[i] = ctr_find (f, argv[optind+1+i]);
+      if (sel[i] == -1) {
+	fprintf (stderr, "%s: signal `%s' not found\n", argv[0],
+		 argv[optind+1+i]);
+	return 1;
+      }
+    }
+  }
+  else {
+    nsel = ctr_nsig (f);
+    sel = (int *) malloc (sizeof (int)*(nsel > 0 ? nsel : 1));
+    for (int i=0; i < nsel; i++) {
+      sel[i] = i;
+    }
+  }
+
+  if (out) {
+    fp = fopen (out, "w");
+    if (!fp) {
+      fprintf (stderr, "%s: could not open `%s'\n", argv[0], out);
+      return 1;
+    }
+  }
+  else {
+    fp = stdout;
+  }
+
+  /*-- header --*/
+  fprintf (fp, "$comment\n  window %llu - %llu of %s\n$end\n",
+	   (unsigned long long) t0, (unsigned long long) t1, argv[optind]);
+  fprintf (fp, "$timescale %s $end\n", vcd_timescale (f->h->dt, &mult));
+  fprintf (fp, "$scope module top $end\n");
+  for (int i=0; i < nsel; i++) {
+    int s = sel[i];
+    vcd_id (id, i);
+    if (ctr_type (f, s) == CTR_ANALOG) {
+      fprintf (fp, "$var real 64 %s %s $end\n", id, ctr_name (f, s));
+    }
+    else {
+      fprintf (fp, "$var wire %d %s %s $end\n", ctr_width (f, s), id,
+	       ctr_name (f, s));
+    }
+  }
+  fprintf (fp, "$upscope $end\n$enddefinitions $end\n");
+
+  /*-- values at the start of the window --*/
+  it = (ctr_iter *) malloc (sizeof (ctr_iter)*(nsel > 0 ? nsel : 1));
+  fprintf (fp, "#%llu\n$dumpvars\n", (unsigned long long) (t0*mult));
+  for (int i=0; i < nsel; i++) {
+    ctr_iter_init (&it[i], f, sel[i], t0);
+    if (it[i].valid) {
+      vcd_id (id, i);
+      vcd_value (fp, &it[i], ctr_width (f, sel[i]), id);
+    }
+  }
+  fprintf (fp, "$end\n");
+
+  /*-- merge the change streams up to t1 --*/
+  heap = (int *) malloc (sizeof (int)*(nsel > 0 ? nsel : 1));
+  nheap = 0;
+  for (int i=0; i < nsel; i++) {
+    if (it[i].more && it[i].nt <= t1) {
+      heap_push (heap, &nheap, it, i);
+    }
+  }
+  last = t0;
+  while (nheap > 0) {
+    int best = heap[0];
+    ctr_iter_next (&it[best]);
+    if (it[best].t != last) {
+      last = it[best].t;
+      fprintf (fp, "#%llu\n", (unsigned long long) (last*mult));
+    }
+    vcd_id (id, best);
+    vcd_value (fp, &it[best], ctr_width (f, sel[best]), id);
+    heap_pop (heap, &nheap, it);
+    if (it[best].more && it[best].nt <= t1) {
+      heap_push (heap, &nheap, it, best);
+    }
+  }
+  free (heap);
+
+  for (int i=0; i < nsel; i++) {
+    ctr_iter_free (&it[i]);
+  }
+  free (it);
+  free (sel);
+  if (fp != stdout) {
+    fclose (fp);
+  }
+  ctr_close (f);
+  return 0;
+}
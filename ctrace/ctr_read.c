@@ -0,0 +1,244 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ctr.h"
+
+/*
+ * Reader for the "ctr" trace format. The file is mmap'ed, and only
+ * the blocks that are decoded are paged in. This part has no
+ * dependence on the ACT libraries so that standalone tools can use
+ * it.
+ */
+
+ctr_file *ctr_open (const char *name)
+{
+  ctr_file *f;
+  struct stat st;
+  const ctr_hdr *h;
+
+  f = (ctr_file *) malloc (sizeof (ctr_file));
+  if (!f) {
+    return NULL;
+  }
+  f->fd = open (name, O_RDONLY);
+  if (f->fd < 0) {
+    fprintf (stderr, "ctr: could not open `%s'\n", name);
+    free (f);
+    return NULL;
+  }
+  if (fstat (f->fd, &st) != 0 || st.st_size < (off_t) sizeof (ctr_hdr)) {
+    fprintf (stderr, "ctr: `%s' is not a ctr trace file\n", name);
+    close (f->fd);
+    free (f);
+    return NULL;
+  }
+  f->len = st.st_size;
+  f->base = (unsigned char *)
+    mmap (NULL, f->len, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (f->base == MAP_FAILED) {
+    fprintf (stderr, "ctr: could not map `%s'\n", name);
+    close (f->fd);
+    free (f);
+    return NULL;
+  }
+  h = (const ctr_hdr *) f->base;
+  if (memcmp (h->magic, CTR_MAGIC, sizeof (CTR_MAGIC)) != 0 ||
+      h->version != CTR_VERSION ||
+      h->dir_off + h->nsig*sizeof (ctr_sig) > f->len ||
+      h->str_off > f->len) {
+    fprintf (stderr, "ctr: `%s' is not a ctr trace file, or it is incomplete\n", name);
+    ctr_close (f);
+    return NULL;
+  }
+  f->h = h;
+  f->sig = (const ctr_sig *) (f->base + h->dir_off);
+  f->str = (const char *) (f->base + h->str_off);
+  return f;
+}
+
+void ctr_close (ctr_file *f)
+{
+  munmap (f->base, f->len);
+  close (f->fd);
+  free (f);
+}
+
+int ctr_nsig (const ctr_file *f)
+{
+  return f->h->nsig;
+}
+
+const char *ctr_name (const ctr_file *f, int s)
+{
+  return f->str + f->sig[s].name;
+}
+
+int ctr_type (const ctr_file *f, int s)
+{
+  return f->sig[s].type;
+}
+
+int ctr_width (const ctr_file *f, int s)
+{
+  return f->sig[s].width;
+}
+
+int ctr_find (const ctr_file *f, const char *name)
+{
+  for (int i=0; i < ctr_nsig (f); i++) {
+    if (strcmp (ctr_name (f, i), name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint64_t _get_varint (const unsigned char **p)
+{
+  uint64_t v = 0;
+  int sh = 0;
+  const unsigned char *q = *p;
+
+  while (*q & 0x80) {
+    v |= (uint64_t)(*q & 0x7f) << sh;
+    sh += 7;
+    q++;
+  }
+  v |= (uint64_t)(*q) << sh;
+  *p = q + 1;
+  return v;
+}
+
+static void _start_block (ctr_iter *it)
+{
+  const ctr_blkent *e = &it->blk[it->b];
+  it->p = it->f->base + e->off + sizeof (ctr_blkhdr);
+  it->left = e->nchg;
+  it->nt = e->t_first;
+  for (int i=0; i < it->nw; i++) {
+    it->nval[i] = 0;
+  }
+  it->nstate = CTR_CHAN_IDLE;
+}
+
+/* decode the next change into nt/nval/nstate */
+static void _decode (ctr_iter *it)
+{
+  while (it->left == 0) {
+    it->b++;
+    if (it->b >= it->nblk) {
+      it->more = 0;
+      return;
+    }
+    _start_block (it);
+  }
+  it->nt += _get_varint (&it->p);
+  switch (it->type) {
+  case CTR_BOOL:
+    it->nval[0] = *it->p++;
+    break;
+
+  case CTR_CHAN:
+    it->nstate = *it->p++;
+    if (it->nstate != CTR_CHAN_VALUE) {
+      break;
+    }
+    /* fallthrough */
+  case CTR_INT:
+  case CTR_ANALOG:
+    for (int i=0; i < it->nw; i++) {
+      it->nval[i] ^= _get_varint (&it->p);
+    }
+    break;
+  }
+  it->left--;
+  it->more = 1;
+}
+
+void ctr_iter_init (ctr_iter *it, const ctr_file *f, int s, uint64_t t0)
+{
+  const ctr_sig *sg = &f->sig[s];
+  uint64_t lo, hi;
+
+  it->f = f;
+  it->s = s;
+  it->type = sg->type;
+  it->nw = CTR_NW (sg->type, sg->width);
+  it->blk = (const ctr_blkent *) (f->base + sg->blk_off);
+  it->nblk = sg->nblk;
+  it->val = (uint64_t *) calloc (it->nw, sizeof (uint64_t));
+  it->nval = (uint64_t *) calloc (it->nw, sizeof (uint64_t));
+  it->valid = 0;
+  it->t = 0;
+  it->state = CTR_CHAN_IDLE;
+  it->more = 0;
+
+  if (it->nblk == 0) {
+    return;
+  }
+
+  /* last block whose first change is at or before t0 */
+  lo = 0;
+  hi = it->nblk;
+  while (hi - lo > 1) {
+    uint64_t mid = (lo + hi)/2;
+    if (it->blk[mid].t_first <= t0) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  it->b = lo;
+  _start_block (it);
+  _decode (it);
+
+  while (it->more && it->nt <= t0) {
+    ctr_iter_next (it);
+  }
+}
+
+int ctr_iter_next (ctr_iter *it)
+{
+  if (!it->more) {
+    return 0;
+  }
+  /* nval is also the decoder's running value, so it is copied */
+  it->t = it->nt;
+  it->state = it->nstate;
+  memcpy (it->val, it->nval, it->nw*sizeof (uint64_t));
+  it->valid = 1;
+  _decode (it);
+  return 1;
+}
+
+void ctr_iter_free (ctr_iter *it)
+{
+  free (it->val);
+  free (it->nval);
+}
@@ -0,0 +1,525 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <common/misc.h>
+#include <act/tracelib.h>
+#include "ctr.h"
+
+/*
+ * Trace format plugin for the "ctr" format; see ctr.h for the file
+ * layout. The entry points follow the tracelib naming convention
+ * <fmt>_<function>, and are picked up by act_trace_load_format().
+ *
+ * Each signal accumulates changes in its own block buffer, which is
+ * written out when full. The directory, block index and names are
+ * written when the trace is closed, and the header is updated last.
+ */
+
+typedef struct {
+  char *name;
+  int type, width, nw;
+
+  unsigned char *buf;		/* current block, NULL until first change */
+  uint32_t blen;		/* its size */
+  uint32_t used;		/* bytes after the header */
+  uint32_t nchg;
+  uint64_t t_first, t_last;
+  uint64_t *prev;		/* previous value in the block */
+
+  ctr_blkent *blk;		/* blocks written so far */
+  uint64_t nblk, maxblk;
+} ctr_wsig;
+
+typedef struct {
+  FILE *fp;
+  uint64_t off;			/* end of the last block */
+  uint64_t t_end;
+  uint64_t nblk;
+  double dt;
+
+  ctr_wsig *sig;
+  int nsig, maxsig;
+
+  unsigned char *rec;		/* scratch for one encoded change */
+  uint32_t reclen;
+  uint64_t *vbuf;		/* scratch for one value */
+  int vmax;
+} ctr_writer;
+
+#define SIG(w,node) (&(w)->sig[(long)(node) - 1])
+
+static int _put_varint (unsigned char *p, uint64_t v)
+{
+  int n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static void *_create (const char *name, float dt)
+{
+  ctr_writer *w;
+  ctr_hdr h;
+
+  NEW (w, ctr_writer);
+  w->fp = fopen (name, "wb");
+  if (!w->fp) {
+    fprintf (stderr, "ctr: could not open `%s' for writing\n", name);
+    FREE (w);
+    return NULL;
+  }
+  memset (&h, 0, sizeof (h));
+  if (fwrite (&h, sizeof (h), 1, w->fp) != 1) {
+    fprintf (stderr, "ctr: write error on `%s'\n", name);
+    fclose (w->fp);
+    FREE (w);
+    return NULL;
+  }
+  w->off = sizeof (h);
+  w->t_end = 0;
+  w->nblk = 0;
+  w->dt = dt;
+  w->sig = NULL;
+  w->nsig = 0;
+  w->maxsig = 0;
+  w->rec = NULL;
+  w->reclen = 0;
+  w->vbuf = NULL;
+  w->vmax = 0;
+  return w;
+}
+
+void *ctr_create_tracefile (const char *name, float stop_time, float dt)
+{
+  return _create (name, dt);
+}
+
+void *ctr_create_tracefile_alt (const char *name, float stop_time, float dt)
+{
+  return _create (name, dt);
+}
+
+static void *_add_signal (void *handle, int type, const char *s, int width)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  ctr_wsig *x;
+
+  if (w->nsig == w->maxsig) {
+    w->maxsig = w->maxsig ? 2*w->maxsig : 64;
+    REALLOC (w->sig, ctr_wsig, w->maxsig);
+  }
+  x = &w->sig[w->nsig++];
+  x->name = Strdup (s);
+  x->type = type;
+  x->width = width;
+  x->nw = CTR_NW (type, width);
+  x->buf = NULL;
+  x->blen = 0;
+  x->used = 0;
+  x->nchg = 0;
+  x->t_first = 0;
+  x->t_last = 0;
+  MALLOC (x->prev, uint64_t, x->nw);
+  x->blk = NULL;
+  x->nblk = 0;
+  x->maxblk = 0;
+
+  /* 1-based, so that no signal is NULL */
+  return (void *)(long)w->nsig;
+}
+
+void *ctr_add_digital_signal (void *handle, const char *s)
+{
+  return _add_signal (handle, CTR_BOOL, s, 1);
+}
+
+void *ctr_add_int_signal (void *handle, const char *s, int width)
+{
+  return _add_signal (handle, CTR_INT, s, width);
+}
+
+void *ctr_add_chan_signal (void *handle, const char *s, int width)
+{
+  return _add_signal (handle, CTR_CHAN, s, width);
+}
+
+void *ctr_add_analog_signal (void *handle, const char *s)
+{
+  return _add_signal (handle, CTR_ANALOG, s, 32);
+}
+
+int ctr_init_start (void *handle)
+{
+  return 1;
+}
+
+int ctr_init_end (void *handle)
+{
+  return 1;
+}
+
+static int _flush_block (ctr_writer *w, ctr_wsig *x)
+{
+  ctr_blkhdr *bh;
+  ctr_blkent *e;
+
+  if (x->nchg == 0) {
+    return 1;
+  }
+  bh = (ctr_blkhdr *) x->buf;
+  bh->sig = x - w->sig;
+  bh->nchg = x->nchg;
+  bh->t_first = x->t_first;
+  bh->t_last = x->t_last;
+  bh->used = x->used;
+  bh->pad = 0;
+  memset (x->buf + sizeof (ctr_blkhdr) + x->used, 0,
+	  x->blen - sizeof (ctr_blkhdr) - x->used);
+  if (fwrite (x->buf, 1, x->blen, w->fp) != x->blen) {
+    fprintf (stderr, "ctr: write error\n");
+    return 0;
+  }
+
+  if (x->nblk == x->maxblk) {
+    x->maxblk = x->maxblk ? 2*x->maxblk : 4;
+    REALLOC (x->blk, ctr_blkent, x->maxblk);
+  }
+  e = &x->blk[x->nblk++];
+  e->t_first = x->t_first;
+  e->t_last = x->t_last;
+  e->off = w->off;
+  e->len = x->blen;
+  e->nchg = x->nchg;
+  w->off += x->blen;
+  w->nblk++;
+
+  x->used = 0;
+  x->nchg = 0;
+  return 1;
+}
+
+/* append a change to the signal; val has x->nw words */
+static int _change (ctr_writer *w, void *node, uint64_t t, int state,
+		    const uint64_t *val)
+{
+  ctr_wsig *x = SIG (w, node);
+  uint32_t need = 11 + 11*x->nw;
+  int n;
+
+  if (need > w->reclen) {
+    w->reclen = need;
+    REALLOC (w->rec, unsigned char, need);
+  }
+  if (x->nchg > 0 && x->used + need > x->blen - sizeof (ctr_blkhdr)) {
+    if (!_flush_block (w, x)) {
+      return 0;
+    }
+  }
+  if (x->nchg == 0) {
+    /* a change wider than a block gets a larger block */
+    uint32_t len = CTR_BLOCK;
+    while (need > len - sizeof (ctr_blkhdr)) {
+      len += CTR_BLOCK;
+    }
+    if (len != x->blen) {
+      REALLOC (x->buf, unsigned char, len);
+      x->blen = len;
+    }
+    x->t_first = t;
+    x->t_last = t;
+    for (int i=0; i < x->nw; i++) {
+      x->prev[i] = 0;
+    }
+  }
+  if (t < x->t_last) {
+    /* time never goes backward; keep the stream monotonic */
+    t = x->t_last;
+  }
+
+  n = _put_varint (w->rec, t - x->t_last);
+  switch (x->type) {
+  case CTR_BOOL:
+    w->rec[n++] = val[0];
+    break;
+
+  case CTR_CHAN:
+    w->rec[n++] = state;
+    if (state != CTR_CHAN_VALUE) {
+      break;
+    }
+    /* fallthrough */
+  case CTR_INT:
+  case CTR_ANALOG:
+    for (int i=0; i < x->nw; i++) {
+      n += _put_varint (w->rec + n, val[i] ^ x->prev[i]);
+      x->prev[i] = val[i];
+    }
+    break;
+  }
+  memcpy (x->buf + sizeof (ctr_blkhdr) + x->used, w->rec, n);
+  x->used += n;
+  x->nchg++;
+  x->t_last = t;
+  if (t > w->t_end) {
+    w->t_end = t;
+  }
+  return 1;
+}
+
+static uint64_t _ftime (ctr_writer *w, float t)
+{
+  if (w->dt <= 0) {
+    return (uint64_t) t;
+  }
+  return (uint64_t) llround (t / w->dt);
+}
+
+static uint64_t _atime (int len, unsigned long *tm)
+{
+  /* times beyond 64 bits are not representable */
+  return len > 1 ? ~(uint64_t)0 : tm[0];
+}
+
+static int _bool (unsigned long v)
+{
+  if (v == ACT_SIG_BOOL_TRUE) {
+    return 1;
+  }
+  else if (v == ACT_SIG_BOOL_FALSE) {
+    return 0;
+  }
+  return 2;
+}
+
+static int _chstate (act_chan_state_t s)
+{
+  switch (s) {
+  case ACT_CHAN_IDLE:
+    return CTR_CHAN_IDLE;
+  case ACT_CHAN_RECV_BLOCKED:
+    return CTR_CHAN_RECV_BLOCKED;
+  case ACT_CHAN_SEND_BLOCKED:
+    return CTR_CHAN_SEND_BLOCKED;
+  default:
+    return CTR_CHAN_VALUE;
+  }
+}
+
+/* value words, zero-extended or truncated to the signal width */
+static const uint64_t *_words (ctr_writer *w, void *node, int len,
+			       unsigned long *v)
+{
+  ctr_wsig *x = SIG (w, node);
+
+  if (x->nw > w->vmax) {
+    w->vmax = x->nw;
+    REALLOC (w->vbuf, uint64_t, w->vmax);
+  }
+  for (int i=0; i < x->nw; i++) {
+    w->vbuf[i] = (i < len) ? v[i] : 0;
+  }
+  return w->vbuf;
+}
+
+static int _analog (ctr_writer *w, void *node, uint64_t t, float v)
+{
+  uint64_t b = 0;
+  memcpy (&b, &v, sizeof (float));
+  return _change (w, node, t, 0, &b);
+}
+
+static int _digital (ctr_writer *w, void *node, uint64_t t, unsigned long v)
+{
+  uint64_t b;
+  if (SIG (w, node)->type == CTR_BOOL) {
+    b = _bool (v);
+  }
+  else {
+    b = v;
+  }
+  return _change (w, node, t, 0, _words (w, node, 1, (unsigned long *)&b));
+}
+
+int ctr_signal_change_analog (void *handle, void *node, float t, float v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _analog (w, node, _ftime (w, t), v);
+}
+
+int ctr_signal_change_digital (void *handle, void *node, float t,
+			       unsigned long v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _digital (w, node, _ftime (w, t), v);
+}
+
+int ctr_signal_change_wide_digital (void *handle, void *node, float t,
+				    int len, unsigned long *v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _ftime (w, t), 0, _words (w, node, len, v));
+}
+
+int ctr_signal_change_chan (void *handle, void *node, float t,
+			    act_chan_state_t s, unsigned long v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _ftime (w, t), _chstate (s),
+		  _words (w, node, 1, &v));
+}
+
+int ctr_signal_change_wide_chan (void *handle, void *node, float t,
+				 act_chan_state_t s, int len, unsigned long *v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _ftime (w, t), _chstate (s),
+		  _words (w, node, len, v));
+}
+
+int ctr_signal_change_analog_alt (void *handle, void *node,
+				  int tlen, unsigned long *tm, float v)
+{
+  return _analog ((ctr_writer *) handle, node, _atime (tlen, tm), v);
+}
+
+int ctr_signal_change_digital_alt (void *handle, void *node,
+				   int tlen, unsigned long *tm,
+				   unsigned long v)
+{
+  return _digital ((ctr_writer *) handle, node, _atime (tlen, tm), v);
+}
+
+int ctr_signal_change_wide_digital_alt (void *handle, void *node,
+					int tlen, unsigned long *tm,
+					int len, unsigned long *v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _atime (tlen, tm), 0, _words (w, node, len, v));
+}
+
+int ctr_signal_change_chan_alt (void *handle, void *node,
+				int tlen, unsigned long *tm,
+				act_chan_state_t s, unsigned long v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _atime (tlen, tm), _chstate (s),
+		  _words (w, node, 1, &v));
+}
+
+int ctr_signal_change_wide_chan_alt (void *handle, void *node,
+				     int tlen, unsigned long *tm,
+				     act_chan_state_t s, int len,
+				     unsigned long *v)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  return _change (w, node, _atime (tlen, tm), _chstate (s),
+		  _words (w, node, len, v));
+}
+
+int ctr_close_tracefile (void *handle)
+{
+  ctr_writer *w = (ctr_writer *) handle;
+  ctr_hdr h;
+  ctr_sig s;
+  uint64_t boff, soff;
+  int ok = 1;
+
+  for (int i=0; i < w->nsig; i++) {
+    ok = ok && _flush_block (w, &w->sig[i]);
+  }
+
+  /*-- directory: block index follows it, then the names --*/
+  boff = w->off + w->nsig*sizeof (ctr_sig);
+  soff = 0;
+  for (int i=0; i < w->nsig; i++) {
+    ctr_wsig *x = &w->sig[i];
+    memset (&s, 0, sizeof (s));
+    s.type = x->type;
+    s.width = x->width;
+    s.name = soff;
+    s.nblk = x->nblk;
+    s.blk_off = boff;
+    ok = ok && (fwrite (&s, sizeof (s), 1, w->fp) == 1);
+    boff += x->nblk*sizeof (ctr_blkent);
+    soff += strlen (x->name) + 1;
+  }
+  for (int i=0; i < w->nsig; i++) {
+    ctr_wsig *x = &w->sig[i];
+    if (x->nblk > 0) {
+      ok = ok &&
+	(fwrite (x->blk, sizeof (ctr_blkent), x->nblk, w->fp) == x->nblk);
+    }
+  }
+  for (int i=0; i < w->nsig; i++) {
+    ctr_wsig *x = &w->sig[i];
+    ok = ok &&
+      (fwrite (x->name, 1, strlen (x->name) + 1, w->fp) ==
+       strlen (x->name) + 1);
+  }
+
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, CTR_MAGIC, sizeof (CTR_MAGIC));
+  h.version = CTR_VERSION;
+  h.blksz = CTR_BLOCK;
+  h.nsig = w->nsig;
+  h.nblk = w->nblk;
+  h.dir_off = w->off;
+  h.str_off = boff;
+  h.t_end = w->t_end;
+  h.dt = w->dt;
+  ok = ok && (fseek (w->fp, 0, SEEK_SET) == 0) &&
+    (fwrite (&h, sizeof (h), 1, w->fp) == 1);
+  if (fclose (w->fp) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    fprintf (stderr, "ctr: write error while closing trace file\n");
+  }
+
+  for (int i=0; i < w->nsig; i++) {
+    ctr_wsig *x = &w->sig[i];
+    FREE (x->name);
+    if (x->buf) {
+      FREE (x->buf);
+    }
+    FREE (x->prev);
+    if (x->blk) {
+      FREE (x->blk);
+    }
+  }
+  if (w->sig) {
+    FREE (w->sig);
+  }
+  if (w->rec) {
+    FREE (w->rec);
+  }
+  if (w->vbuf) {
+    FREE (w->vbuf);
+  }
+  FREE (w);
+  return ok;
+}
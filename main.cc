@@ -31,6 +31,7 @@
 #include "actsim.h"
 #include "chpsim.h"
 #include "prssim.h"
+#include "prslane.h"
 #include <lisp.h>
 #include <lispCli.h>
 #include <ctype.h>
@@ -63,6 +64,7 @@ static ActStatePass *glob_sp;
 ActSim *glob_sim;
 static Act *glob_act;
 static Process *glob_top;
+static PrsLaneSim *glob_lanes;
 
 int is_rand_excl()
 {
@@ -153,6 +155,10 @@ int process_initialize (int argc, char **argv)
     fprintf (stderr, "%s: `%s' is not an expanded process\n", argv[0], argv[1]);
     return LISP_RET_ERROR;
   }
+  if (glob_lanes) {
+    delete glob_lanes;
+    glob_lanes = NULL;
+  }
   if (glob_sim) {
     delete glob_sim;
     delete glob_sp;
@@ -751,13 +757,7 @@ int process_set (int argc, char **argv)
     fatal_error ("Should not be here");
   }
 
-  SimDES **arr;
-  arr = glob_sim->getFO (offset, type);
-  for (int i=0; i < glob_sim->numFanout (offset, type); i++) {
-    ActSimDES *p = dynamic_cast <ActSimDES *> (arr[i]);
-    Assert (p, "Hmm?");
-    p->propagate ();
-  }
+  glob_sim->propagateFanout (offset, type);
   return LISP_RET_TRUE;
 }
 
@@ -1252,6 +1252,10 @@ int process_status (int argc, char **argv)
     fprintf (stderr, "Usage: %s 0|1|X\n", argv[0]);
     return LISP_RET_ERROR;
   }
+  if (glob_sim->getState()->countBools (val) == 0) {
+    /* nothing to report */
+    return LISP_RET_TRUE;
+  }
   _compute_status (glob_sim->getInstTable(), val);
 
   /* now dump status for all the primary I/O pins and globals */
@@ -1262,6 +1266,320 @@ int process_status (int argc, char **argv)
   return LISP_RET_TRUE;
 }
 
+int process_prs_stats (int argc, char **argv)
+{
+  unsigned long nreq, neval;
+
+  if (argc != 1) {
+    fprintf (stderr, "Usage: %s\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!OnePrsSim::deltaStats (&nreq, &neval)) {
+    printf ("Delta-cycle mode is off (sim.prs.delta_cycle)\n");
+    return LISP_RET_TRUE;
+  }
+  printf ("prs propagate requests: %lu\n", nreq);
+  printf ("prs gate evaluations: %lu\n", neval);
+  printf ("prs evaluations saved: %lu", nreq - neval);
+  if (nreq > 0) {
+    printf (" (%.1f%%)", (100.0*(nreq - neval))/nreq);
+  }
+  printf ("\n");
+  return LISP_RET_TRUE;
+}
+
+int process_prs_mem (int argc, char **argv)
+{
+  unsigned long ngates, state, ops, sop;
+  unsigned long prev;
+
+  if (argc != 1) {
+    fprintf (stderr, "Usage: %s\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  PrsSim::memStats (&ngates, &state, &ops, &sop);
+  printf ("prs gates: %lu\n", ngates);
+  if (ngates == 0) {
+    return LISP_RET_TRUE;
+  }
+  printf ("  rule state: %lu bytes (%.1f/gate, %d-byte objects)\n",
+	  state, (double)state/ngates, (int)sizeof (OnePrsSim));
+  printf ("  operand table: %lu bytes (%.1f/gate)\n",
+	  ops, (double)ops/ngates);
+  if (sop > 0) {
+    printf ("  sop counters: %lu bytes (%.1f/gate)\n",
+	    sop, (double)sop/ngates);
+  }
+  printf ("  total: %.1f bytes/gate\n", (double)(state + ops + sop)/ngates);
+
+  /* not measured: the size one heap object per gate (with an
+     operand and a counter pointer) plus a list item would take,
+     assuming an 8-byte malloc header and 16-byte aligned chunks */
+#define CHUNK(n) ((((n) + 8 + 15)/16)*16)
+  prev = CHUNK (sizeof (OnePrsSim) + 2*sizeof (void *))
+    + CHUNK (2*sizeof (void *));
+#undef CHUNK
+  printf ("  estimate with per-gate heap objects: ~%.1f bytes/gate\n",
+	  (double)prev + (double)(ops + sop)/ngates);
+  return LISP_RET_TRUE;
+}
+
+int process_chp_events (int argc, char **argv)
+{
+  unsigned long next, wake, direct;
+
+  if (argc != 1) {
+    fprintf (stderr, "Usage: %s\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  ChpSim::eventStats (&next, &wake, &direct);
+  printf ("chp events: %lu\n", next + wake);
+  printf ("  statement events: %lu\n", next);
+  printf ("  channel wake-ups: %lu\n", wake);
+  printf ("  direct hand-offs: %lu (wake-up events avoided)\n", direct);
+  return LISP_RET_TRUE;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Lane-parallel production rule simulation
+ *
+ *------------------------------------------------------------------------
+ */
+static int lanes_node (const char *cmd, const char *name)
+{
+  int type, offset, n;
+
+  if (!glob_lanes) {
+    fprintf (stderr, "%s: run lanes_init first\n", cmd);
+    return -1;
+  }
+  if (!id_to_siminfo_glob (name, &type, &offset, NULL)) {
+    return -1;
+  }
+  if (type != 0) {
+    fprintf (stderr, "%s: `%s' is not a Boolean\n", cmd, name);
+    return -1;
+  }
+  n = glob_lanes->findNode (offset);
+  if (n == -1) {
+    fprintf (stderr, "%s: `%s' is not used by any production rule\n", cmd, name);
+  }
+  return n;
+}
+
+int process_lanes_init (int argc, char **argv)
+{
+  if (argc != 1) {
+    fprintf (stderr, "Usage: %s\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes) {
+    glob_lanes = new PrsLaneSim (glob_sim);
+  }
+  if (!glob_lanes->init ()) {
+    delete glob_lanes;
+    glob_lanes = NULL;
+    return LISP_RET_ERROR;
+  }
+  printf ("lanes: %d rules, %d nodes, %d lanes\n", glob_lanes->numGates(),
+	  glob_lanes->numNodes(), PRSLANE_N);
+  return LISP_RET_TRUE;
+}
+
+/*
+  Parse the per-lane values 0/1/X of lanes 0, 1, ...; a single value
+  applies to all lanes.
+*/
+static int lanes_vals (const char *cmd, const char *s, prslane_val *w,
+		       prslane_t *m)
+{
+  int len = strlen (s);
+
+  if (len == 0 || len > PRSLANE_N) {
+    fprintf (stderr, "%s: between 1 and %d values needed\n", cmd, PRSLANE_N);
+    return 0;
+  }
+  w->v = 0;
+  w->x = 0;
+  for (int i=0; i < len; i++) {
+    prslane_t b = (prslane_t)1 << i;
+    if (s[i] == '1') {
+      w->v |= b;
+    }
+    else if (s[i] == 'X') {
+      w->x |= b;
+    }
+    else if (s[i] != '0') {
+      fprintf (stderr, "%s: values must be 0, 1, or X\n", cmd);
+      return 0;
+    }
+  }
+  if (len == 1) {
+    /* one value for all lanes */
+    w->v = (w->v ? ~(prslane_t)0 : 0);
+    w->x = (w->x ? ~(prslane_t)0 : 0);
+    *m = ~(prslane_t)0;
+  }
+  else {
+    *m = (len == PRSLANE_N) ? ~(prslane_t)0 : (((prslane_t)1 << len) - 1);
+  }
+  return 1;
+}
+
+int process_lanes_set (int argc, char **argv)
+{
+  int n;
+  prslane_val w;
+  prslane_t m;
+
+  if (argc != 3) {
+    fprintf (stderr, "Usage: %s <name> <vals>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if ((n = lanes_node (argv[0], argv[1])) == -1) {
+    return LISP_RET_ERROR;
+  }
+  if (!lanes_vals (argv[0], argv[2], &w, &m)) {
+    return LISP_RET_ERROR;
+  }
+  glob_lanes->setNode (n, w, m);
+  return LISP_RET_TRUE;
+}
+
+/*
+  A stimulus file has one input per line:
+
+     <delay> <name> <vals>
+
+  where <delay> is relative to the current lane time and <vals> is
+  as in lanes_set. Blank lines and lines starting with # are
+  ignored. The whole file is checked before any of it is used.
+*/
+int process_lanes_source (int argc, char **argv)
+{
+  FILE *fp;
+  char buf[10240];
+  char name[10240], vals[10240];
+  unsigned long delay;
+  int line = 0, ok = 1;
+  A_DECL (prslane_stim, st);
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <file>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes) {
+    fprintf (stderr, "%s: run lanes_init first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  fp = fopen (argv[1], "r");
+  if (!fp) {
+    fprintf (stderr, "%s: could not open file `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  A_INIT (st);
+  while (ok && fgets (buf, 10240, fp)) {
+    char *s = buf;
+    line++;
+    while (*s == ' ' || *s == '\t') {
+      s++;
+    }
+    if (*s == '#' || *s == '\n' || *s == '\0') {
+      continue;
+    }
+    A_NEW (st, prslane_stim);
+    if (sscanf (s, "%lu %10239s %10239s", &delay, name, vals) != 3) {
+      fprintf (stderr, "%s: %s:%d: expected <delay> <name> <vals>\n",
+	       argv[0], argv[1], line);
+      ok = 0;
+    }
+    else if ((A_NEXT (st).n = lanes_node (argv[0], name)) == -1 ||
+	     !lanes_vals (argv[0], vals, &A_NEXT (st).w, &A_NEXT (st).m)) {
+      fprintf (stderr, "%s: error at %s:%d\n", argv[0], argv[1], line);
+      ok = 0;
+    }
+    else {
+      A_NEXT (st).tm = delay;
+      A_INC (st);
+    }
+  }
+  fclose (fp);
+  if (ok) {
+    for (int i=0; i < A_LEN (st); i++) {
+      glob_lanes->addStimulus (st[i].tm, st[i].n, st[i].w, st[i].m);
+    }
+    printf ("lanes: %d inputs scheduled\n", A_LEN (st));
+  }
+  A_FREE (st);
+  return ok ? LISP_RET_TRUE : LISP_RET_ERROR;
+}
+
+int process_lanes_get (int argc, char **argv)
+{
+  int n;
+  prslane_val w;
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <name>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if ((n = lanes_node (argv[0], argv[1])) == -1) {
+    return LISP_RET_ERROR;
+  }
+  w = glob_lanes->getNode (n);
+  printf ("%s: ", argv[1]);
+  for (int i=0; i < PRSLANE_N; i++) {
+    prslane_t b = (prslane_t)1 << i;
+    printf ("%c", (w.x & b) ? 'X' : ((w.v & b) ? '1' : '0'));
+  }
+  printf ("\n");
+  return LISP_RET_TRUE;
+}
+
+int process_lanes_advance (int argc, char **argv)
+{
+  long nsteps;
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <delay>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes) {
+    fprintf (stderr, "%s: run lanes_init first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (sscanf (argv[1], "%ld", &nsteps) != 1) {
+    fprintf (stderr, "%s: `%s' is not an integer\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  if (nsteps <= 0) {
+    fprintf (stderr, "%s: zero/negative delay?\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes->advance (nsteps, 0)) {
+    return LISP_RET_FALSE;
+  }
+  return LISP_RET_TRUE;
+}
+
+int process_lanes_cycle (int argc, char **argv)
+{
+  if (argc != 1) {
+    fprintf (stderr, "Usage: %s\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes) {
+    fprintf (stderr, "%s: run lanes_init first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_lanes->advance (0, 1)) {
+    return LISP_RET_FALSE;
+  }
+  printf ("lanes: time %lu, %lu events\n", glob_lanes->curTime(),
+	  glob_lanes->numEvents());
+  return LISP_RET_TRUE;
+}
+
 int process_create_generic_trace (const char *cmd,
 				  const char *file,
 				  const char *trname,
@@ -1575,6 +1893,53 @@ int process_sed (int argc, char **argv)
   return LISP_RET_TRUE;
 }
 
+int process_save (int argc, char **argv)
+{
+  FILE *fp;
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <file>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  fp = fopen (argv[1], "wb");
+  if (!fp) {
+    fprintf (stderr, "%s: could not open file `%s' for writing\n",
+	     argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_sim->saveSim (fp) || ferror (fp)) {
+    fclose (fp);
+    fprintf (stderr, "%s: could not save checkpoint to `%s'\n",
+	     argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  if (fclose (fp) != 0) {
+    fprintf (stderr, "%s: error writing `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  return LISP_RET_TRUE;
+}
+
+int process_restore (int argc, char **argv)
+{
+  FILE *fp;
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s <file>\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  fp = fopen (argv[1], "rb");
+  if (!fp) {
+    fprintf (stderr, "%s: could not open file `%s' for reading\n",
+	     argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  if (!glob_sim->restoreSim (fp)) {
+    fclose (fp);
+    return LISP_RET_ERROR;
+  }
+  fclose (fp);
+  return LISP_RET_TRUE;
+}
+
 struct LispCliCommand Cmds[] = {
   { NULL, "Initialization and setup", NULL },
 
@@ -1600,6 +1965,8 @@ struct LispCliCommand Cmds[] = {
   { "step", "[n] - run the next [n] events", process_step },
   { "advance", "<delay> - run for <delay> time", process_advance },
   { "cycle", "- run until simulation stops", process_cycle },
+  { "save", "<file> - save a checkpoint of the simulation state", process_save },
+  { "restore", "<file> - restore a checkpoint (from the same design, after initialization)", process_restore },
 
   { "set", "<name> <val> - set a variable to a value", process_set },
   { "gc-retry", "<name> - re-try guards in a deadlocked process", process_wakeup },
@@ -1619,6 +1986,9 @@ struct LispCliCommand Cmds[] = {
   { "resume-on-warn", "- continue simulation on warning", process_resume_on_warn },
 
   { "status", "0|1|X - list all nodes with specified value", process_status },
+  { "prs_stats", "- report gate evaluations saved by delta-cycle mode", process_prs_stats },
+  { "prs_mem", "- report memory used per production rule", process_prs_mem },
+  { "chp_events", "- report CHP event counts and direct channel hand-offs", process_chp_events },
 
   { "timescale", "<t> - set time scale to <t> picoseconds for tracing", process_timescale },
   { "get_sim_time", "- returns current simulation time in picoseconds", process_get_sim_time },
@@ -1641,6 +2011,15 @@ struct LispCliCommand Cmds[] = {
   
 #endif  
 
+  { NULL, "Lane-parallel production rule simulation", NULL },
+
+  { "lanes_init", "- copy the current state into 64 lanes of the production rules", process_lanes_init },
+  { "lanes_set", "<n> <vals> - set lanes 0, 1, ... of <n> to the 0/1/X values in <vals>", process_lanes_set },
+  { "lanes_get", "<n> - show the value of <n> in every lane", process_lanes_get },
+  { "lanes_source", "<file> - schedule per-lane inputs: lines of <delay> <n> <vals>", process_lanes_source },
+  { "lanes_advance", "<delay> - run all lanes for <delay> time units", process_lanes_advance },
+  { "lanes_cycle", "- run all lanes until no events or inputs remain", process_lanes_cycle },
+
   { NULL, "Process and CHP commands", NULL },
 
 #if 0
@@ -0,0 +1,739 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "prslane.h"
+
+#define LANES_ALL (~(prslane_t)0)
+
+/* lanes holding 0, 1, X */
+#define IS0(w) (~(w).v & ~(w).x)
+#define IS1(w) ((w).v)
+#define ISX(w) ((w).x)
+
+PrsLaneSim::PrsLaneSim (ActSimCore *sim)
+{
+  _sc = sim;
+  _ngates = 0;
+  _gmax = 0;
+  _gate = NULL;
+  _nnodes = 0;
+  _node = NULL;
+  _noff = NULL;
+  _nmap = NULL;
+  _fo_start = NULL;
+  _fo = NULL;
+  A_INIT (_heap);
+  _free = NULL;
+  _now = 0;
+  _seq = 0;
+  _nev = 0;
+  _stop = 0;
+  A_INIT (_stim);
+  _spos = 0;
+}
+
+PrsLaneSim::~PrsLaneSim ()
+{
+  _clear ();
+}
+
+void PrsLaneSim::_clear ()
+{
+  prslane_ev *e;
+
+  for (int i=0; i < _ngates; i++) {
+    while (_gate[i].live) {
+      e = _gate[i].live;
+      _gate[i].live = e->gnext;
+      FREE (e);
+    }
+    if (_gate[i].op) {
+      FREE (_gate[i].op);
+    }
+  }
+  if (_gate) {
+    FREE (_gate);
+  }
+  _gate = NULL;
+  _ngates = 0;
+  _gmax = 0;
+  while (_free) {
+    e = _free;
+    _free = e->gnext;
+    FREE (e);
+  }
+  A_FREE (_heap);
+  A_INIT (_heap);
+  A_FREE (_stim);
+  A_INIT (_stim);
+  _spos = 0;
+  if (_node) {
+    FREE (_node);
+    FREE (_noff);
+  }
+  _node = NULL;
+  _noff = NULL;
+  _nnodes = 0;
+  if (_nmap) {
+    ihash_free (_nmap);
+  }
+  _nmap = NULL;
+  if (_fo_start) {
+    FREE (_fo_start);
+  }
+  if (_fo) {
+    FREE (_fo);
+  }
+  _fo_start = NULL;
+  _fo = NULL;
+}
+
+int PrsLaneSim::findNode (int off)
+{
+  ihash_bucket_t *b;
+  if (!_nmap) {
+    return -1;
+  }
+  b = ihash_lookup (_nmap, off);
+  if (!b) {
+    return -1;
+  }
+  return b->i;
+}
+
+int PrsLaneSim::_addNode (int off)
+{
+  ihash_bucket_t *b;
+
+  b = ihash_lookup (_nmap, off);
+  if (b) {
+    return b->i;
+  }
+  b = ihash_add (_nmap, off);
+  b->i = _nnodes++;
+  return b->i;
+}
+
+/*
+  Collect the rules of all PrsSim objects in the instance table.
+*/
+void PrsLaneSim::_addGates (ActInstTable *t, int *err)
+{
+  PrsSim *p;
+
+  if (t->obj && (p = dynamic_cast <PrsSim *> (t->obj))) {
+    for (int ri=0; ri < p->numRules(); ri++) {
+      OnePrsSim *o = p->getRule (ri);
+      prssim_stmt *s = o->getStmt ();
+      prslane_gate *g;
+
+      if (s->type != PRSSIM_RULE) {
+	if (!*err) {
+	  printf ("lanes: pass transistors are not supported (`");
+	  p->printName (stdout, s->t2);
+	  printf ("')\n");
+	}
+	*err = 1;
+	continue;
+      }
+      if (o->isPending()) {
+	/* the lanes start from the settled state */
+	if (!*err) {
+	  printf ("lanes: `");
+	  p->printName (stdout, s->vid);
+	  printf ("' has a pending transition; run the simulation to quiescence first\n");
+	}
+	*err = 1;
+	continue;
+      }
+      if (_ngates == _gmax) {
+	_gmax = (_gmax == 0 ? 1024 : 2*_gmax);
+	REALLOC (_gate, prslane_gate, _gmax);
+      }
+      g = &_gate[_ngates++];
+      g->obj = o;
+      g->out = _addNode (o->getOutput ());
+      g->op = NULL;
+      if (s->nvars > 0) {
+	MALLOC (g->op, int, s->nvars);
+	for (int i=0; i < s->nvars; i++) {
+	  g->op[i] = _addNode (o->getOperands()[i]);
+	}
+      }
+      g->pend[0] = g->pend[1] = g->pend[2] = 0;
+      g->live = NULL;
+    }
+  }
+  if (t->H) {
+    hash_bucket_t *b;
+    hash_iter_t it;
+    hash_iter_init (t->H, &it);
+    while ((b = hash_iter_next (t->H, &it))) {
+      _addGates ((ActInstTable *)b->v, err);
+    }
+  }
+}
+
+int PrsLaneSim::init ()
+{
+  int err = 0;
+  int *stamp;
+
+  _clear ();
+
+  if (_sc->isRandom ()) {
+    printf ("lanes: only supported with fixed delays (norandom)\n");
+    return 0;
+  }
+
+  _nmap = ihash_new (8);
+  _addGates (_sc->getInstTable(), &err);
+  if (err) {
+    _clear ();
+    return 0;
+  }
+
+  /* every lane starts from the current state */
+  MALLOC (_node, prslane_val, _nnodes > 0 ? _nnodes : 1);
+  MALLOC (_noff, int, _nnodes > 0 ? _nnodes : 1);
+  {
+    ihash_bucket_t *b;
+    ihash_iter_t it;
+    ihash_iter_init (_nmap, &it);
+    while ((b = ihash_iter_next (_nmap, &it))) {
+      int v = _sc->getBool (b->key);
+      _noff[b->i] = b->key;
+      _node[b->i].v = (v == 1 ? LANES_ALL : 0);
+      _node[b->i].x = (v == 2 ? LANES_ALL : 0);
+    }
+  }
+
+  /* fanout gates for each node, without duplicates */
+  MALLOC (_fo_start, int, _nnodes+1);
+  MALLOC (stamp, int, _nnodes > 0 ? _nnodes : 1);
+  for (int i=0; i <= _nnodes; i++) {
+    _fo_start[i] = 0;
+  }
+  for (int i=0; i < _nnodes; i++) {
+    stamp[i] = -1;
+  }
+  for (int gi=0; gi < _ngates; gi++) {
+    prssim_stmt *s = _gate[gi].obj->getStmt();
+    for (int i=0; i < s->nvars; i++) {
+      int n = _gate[gi].op[i];
+      if (stamp[n] != gi) {
+	stamp[n] = gi;
+	_fo_start[n+1]++;
+      }
+    }
+  }
+  for (int i=0; i < _nnodes; i++) {
+    _fo_start[i+1] += _fo_start[i];
+    stamp[i] = -1;
+  }
+  MALLOC (_fo, int, _fo_start[_nnodes] > 0 ? _fo_start[_nnodes] : 1);
+  {
+    int *pos;
+    MALLOC (pos, int, _nnodes > 0 ? _nnodes : 1);
+    for (int i=0; i < _nnodes; i++) {
+      pos[i] = _fo_start[i];
+    }
+    for (int gi=0; gi < _ngates; gi++) {
+      prssim_stmt *s = _gate[gi].obj->getStmt();
+      for (int i=0; i < s->nvars; i++) {
+	int n = _gate[gi].op[i];
+	if (stamp[n] != gi) {
+	  stamp[n] = gi;
+	  _fo[pos[n]++] = gi;
+	}
+      }
+    }
+    FREE (pos);
+  }
+  FREE (stamp);
+
+  _now = SimDES::CurTimeLo();
+  _seq = 0;
+  _nev = 0;
+  return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Word-wide rule evaluation
+ *
+ *------------------------------------------------------------------------
+ */
+void PrsLaneSim::_eval (prslane_gate *g, const prssim_code *c,
+			prslane_val *r)
+{
+  prslane_val stk[PRSSIM_MAX_STACK];
+  prslane_t k;
+  int sp = -1;
+  const unsigned char *op = c->op;
+  const unsigned char *end = c->op + c->nops;
+  const int *vid = g->op + c->vbase;
+
+  if (c->nops == 0) {
+    r->v = 0;
+    r->x = 0;
+    return;
+  }
+  while (op < end) {
+    switch (*op++) {
+    case PRSSIM_OP_VAR:
+      stk[++sp] = _node[*vid++];
+      break;
+
+    case PRSSIM_OP_AND:
+      sp--;
+      /* X unless some input is 0 */
+      k = IS0 (stk[sp]) | IS0 (stk[sp+1]);
+      stk[sp].x = (stk[sp].x | stk[sp+1].x) & ~k;
+      stk[sp].v = stk[sp].v & stk[sp+1].v;
+      break;
+
+    case PRSSIM_OP_OR:
+      sp--;
+      /* X unless some input is 1 */
+      k = IS1 (stk[sp]) | IS1 (stk[sp+1]);
+      stk[sp].x = (stk[sp].x | stk[sp+1].x) & ~k;
+      stk[sp].v = k;
+      break;
+
+    case PRSSIM_OP_NOT:
+      stk[sp].v = IS0 (stk[sp]);
+      break;
+
+    case PRSSIM_OP_TRUE:
+      sp++;
+      stk[sp].v = LANES_ALL;
+      stk[sp].x = 0;
+      break;
+
+    case PRSSIM_OP_FALSE:
+      sp++;
+      stk[sp].v = 0;
+      stk[sp].x = 0;
+      break;
+
+    default:
+      fatal_error ("What?");
+      break;
+    }
+  }
+  *r = stk[0];
+}
+
+/*
+  Pull-up and pull-down state; the weak network is used in the lanes
+  where the normal one is off, as in OnePrsSim::propagate().
+*/
+void PrsLaneSim::_evalNets (prslane_gate *g,
+			    prslane_val *u, prslane_t *uw,
+			    prslane_val *d, prslane_t *dw)
+{
+  prssim_stmt *s = g->obj->getStmt();
+  prslane_val w;
+  prslane_t z;
+
+  _eval (g, &s->code[PRSSIM_UP (PRSSIM_NORM)], u);
+  *uw = 0;
+  z = IS0 (*u);
+  if (z && s->code[PRSSIM_UP (PRSSIM_WEAK)].nops > 0) {
+    _eval (g, &s->code[PRSSIM_UP (PRSSIM_WEAK)], &w);
+    u->v |= w.v & z;
+    u->x |= w.x & z;
+    *uw = (w.v | w.x) & z;
+  }
+
+  _eval (g, &s->code[PRSSIM_DN (PRSSIM_NORM)], d);
+  *dw = 0;
+  z = IS0 (*d);
+  if (z && s->code[PRSSIM_DN (PRSSIM_WEAK)].nops > 0) {
+    _eval (g, &s->code[PRSSIM_DN (PRSSIM_WEAK)], &w);
+    d->v |= w.v & z;
+    d->x |= w.x & z;
+    *dw = (w.v | w.x) & z;
+  }
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Per-lane event bookkeeping
+ *
+ *------------------------------------------------------------------------
+ */
+void PrsLaneSim::_push (prslane_ev *e)
+{
+  int i, p;
+
+  A_NEW (_heap, prslane_ev *);
+  i = A_LEN (_heap);
+  A_INC (_heap);
+  while (i > 0) {
+    p = (i-1)/2;
+    if (_heap[p]->tm < e->tm ||
+	(_heap[p]->tm == e->tm && _heap[p]->seq < e->seq)) {
+      break;
+    }
+    _heap[i] = _heap[p];
+    i = p;
+  }
+  _heap[i] = e;
+}
+
+prslane_ev *PrsLaneSim::_pop ()
+{
+  prslane_ev *ret, *e;
+  int i, c, n;
+
+  if (A_LEN (_heap) == 0) {
+    return NULL;
+  }
+  ret = _heap[0];
+  n = --A_LEN_RAW (_heap);
+  if (n == 0) {
+    return ret;
+  }
+  e = _heap[n];
+  i = 0;
+  while ((c = 2*i+1) < n) {
+    if (c+1 < n &&
+	(_heap[c+1]->tm < _heap[c]->tm ||
+	 (_heap[c+1]->tm == _heap[c]->tm && _heap[c+1]->seq < _heap[c]->seq))) {
+      c++;
+    }
+    if (e->tm < _heap[c]->tm ||
+	(e->tm == _heap[c]->tm && e->seq < _heap[c]->seq)) {
+      break;
+    }
+    _heap[i] = _heap[c];
+    i = c;
+  }
+  _heap[i] = e;
+  return ret;
+}
+
+void PrsLaneSim::_schedule (prslane_gate *g, int val, prslane_t m,
+			    int delay)
+{
+  prslane_ev *e;
+
+  if (!m) {
+    return;
+  }
+  /* the new event becomes the pending one for these lanes */
+  for (e = g->live; e; e = e->gnext) {
+    e->cur &= ~m;
+  }
+  if (_free) {
+    e = _free;
+    _free = e->gnext;
+  }
+  else {
+    NEW (e, prslane_ev);
+  }
+  e->g = g - _gate;
+  e->val = val;
+  e->tm = _now + delay;
+  e->seq = _seq++;
+  e->m = m;
+  e->cur = m;
+  e->gnext = g->live;
+  g->live = e;
+  _push (e);
+}
+
+void PrsLaneSim::_cancel (prslane_gate *g, prslane_t m)
+{
+  /* drop the lanes from their pending event; the event itself is
+     discarded when it reaches the top of the heap */
+  for (prslane_ev *e = g->live; e; e = e->gnext) {
+    prslane_t k = e->cur & m;
+    e->m &= ~k;
+    e->cur &= ~k;
+  }
+}
+
+/* OnePrsSim::setVal */
+void PrsLaneSim::_setVal (prslane_gate *g, int val, prslane_t m)
+{
+  prssim_stmt *s = g->obj->getStmt();
+  prslane_val c = _node[g->out];
+  prslane_t same;
+
+  same = (val == 0 ? IS0 (c) : IS1 (c));
+  m &= ~same & ~g->pend[val];
+  if (!m) {
+    return;
+  }
+  for (int i=0; i < 3; i++) {
+    g->pend[i] &= ~m;
+  }
+  g->pend[val] |= m;
+  _schedule (g, val, m, val ? s->delay_dn : s->delay_up);
+}
+
+/* MAKE_NODE_X */
+void PrsLaneSim::_makeX (prslane_gate *g, prslane_t m)
+{
+  prslane_val c = _node[g->out];
+  prslane_t l;
+
+  l = m & ~ISX (c) & ~g->pend[2];
+  if (l) {
+    g->pend[0] &= ~l;
+    g->pend[1] &= ~l;
+    g->pend[2] |= l;
+    _cancel (g, l);
+    _schedule (g, 2, l, 1);
+  }
+
+  l = m & ISX (c) & (g->pend[0] | g->pend[1]);
+  if (l) {
+    g->pend[0] &= ~l;
+    g->pend[1] &= ~l;
+    _cancel (g, l);
+  }
+}
+
+void PrsLaneSim::_warn (prslane_gate *g, const char *msg,
+			const char *dir, prslane_t m)
+{
+  prssim_stmt *s = g->obj->getStmt();
+
+  if (!m) {
+    return;
+  }
+  printf ("[%lu] <lanes>  WARNING: %s on `", _now, msg);
+  g->obj->getPrs()->printName (stdout, s->vid);
+  printf ("%s' (lanes 0x%016lx)\n", dir, m);
+  if (_sc->onWarning() == 2) {
+    exit (1);
+  }
+  else if (_sc->onWarning() == 1) {
+    _stop = 1;
+  }
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Rule evaluation and transitions, restricted to the lanes whose
+ *  inputs changed
+ *
+ *------------------------------------------------------------------------
+ */
+void PrsLaneSim::_propagate (int gi, prslane_t a)
+{
+  prslane_gate *g = &_gate[gi];
+  prssim_stmt *s = g->obj->getStmt();
+  int reset = _sc->isResetMode();
+  int hazard = _sc->isHazard (_noff[g->out]);
+  prslane_val u, d, c;
+  prslane_t uw, dw, m;
+  prslane_t u0, u1, ux, d0, d1, dx;
+
+  _evalNets (g, &u, &uw, &d, &dw);
+  u0 = IS0 (u); u1 = IS1 (u); ux = ISX (u);
+  d0 = IS0 (d); d1 = IS1 (d); dx = ISX (d);
+
+  /* -- check for unstable rules -- */
+  m = a & g->pend[1] & ~u1;
+  if (m) {
+    if (!reset && !s->unstab && !hazard) {
+      _warn (g, "weak-unstable transition", "+", m & ux);
+    }
+    if (!s->unstab) {
+      _warn (g, "unstable transition", "+", m & ~ux);
+    }
+    _makeX (g, m);
+  }
+  m = a & g->pend[0] & ~d1;
+  if (m) {
+    if (!reset && !s->unstab && !hazard) {
+      _warn (g, "weak-unstable transition", "-", m & dx);
+    }
+    if (!s->unstab && !hazard) {
+      _warn (g, "unstable transition", "-", m & ~dx);
+    }
+    _makeX (g, m);
+  }
+
+  c = _node[g->out];
+
+  _setVal (g, 1, a & u1 & (d0 | ((dx | d1) & ~uw & dw)));
+  _setVal (g, 0, a & d1 & ((u0 | ((u1 | ux) & uw & ~dw))));
+
+  /* u = 0, d = X or u = X, d = 0: X unless already there */
+  _makeX (g, a & ((u0 & dx & IS1 (c)) | (ux & d0 & IS0 (c))));
+
+  m = a & u1 & d1 & ~(uw & ~dw) & ~(~uw & dw);
+  _warn (g, "interference", "", m);
+  _makeX (g, m);
+
+  m = a & ((u1 & dx & ~(~uw & dw)) | (ux & d1 & ~(uw & ~dw)) | (ux & dx));
+  if (!reset) {
+    _warn (g, "weak-interference", "", m);
+  }
+  _makeX (g, m);
+}
+
+/* set lanes m of node n to t, and evaluate the fanout in the lanes
+   that changed */
+void PrsLaneSim::_set (int n, int t, prslane_t m)
+{
+  prslane_val *w = &_node[n];
+  prslane_t chg;
+
+  if (t == 2) {
+    chg = m & ~w->x;
+    w->x |= m;
+    w->v &= ~m;
+  }
+  else if (t == 1) {
+    chg = m & ~w->v;
+    w->v |= m;
+    w->x &= ~m;
+  }
+  else {
+    chg = m & (w->v | w->x);
+    w->v &= ~m;
+    w->x &= ~m;
+  }
+  if (!chg) {
+    return;
+  }
+  for (int i=_fo_start[n]; i < _fo_start[n+1]; i++) {
+    _propagate (_fo[i], chg);
+  }
+}
+
+void PrsLaneSim::setNode (int n, prslane_val w, prslane_t m)
+{
+  _set (n, 0, m & IS0 (w));
+  _set (n, 1, m & IS1 (w));
+  _set (n, 2, m & ISX (w));
+}
+
+/* OnePrsSim::Step for the lanes of one event */
+void PrsLaneSim::_fire (prslane_ev *e)
+{
+  prslane_gate *g = &_gate[e->g];
+  prslane_ev **pe;
+  prslane_t f, lt[3];
+
+  for (pe = &g->live; *pe != e; pe = &(*pe)->gnext)
+    ;
+  *pe = e->gnext;
+
+  f = e->m;
+  if (f) {
+    _nev++;
+    lt[0] = lt[1] = lt[2] = 0;
+    lt[e->val] = f;
+    /* firing clears the pending event of the gate */
+    for (prslane_ev *x = g->live; x; x = x->gnext) {
+      x->cur &= ~f;
+    }
+    for (int t=0; t < 3; t++) {
+      if (!lt[t]) continue;
+      g->pend[t] &= ~lt[t];
+      _set (g->out, t, lt[t]);
+    }
+
+    /* set to X with nothing pending: look for the X -> 0/1 cleanup */
+    f = lt[2] & ~(g->pend[0] | g->pend[1] | g->pend[2]);
+    if (f) {
+      prslane_val u, d;
+      prslane_t uw, dw;
+
+      _evalNets (g, &u, &uw, &d, &dw);
+      _setVal (g, 0, f & IS1 (d) & (IS0 (u) | ((IS1 (u) | ISX (u)) & uw & ~dw)));
+      _setVal (g, 1, f & IS1 (u) & (IS0 (d) | ((ISX (d) | IS1 (d)) & ~uw & dw)));
+    }
+  }
+  e->gnext = _free;
+  _free = e;
+}
+
+void PrsLaneSim::addStimulus (unsigned long delay, int n, prslane_val w,
+			       prslane_t m)
+{
+  int i;
+
+  if (_spos == A_LEN (_stim)) {
+    A_LEN_RAW (_stim) = 0;
+    _spos = 0;
+  }
+  /* schedules are normally added in time order, so this only walks
+     back over inputs that are later than the new one */
+  A_NEW (_stim, prslane_stim);
+  i = A_LEN (_stim);
+  A_INC (_stim);
+  while (i > _spos && _stim[i-1].tm > _now + delay) {
+    _stim[i] = _stim[i-1];
+    i--;
+  }
+  _stim[i].tm = _now + delay;
+  _stim[i].n = n;
+  _stim[i].w = w;
+  _stim[i].m = m;
+}
+
+int PrsLaneSim::advance (unsigned long delay, int cycle)
+{
+  unsigned long end = _now + delay;
+  prslane_ev *e;
+
+  _stop = 0;
+  while (!_stop && (A_LEN (_heap) > 0 || _spos < A_LEN (_stim))) {
+    if (_spos < A_LEN (_stim) &&
+	(A_LEN (_heap) == 0 || _stim[_spos].tm <= _heap[0]->tm)) {
+      prslane_stim *s = &_stim[_spos];
+      if (!cycle && s->tm > end) {
+	break;
+      }
+      _spos++;
+      _now = s->tm;
+      setNode (s->n, s->w, s->m);
+      continue;
+    }
+    if (!cycle && _heap[0]->tm > end) {
+      break;
+    }
+    e = _pop ();
+    _now = e->tm;
+    _fire (e);
+  }
+  if (_stop) {
+    return 0;
+  }
+  if (!cycle) {
+    _now = end;
+  }
+  return 1;
+}
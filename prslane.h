@@ -0,0 +1,157 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_PRS_LANE_H__
+#define __ACT_PRS_LANE_H__
+
+#include "prssim.h"
+
+/*
+ * Lane-parallel production rule simulation.
+ *
+ * Each Boolean holds PRSLANE_N independent copies ("lanes") of its
+ * three-valued state as two words: a lane is X if its bit is set in
+ * x, and otherwise has the value of its bit in v. Rules are evaluated
+ * with word-wide bitwise operations, so a single pass simulates
+ * PRSLANE_N runs of the same netlist with different stimulus.
+ *
+ * Delays are fixed (norandom), so lanes only diverge in which
+ * transitions they make, not in when a given transition fires. A
+ * transition event carries the mask of lanes it applies to. When a
+ * lane cancels or replaces its pending transition, the live events
+ * of that gate are checked lane by lane and the lane is removed from
+ * them.
+ *
+ * Only production rules are supported; nodes driven by anything
+ * else (CHP, file_source, the environment) are inputs. They keep
+ * their value unless set from the command line or by a stimulus
+ * schedule, which gives each lane its own timed input sequence.
+ */
+#define PRSLANE_N 64
+
+typedef unsigned long prslane_t;
+
+struct prslane_val {
+  prslane_t v, x;		// v & x == 0
+};
+
+struct prslane_ev {
+  int g;			// gate
+  int val;			// 0, 1, 2 = X
+  unsigned long tm;		// firing time
+  unsigned long seq;		// insertion order, for ties
+  prslane_t m;			// lanes that fire
+  prslane_t cur;		// lanes for which this is the pending event
+  struct prslane_ev *gnext;	// live events of the same gate / freelist
+};
+
+struct prslane_stim {
+  unsigned long tm;		// time at which the input is applied
+  int n;			// lane node
+  prslane_val w;		// new value
+  prslane_t m;			// lanes to set
+};
+
+struct prslane_gate {
+  OnePrsSim *obj;		// scalar rule
+  int *op;			// lane node for each operand slot
+  int out;			// lane node driven by the rule
+  prslane_t pend[3];		// lanes with a pending 0, 1, X transition
+  prslane_ev *live;		// events that have not fired yet
+};
+
+class PrsLaneSim {
+public:
+  PrsLaneSim (ActSimCore *sim);
+  ~PrsLaneSim ();
+
+  /* build the lane netlist and copy the current state to all lanes;
+     returns 0 (with a message) if the design is not supported */
+  int init ();
+
+  /* lane node for a global Boolean offset, -1 if not in the netlist */
+  int findNode (int off);
+
+  prslane_val getNode (int n) { return _node[n]; }
+
+  /* set the lanes in mask m of node n, as an environment input */
+  void setNode (int n, prslane_val w, prslane_t m);
+
+  /* same as setNode, but delay time units from now. Inputs for the
+     same time are applied in the order they were added, before any
+     rule firing at that time. */
+  void addStimulus (unsigned long delay, int n, prslane_val w, prslane_t m);
+
+  /* run for delay time units; cycle = 1 runs until no events are
+     left. Returns 0 if stopped by a warning. */
+  int advance (unsigned long delay, int cycle);
+
+  unsigned long curTime () { return _now; }
+  unsigned long numEvents () { return _nev; }
+  int numStimulus () { return A_LEN (_stim) - _spos; }
+  int numGates () { return _ngates; }
+  int numNodes () { return _nnodes; }
+
+private:
+  ActSimCore *_sc;
+
+  int _ngates, _gmax;
+  prslane_gate *_gate;
+
+  int _nnodes;
+  prslane_val *_node;		// lane state
+  int *_noff;			// global offset of each lane node
+  struct iHashtable *_nmap;	// global offset -> lane node
+  int *_fo_start, *_fo;		// fanout gates, CSR form
+
+  A_DECL (prslane_ev *, _heap);	// event heap, ordered by (tm, seq)
+  prslane_ev *_free;
+  unsigned long _now;
+  unsigned long _seq;
+  unsigned long _nev;		// # of events fired
+  int _stop;
+
+  A_DECL (prslane_stim, _stim);	// pending inputs, ordered by time
+  int _spos;			// next input to apply
+
+  void _clear ();
+  int _addNode (int off);
+  void _addGates (ActInstTable *t, int *err);
+
+  void _eval (prslane_gate *g, const prssim_code *c, prslane_val *r);
+  void _evalNets (prslane_gate *g, prslane_val *u, prslane_t *uw,
+		  prslane_val *d, prslane_t *dw);
+  void _propagate (int gi, prslane_t a);
+  void _fire (prslane_ev *e);
+  void _set (int n, int t, prslane_t m);
+
+  void _setVal (prslane_gate *g, int val, prslane_t m);
+  void _makeX (prslane_gate *g, prslane_t m);
+  void _schedule (prslane_gate *g, int val, prslane_t m, int delay);
+  void _cancel (prslane_gate *g, prslane_t m);
+  void _warn (prslane_gate *g, const char *msg, const char *dir,
+	      prslane_t m);
+
+  void _push (prslane_ev *e);
+  prslane_ev *_pop ();
+};
+
+#endif /* __ACT_PRS_LANE_H__ */
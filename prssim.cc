@@ -19,7 +19,14 @@
  *
  **************************************************************************
  */
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <new>
 #include <common/simdes.h>
+#include <common/config.h>
 #include "prssim.h"
 #include <common/qops.h>
 
@@ -36,17 +43,64 @@ PrsSim::PrsSim (PrsSimGraph *g, ActSimCore *sim, Process *p)
 {
   _sc = sim;
   _g = g;
-  _sim = list_new ();
+  _nrules = 0;
+  _rules = NULL;
+  _sopn = NULL;
+  _sopbytes = 0;
+  _cones = list_new ();
+  _gids = NULL;
 }
 
+unsigned long PrsSim::_mem_gates = 0;
+unsigned long PrsSim::_mem_state = 0;
+unsigned long PrsSim::_mem_ops = 0;
+unsigned long PrsSim::_mem_sop = 0;
+
 PrsSim::~PrsSim()
 {
   listitem_t *li;
-  for (li = list_first (_sim); li; li = list_next (li)) {
-    OnePrsSim *x = (OnePrsSim *) list_value (li);
+
+  _mem_gates -= _nrules;
+  _mem_state -= _nrules*sizeof (OnePrsSim);
+  _mem_ops -= (_gids ? _g->numOperands()*sizeof (int) : 0);
+  _mem_sop -= _sopbytes;
+
+  for (int i=0; i < _nrules; i++) {
+    _rules[i].~OnePrsSim ();
+  }
+  if (_rules) {
+    FREE (_rules);
+  }
+  if (_sopn) {
+    for (int i=0; i < _nrules; i++) {
+      if (_sopn[i]) {
+	for (int w=0; w < 4; w++) {
+	  if (_sopn[i][w].t) {
+	    FREE (_sopn[i][w].t);
+	  }
+	}
+	FREE (_sopn[i]);
+      }
+    }
+    FREE (_sopn);
+  }
+  for (li = list_first (_cones); li; li = list_next (li)) {
+    PrsSimCone *x = (PrsSimCone *) list_value (li);
     delete x;
   }
-  list_free (_sim);
+  list_free (_cones);
+  if (_gids) {
+    FREE (_gids);
+  }
+}
+
+void PrsSim::memStats (unsigned long *ngates, unsigned long *state,
+		       unsigned long *ops, unsigned long *sop)
+{
+  *ngates = _mem_gates;
+  *state = _mem_state;
+  *ops = _mem_ops;
+  *sop = _mem_sop;
 }
 
 int PrsSim::Step (Event */*ev*/)
@@ -59,7 +113,6 @@ extern ActSim *glob_sim;
 
 void PrsSim::printStatus (int val, bool io_glob)
 {
-  listitem_t *li;
   int emit_name = 0;
 
   if (io_glob) {
@@ -96,8 +149,8 @@ void PrsSim::printStatus (int val, bool io_glob)
     }
   }
   else {
-    for (li = list_first (_sim); li; li = list_next (li)) {
-      if (((OnePrsSim *)list_value (li))->matches (val)) {
+    for (int i=0; i < _nrules; i++) {
+      if (_rules[i].matches (val)) {
 	if (!emit_name) {
 	  if (name) {
 	    name->Print (stdout);
@@ -111,7 +164,7 @@ void PrsSim::printStatus (int val, bool io_glob)
 	else {
 	  printf (" ");
 	}
-	((OnePrsSim *)list_value (li))->printName ();
+	_rules[i].printName ();
       }
     }
   }
@@ -156,11 +209,48 @@ void PrsSim::_computeFanout (prssim_expr *e, SimDES *s)
 void PrsSim::computeFanout ()
 {
   prssim_stmt *x;
+  int pos = 0;
+  int idx = 0;
+
+  /*-- resolve the operands of the compiled rules for this instance --*/
+  if (_g->numOperands() > 0) {
+    MALLOC (_gids, int, _g->numOperands());
+  }
 
+  /*-- rule objects live in one array, in rule order --*/
   for (x = _g->getRules(); x; x = x->next) {
+    _nrules++;
+  }
+  if (_nrules > 0) {
+    MALLOC (_rules, OnePrsSim, _nrules);
+    if (_sc->prsSop()) {
+      MALLOC (_sopn, prssim_sopnet *, _nrules);
+      for (int i=0; i < _nrules; i++) {
+	_sopn[i] = NULL;
+      }
+    }
+  }
+
+  for (x = _g->getRules(); x; x = x->next, idx++) {
     /* -- create rule -- */
-    OnePrsSim *t = new OnePrsSim (this, x);
-    list_append (_sim, t);
+    OnePrsSim *t = &_rules[idx];
+    if (x->type == PRSSIM_RULE) {
+      for (int i=0; i < x->nvars; i++) {
+	_gids[pos+i] = getGlobalOffset (x->vids[i], 0);
+      }
+      new (t) OnePrsSim (this, x, idx, pos);
+      if (_sopn) {
+	_addSop (idx, x, _gids + pos);
+      }
+      pos += x->nvars;
+    }
+    else {
+      new (t) OnePrsSim (this, x, idx);
+    }
+    if (x->type == PRSSIM_RULE && x->incone) {
+      /* the cone is the fanout of its operands */
+      continue;
+    }
     if (x->type == PRSSIM_RULE) {
       _computeFanout (x->up[0], t);
       _computeFanout (x->up[1], t);
@@ -183,6 +273,79 @@ void PrsSim::computeFanout ()
       _sc->incFanout (off, 0, t);
     }
   }
+  _computeCones ();
+
+  _mem_gates += _nrules;
+  _mem_state += _nrules*sizeof (OnePrsSim);
+  _mem_ops += (_gids ? _g->numOperands()*sizeof (int) : 0);
+  _mem_sop += _sopbytes;
+}
+
+/* counters for the SOP networks of rule x, registered with the index */
+void PrsSim::_addSop (int idx, prssim_stmt *x, int *gid)
+{
+  PrsSopIndex *sop = _sc->prsSop();
+  prssim_sopnet *n;
+
+  if (!x->sop[0] && !x->sop[1] && !x->sop[2] && !x->sop[3]) {
+    return;
+  }
+  MALLOC (n, prssim_sopnet, 4);
+  _sopbytes += 4*sizeof (prssim_sopnet);
+  for (int w=0; w < 4; w++) {
+    prssim_sopcode *c = x->sop[w];
+    n[w].nterms = 0;
+    n[w].ntrue = 0;
+    n[w].nx = 0;
+    n[w].t = NULL;
+    if (!c) continue;
+
+    n[w].nterms = c->nterms;
+    MALLOC (n[w].t, prssim_sopterm, c->nterms);
+    _sopbytes += c->nterms*sizeof (prssim_sopterm);
+    for (int i=0; i < c->nterms; i++) {
+      for (int j=c->tstart[i]; j < c->tstart[i+1]; j++) {
+	sop->add (gid[c->lit[j]/2], &n[w], i, c->lit[j] & 1);
+      }
+    }
+    sop->addNet (&n[w]);
+  }
+  _sopn[idx] = n;
+  _rules[idx].useSop ();
+}
+
+void PrsSim::_computeCones ()
+{
+  struct pHashtable *H;
+  phash_bucket_t *b;
+  prssim_cone *c;
+
+  if (!_g->getCones()) {
+    return;
+  }
+
+  H = phash_new (8);
+  for (int i=0; i < _nrules; i++) {
+    b = phash_add (H, _rules[i].getStmt());
+    b->v = &_rules[i];
+  }
+  for (c = _g->getCones(); c; c = c->next) {
+    OnePrsSim **r;
+    PrsSimCone *pc;
+
+    MALLOC (r, OnePrsSim *, c->nr);
+    for (int i=0; i < c->nr; i++) {
+      b = phash_lookup (H, c->r[i]);
+      Assert (b, "What?");
+      r[i] = (OnePrsSim *) b->v;
+    }
+    pc = new PrsSimCone (this, c, r);
+    list_append (_cones, pc);
+    for (int j=0; j < c->nops; j++) {
+      _sc->incFanout (getGlobalOffset (c->ops[j], 0), 0, pc);
+    }
+  }
+  phash_free (H);
 }
 
 static int _attr_check (const char *nm, act_attr_t *attr)
@@ -356,6 +519,8 @@ void PrsSimGraph::_add_one_rule (ActSimCore *sc, act_prs_lang_t *p)
     s->vid = rhs;
     s->c = rhsc;
     s->unstab = 0;
+    s->incone = 0;
+    s->jit = NULL;
     s->delay_up = 10;
     s->delay_dn = 10;
     s->delay_up_max = -1;
@@ -365,6 +530,14 @@ void PrsSimGraph::_add_one_rule (ActSimCore *sc, act_prs_lang_t *p)
     s->up[1] = NULL;
     s->dn[0] = NULL;
     s->dn[1] = NULL;
+    for (int i=0; i < 4; i++) {
+      s->code[i].op = NULL;
+      s->code[i].nops = 0;
+      s->code[i].vbase = 0;
+      s->sop[i] = NULL;
+    }
+    s->nvars = 0;
+    s->vids = NULL;
     q_ins (_rules, _tail, s);
   }
 
@@ -443,6 +616,9 @@ void PrsSimGraph::_add_one_gate (ActSimCore *sc, act_prs_lang_t *p)
   struct prssim_stmt *s;
   NEW (s, struct prssim_stmt);
   s->next = NULL;
+  s->unstab = 0;
+  s->incone = 0;
+  s->jit = NULL;
   s->delay_up = 10;
   s->delay_dn = 10;
   if (p->u.p.g) {
@@ -502,6 +678,9 @@ PrsSimGraph::PrsSimGraph ()
   _rules = NULL;
   _tail = NULL;
   _labels = hash_new (4);
+  _nvars = 0;
+  _cones = NULL;
+  _jit_lib = NULL;
 }
 
 static void _free_prssim_expr (prssim_expr *e)
@@ -530,6 +709,27 @@ static void _free_prssim_expr (prssim_expr *e)
 PrsSimGraph::~PrsSimGraph()
 {
   hash_free (_labels);
+  if (_jit_lib) {
+    dlclose (_jit_lib);
+  }
+  while (_cones) {
+    prssim_cone *c = _cones;
+    _cones = c->next;
+    for (int i=0; i < c->nr; i++) {
+      if (c->opidx[i]) {
+	FREE (c->opidx[i]);
+      }
+    }
+    FREE (c->opidx);
+    FREE (c->r);
+    FREE (c->internal);
+    FREE (c->outidx);
+    if (c->ops) {
+      FREE (c->ops);
+      FREE (c->drv);
+    }
+    FREE (c);
+  }
   while (_rules) {
     switch (_rules->type) {
     case PRSSIM_RULE:
@@ -537,6 +737,19 @@ PrsSimGraph::~PrsSimGraph()
       _free_prssim_expr (_rules->up[1]);
       _free_prssim_expr (_rules->dn[0]);
       _free_prssim_expr (_rules->dn[1]);
+      if (_rules->code[0].op) {
+	FREE (_rules->code[0].op);
+      }
+      if (_rules->vids) {
+	FREE (_rules->vids);
+      }
+      for (int i=0; i < 4; i++) {
+	if (_rules->sop[i]) {
+	  FREE (_rules->sop[i]->tstart);
+	  FREE (_rules->sop[i]->lit);
+	  FREE (_rules->sop[i]);
+	}
+      }
       break;
       
     case PRSSIM_PASSP:
@@ -561,111 +774,1379 @@ PrsSimGraph *PrsSimGraph::buildPrsSimGraph (ActSimCore *sc, act_prs *p)
     pg->addPrs (sc, p->p);
     p = p->next;
   }
+  pg->_compile ();
+  if (sc->prsLevelize()) {
+    pg->_levelize ();
+  }
+  if (sc->prsSop()) {
+    pg->_sopify (sc->prsSop()->minLiterals());
+  }
+  if (sc->prsJit()) {
+    pg->_jit ();
+  }
   return pg;
 }
 
 
-/* 2 = X */
-static const int _not_table[3] = { 1, 0, 2 };
-
-static const int _and_table[3][3] = { { 0, 0, 0 },
-				      { 0, 1, 2 },
-				      { 0, 2, 2 } };
+/*
+ * Stack depth needed to evaluate e when the deeper child of each
+ * AND/OR is evaluated first. Depths of AND/OR nodes are computed
+ * once, bottom-up, and kept in H so that _code_emit can look them up.
+ */
+static int _code_depth (prssim_expr *e, struct pHashtable *H)
+{
+  phash_bucket_t *b;
+  int a, c;
+  if (!e) return 0;
+  switch (e->type) {
+  case PRSSIM_EXPR_AND:
+  case PRSSIM_EXPR_OR:
+    if ((b = phash_lookup (H, e))) {
+      return b->i;
+    }
+    a = _code_depth (e->l, H);
+    c = _code_depth (e->r, H);
+    b = phash_add (H, e);
+    b->i = (a == c ? a + 1 : (a > c ? a : c));
+    return b->i;
+    break;
 
-static const int _or_table[3][3] = { { 0, 1, 2 },
-				     { 1, 1, 1 },
-				     { 2, 1, 2 } };
+  case PRSSIM_EXPR_NOT:
+    return _code_depth (e->l, H);
+    break;
 
-#define PENDING_NONE 0
-#define PENDING_0    (1+0)
-#define PENDING_1    (1+1)
-#define PENDING_X    (1+2)
+  default:
+    return 1;
+    break;
+  }
+}
 
-int OnePrsSim::eval (prssim_expr *x)
+static void _code_size (prssim_expr *e, int *nops, int *nvars)
 {
-  int a, b;
-  if (!x) { return 0; }
-  switch (x->type) {
+  if (!e) return;
+  switch (e->type) {
   case PRSSIM_EXPR_AND:
-    a = eval (x->l);
-    b = eval (x->r);
-    return _and_table[a][b];
+  case PRSSIM_EXPR_OR:
+    _code_size (e->l, nops, nvars);
+    _code_size (e->r, nops, nvars);
     break;
-    
+
+  case PRSSIM_EXPR_NOT:
+    _code_size (e->l, nops, nvars);
+    break;
+
+  case PRSSIM_EXPR_VAR:
+    *nvars = *nvars + 1;
+    break;
+
+  default:
+    break;
+  }
+  *nops = *nops + 1;
+}
+
+static void _code_emit (prssim_expr *e, struct pHashtable *H,
+			unsigned char *op, int *pos, int *vids, int *nv)
+{
+  switch (e->type) {
+  case PRSSIM_EXPR_AND:
   case PRSSIM_EXPR_OR:
-    a = eval (x->l);
-    b = eval (x->r);
-    return _or_table[a][b];
+    /* and/or tables are symmetric, so operand order is free */
+    if (_code_depth (e->r, H) > _code_depth (e->l, H)) {
+      _code_emit (e->r, H, op, pos, vids, nv);
+      _code_emit (e->l, H, op, pos, vids, nv);
+    }
+    else {
+      _code_emit (e->l, H, op, pos, vids, nv);
+      _code_emit (e->r, H, op, pos, vids, nv);
+    }
+    op[(*pos)++] = (e->type == PRSSIM_EXPR_AND ? PRSSIM_OP_AND : PRSSIM_OP_OR);
     break;
 
   case PRSSIM_EXPR_NOT:
-    a = eval (x->l);
-    return _not_table[a];
+    _code_emit (e->l, H, op, pos, vids, nv);
+    op[(*pos)++] = PRSSIM_OP_NOT;
     break;
 
   case PRSSIM_EXPR_VAR:
-    return _proc->getBool (x->vid);
+    vids[(*nv)++] = e->vid;
+    op[(*pos)++] = PRSSIM_OP_VAR;
     break;
 
   case PRSSIM_EXPR_TRUE:
-    return 1;
+    op[(*pos)++] = PRSSIM_OP_TRUE;
     break;
-    
+
   case PRSSIM_EXPR_FALSE:
-    return 0;
+    op[(*pos)++] = PRSSIM_OP_FALSE;
     break;
 
   default:
-    fatal_error("What?");
+    fatal_error ("What?");
     break;
   }
-  return 0;
 }
 
+/*
+ * Flatten the up/dn networks of each rule into postfix programs.
+ * The programs and the local ids of their operands are shared by
+ * all instances; each PrsSim only resolves the operands to global
+ * offsets.
+ */
+void PrsSimGraph::_compile ()
+{
+  prssim_stmt *s;
+  struct pHashtable *H;
 
-static int _breakpt;
+  _nvars = 0;
+  H = phash_new (8);
+  for (s = _rules; s; s = s->next) {
+    if (s->type != PRSSIM_RULE) continue;
+
+    prssim_expr *net[4] = { s->up[PRSSIM_NORM], s->up[PRSSIM_WEAK],
+			    s->dn[PRSSIM_NORM], s->dn[PRSSIM_WEAK] };
+    int nops = 0;
+    int nv = 0;
+    int pos = 0;
+
+    for (int i=0; i < 4; i++) {
+      int d;
+      _code_size (net[i], &nops, &nv);
+      if ((d = _code_depth (net[i], H)) > PRSSIM_MAX_STACK) {
+	ActId *tmp = s->c->toid ();
+	fprintf (stderr, "Production rule for `");
+	tmp->Print (stderr);
+	fprintf (stderr, "': %s network needs an evaluation stack of %d; the limit is %d (PRSSIM_MAX_STACK).\n", i < 2 ? "pull-up" : "pull-down", d, PRSSIM_MAX_STACK);
+	delete tmp;
+	fatal_error ("Production rule too deeply nested");
+      }
+    }
+    s->nvars = nv;
+    if (nops > 0) {
+      MALLOC (s->code[0].op, unsigned char, nops);
+    }
+    if (nv > 0) {
+      MALLOC (s->vids, int, nv);
+    }
+    nv = 0;
+    for (int i=0; i < 4; i++) {
+      s->code[i].op = s->code[0].op + pos;
+      s->code[i].vbase = nv;
+      if (net[i]) {
+	_code_emit (net[i], H, s->code[0].op, &pos, s->vids, &nv);
+      }
+      s->code[i].nops = (s->code[0].op + pos) - s->code[i].op;
+    }
+    _nvars += s->nvars;
+  }
+  phash_free (H);
+}
 
 
-void OnePrsSim::setVal(int nid, int value) {
-  // we only have to change value when the value we set to is different
-  // from our current value
-  if (_proc->getBool (nid) != (value)) {
+/*------------------------------------------------------------------------
+ *
+ *  Levelized combinational cones
+ *
+ *------------------------------------------------------------------------
+ */
+#define PRSSIM_COMB_MAXVARS 8	/* largest truth table checked */
+#define PRSSIM_CONE_MAXRULES 64	/* larger regions are split */
 
+static int _code_eval_bool (const prssim_code *c, const int *slot,
+			    unsigned int asg)
+{
+  int stk[PRSSIM_MAX_STACK];
+  int sp = -1;
+  const unsigned char *op = c->op;
+  const unsigned char *end = c->op + c->nops;
+  const int *sl = slot + c->vbase;
 
-    if (flags != (1 + (value))) {
-	    flags = (1 + (value));
+  if (c->nops == 0) {
+    return 0;
+  }
+  while (op < end) {
+    switch (*op++) {
+    case PRSSIM_OP_VAR:
+      stk[++sp] = (asg >> *sl++) & 1;
+      break;
+    case PRSSIM_OP_AND:
+      sp--;
+      stk[sp] = stk[sp] & stk[sp+1];
+      break;
+    case PRSSIM_OP_OR:
+      sp--;
+      stk[sp] = stk[sp] | stk[sp+1];
+      break;
+    case PRSSIM_OP_NOT:
+      stk[sp] = !stk[sp];
+      break;
+    case PRSSIM_OP_TRUE:
+      stk[++sp] = 1;
+      break;
+    case PRSSIM_OP_FALSE:
+      stk[++sp] = 0;
+      break;
+    default:
+      fatal_error ("What?");
+      break;
+    }
+  }
+  return stk[0];
+}
 
-      // We always need to call getDelay, even if we are currently 
-      // overriding the delay time. This is because the pseudorand 
-      // generator must be stepped for simulations to be reproducible.
-      int delay;
-      if (value) {
-        delay = _proc->getDelay (_me->delay_dn, _me->delay_dn_max);
-      } else {
-        delay = _proc->getDelay (_me->delay_up, _me->delay_up_max);
+/*
+  A rule is combinational if it has no weak networks and, for every
+  assignment to its operands, exactly one of pull-up and pull-down
+  is on.
+*/
+static int _is_combinational (prssim_stmt *s)
+{
+  int slot[64];
+  int k = 0;
+
+  if (s->type != PRSSIM_RULE || s->unstab) {
+    return 0;
+  }
+  if (s->code[PRSSIM_UP (PRSSIM_WEAK)].nops > 0 ||
+      s->code[PRSSIM_DN (PRSSIM_WEAK)].nops > 0) {
+    return 0;
+  }
+  if (s->nvars == 0 || s->nvars > 64) {
+    return 0;
+  }
+  for (int i=0; i < s->nvars; i++) {
+    if (s->vids[i] == s->vid) {
+      return 0;
+    }
+    slot[i] = -1;
+    for (int j=0; j < i; j++) {
+      if (s->vids[j] == s->vids[i]) {
+	slot[i] = slot[j];
+	break;
+      }
+    }
+    if (slot[i] == -1) {
+      if (k == PRSSIM_COMB_MAXVARS) {
+	return 0;
       }
+      slot[i] = k++;
+    }
+  }
+  for (unsigned int asg=0; asg < (1U << k); asg++) {
+    if (_code_eval_bool (&s->code[PRSSIM_UP (PRSSIM_NORM)], slot, asg) ==
+	_code_eval_bool (&s->code[PRSSIM_DN (PRSSIM_NORM)], slot, asg)) {
+      return 0;
+    }
+  }
+  return 1;
+}
 
-      // create a new event to change the value
-	    _pending = new Event (
-        this, 
-        SIM_EV_MKTYPE ((value), 0),
-			  _me->delay_override_length == 0 ? delay : _me->delay_override_length
-      );
+static int _uf_find (int *uf, int i)
+{
+  while (uf[i] != i) {
+    uf[i] = uf[uf[i]];
+    i = uf[i];
+  }
+  return i;
+}
 
-      // we need to reset the delay override once it has fulfilled its purpose
-      _me->delay_override_length = 0;
+/*
+ * Find acyclic groups of combinational rules and sort them by level.
+ * Rules on a cycle, or downstream of one, stay event-driven.
+ */
+void PrsSimGraph::_levelize ()
+{
+  prssim_stmt *s, **rl;
+  struct iHashtable *drv;
+  ihash_bucket_t *b;
+  int n, nord;
+  int *comb, *indeg, *sstart, *succ, *order, *uf, *cid, *ext, *nrd;
+
+  n = 0;
+  for (s = _rules; s; s = s->next) {
+    n++;
+  }
+  if (n < 2) {
+    return;
+  }
+  MALLOC (rl, prssim_stmt *, n);
+  MALLOC (comb, int, n);
+  n = 0;
+  for (s = _rules; s; s = s->next) {
+    comb[n] = _is_combinational (s);
+    rl[n++] = s;
+  }
+
+  /* nodes that are also pass transistor terminals have other drivers */
+  drv = ihash_new (8);
+  for (int i=0; i < n; i++) {
+    if (comb[i]) {
+      b = ihash_add (drv, rl[i]->vid);
+      b->i = i;
+    }
+  }
+  for (int i=0; i < n; i++) {
+    if (rl[i]->type != PRSSIM_RULE) {
+      int t[2] = { rl[i]->t1, rl[i]->t2 };
+      for (int k=0; k < 2; k++) {
+	if ((b = ihash_lookup (drv, t[k]))) {
+	  comb[b->i] = 0;
+	}
+      }
+    }
+  }
+
+  /* edges between combinational rules, in CSR form */
+  MALLOC (sstart, int, n+1);
+  MALLOC (indeg, int, n);
+  for (int i=0; i <= n; i++) {
+    sstart[i] = 0;
+  }
+  for (int i=0; i < n; i++) {
+    indeg[i] = 0;
+    if (!comb[i]) continue;
+    for (int k=0; k < rl[i]->nvars; k++) {
+      if ((b = ihash_lookup (drv, rl[i]->vids[k])) && comb[b->i]) {
+	sstart[b->i+1]++;
+	indeg[i]++;
+      }
+    }
+  }
+  for (int i=0; i < n; i++) {
+    sstart[i+1] += sstart[i];
+  }
+  MALLOC (succ, int, sstart[n] > 0 ? sstart[n] : 1);
+  {
+    int *pos;
+    MALLOC (pos, int, n);
+    for (int i=0; i < n; i++) {
+      pos[i] = sstart[i];
+    }
+    for (int i=0; i < n; i++) {
+      if (!comb[i]) continue;
+      for (int k=0; k < rl[i]->nvars; k++) {
+	if ((b = ihash_lookup (drv, rl[i]->vids[k])) && comb[b->i]) {
+	  succ[pos[b->i]++] = i;
+	}
+      }
+    }
+    FREE (pos);
+  }
+
+  /* topological order; rules never reached are on or after a cycle */
+  MALLOC (order, int, n);
+  nord = 0;
+  for (int i=0; i < n; i++) {
+    if (comb[i] && indeg[i] == 0) {
+      order[nord++] = i;
+    }
+  }
+  for (int q=0; q < nord; q++) {
+    int i = order[q];
+    for (int e=sstart[i]; e < sstart[i+1]; e++) {
+      if (--indeg[succ[e]] == 0) {
+	order[nord++] = succ[e];
+      }
+    }
+  }
+  for (int i=0; i < n; i++) {
+    if (indeg[i] != 0) {
+      comb[i] = 0;
+    }
+  }
+
+  /* connected groups, split into chunks of consecutive levels */
+  MALLOC (uf, int, n);
+  MALLOC (cid, int, n);
+  for (int i=0; i < n; i++) {
+    uf[i] = i;
+    cid[i] = -1;
+  }
+  for (int i=0; i < n; i++) {
+    if (!comb[i]) continue;
+    for (int e=sstart[i]; e < sstart[i+1]; e++) {
+      if (comb[succ[e]]) {
+	uf[_uf_find (uf, i)] = _uf_find (uf, succ[e]);
+      }
+    }
+  }
+  {
+    int *ccur, *ccnt, nc = 0;
+    MALLOC (ccur, int, n);
+    MALLOC (ccnt, int, n);
+    for (int i=0; i < n; i++) {
+      ccur[i] = -1;
+    }
+    for (int q=0; q < nord; q++) {
+      int i = order[q];
+      int r;
+      if (!comb[i]) continue;
+      r = _uf_find (uf, i);
+      if (ccur[r] == -1 || ccnt[ccur[r]] == PRSSIM_CONE_MAXRULES) {
+	ccur[r] = nc;
+	ccnt[nc++] = 0;
+      }
+      cid[i] = ccur[r];
+      ccnt[cid[i]]++;
     }
+    FREE (ccur);
+    FREE (ccnt);
   }
+
+  /* an output is internal if it is a local node only read in its cone */
+  MALLOC (ext, int, n);
+  MALLOC (nrd, int, n);
+  for (int i=0; i < n; i++) {
+    ext[i] = 0;
+    nrd[i] = 0;
+  }
+  for (int i=0; i < n; i++) {
+    int nt = 0;
+    int t[4];
+    int *v;
+    if (rl[i]->type == PRSSIM_RULE) {
+      nt = rl[i]->nvars;
+      v = rl[i]->vids;
+    }
+    else {
+      t[nt++] = rl[i]->t1;
+      t[nt++] = rl[i]->t2;
+      if (rl[i]->type != PRSSIM_PASSN) t[nt++] = rl[i]->_g;
+      if (rl[i]->type != PRSSIM_PASSP) t[nt++] = rl[i]->g;
+      v = t;
+    }
+    for (int k=0; k < nt; k++) {
+      if ((b = ihash_lookup (drv, v[k])) && cid[b->i] != -1) {
+	if (cid[i] != cid[b->i]) {
+	  ext[b->i] = 1;
+	}
+	else {
+	  nrd[b->i]++;
+	}
+      }
+    }
+  }
+
+  /* build the cones */
+  {
+    int nc = 0;
+    int *csize, *cint;
+    for (int i=0; i < n; i++) {
+      if (cid[i] >= nc) nc = cid[i] + 1;
+    }
+    MALLOC (csize, int, nc > 0 ? nc : 1);
+    MALLOC (cint, int, nc > 0 ? nc : 1);
+    for (int c=0; c < nc; c++) {
+      csize[c] = 0;
+      cint[c] = 0;
+    }
+    for (int i=0; i < n; i++) {
+      if (cid[i] == -1) continue;
+      csize[cid[i]]++;
+      if (!ext[i] && nrd[i] > 0 && rl[i]->vid >= 0) {
+	cint[cid[i]]++;
+      }
+    }
+    for (int c=nc-1; c >= 0; c--) {
+      prssim_cone *x;
+      struct iHashtable *oh;
+      int pos;
+
+      if (csize[c] < 2 || cint[c] == 0) {
+	/* nothing to save */
+	continue;
+      }
+      NEW (x, prssim_cone);
+      x->nr = csize[c];
+      MALLOC (x->r, prssim_stmt *, x->nr);
+      MALLOC (x->internal, unsigned char, x->nr);
+      MALLOC (x->opidx, int *, x->nr);
+      MALLOC (x->outidx, int, x->nr);
+      x->nops = 0;
+      x->ops = NULL;
+      x->drv = NULL;
+
+      oh = ihash_new (4);
+      pos = 0;
+      for (int q=0; q < nord; q++) {
+	int i = order[q];
+	if (cid[i] != c) continue;
+	b = ihash_add (oh, rl[i]->vid);
+	b->i = -(pos+1);	/* rule index, until read by the cone */
+	x->r[pos] = rl[i];
+	x->internal[pos] = (!ext[i] && nrd[i] > 0 && rl[i]->vid >= 0);
+	rl[i]->incone = 1;
+	pos++;
+      }
+      for (int i=0; i < x->nr; i++) {
+	prssim_stmt *r = x->r[i];
+	x->opidx[i] = NULL;
+	if (r->nvars > 0) {
+	  MALLOC (x->opidx[i], int, r->nvars);
+	}
+	for (int k=0; k < r->nvars; k++) {
+	  b = ihash_lookup (oh, r->vids[k]);
+	  if (!b) {
+	    b = ihash_add (oh, r->vids[k]);
+	    b->i = x->nops++;
+	    REALLOC (x->ops, int, x->nops);
+	    REALLOC (x->drv, int, x->nops);
+	    x->ops[b->i] = r->vids[k];
+	    x->drv[b->i] = -1;
+	  }
+	  else if (b->i < 0) {
+	    /* first read of an output of this cone */
+	    int d = -b->i - 1;
+	    b->i = x->nops++;
+	    REALLOC (x->ops, int, x->nops);
+	    REALLOC (x->drv, int, x->nops);
+	    x->ops[b->i] = r->vids[k];
+	    x->drv[b->i] = d;
+	  }
+	  x->opidx[i][k] = b->i;
+	}
+      }
+      for (int i=0; i < x->nr; i++) {
+	b = ihash_lookup (oh, x->r[i]->vid);
+	x->outidx[i] = (b->i >= 0 ? b->i : -1);
+      }
+      ihash_free (oh);
+
+      x->next = _cones;
+      _cones = x;
+    }
+    FREE (csize);
+    FREE (cint);
+  }
+
+  ihash_free (drv);
+  FREE (rl);
+  FREE (comb);
+  FREE (indeg);
+  FREE (sstart);
+  FREE (succ);
+  FREE (order);
+  FREE (uf);
+  FREE (cid);
+  FREE (ext);
+  FREE (nrd);
 }
 
 
-int OnePrsSim::Step (Event *ev)
+/*------------------------------------------------------------------------
+ *
+ *  Postfix programs as trees
+ *
+ *------------------------------------------------------------------------
+ */
+struct code_node {
+  unsigned char op;
+  int slot;			/* VAR */
+  int l, r;			/* AND, OR, NOT */
+};
+
+/*
+ * Rebuild the expression tree of a postfix program in n[] (c->nops
+ * entries), keeping the operand slots. Returns the root.
+ */
+static int _code_tree (const prssim_code *c, struct code_node *n)
+{
+  int *stk;
+  int sp = -1;
+  int slot = c->vbase;
+  int root;
+
+  MALLOC (stk, int, c->nops);
+  for (int i=0; i < c->nops; i++) {
+    n[i].op = c->op[i];
+    switch (c->op[i]) {
+    case PRSSIM_OP_VAR:
+      n[i].slot = slot++;
+      break;
+    case PRSSIM_OP_AND:
+    case PRSSIM_OP_OR:
+      n[i].r = stk[sp--];
+      n[i].l = stk[sp--];
+      break;
+    case PRSSIM_OP_NOT:
+      n[i].l = stk[sp--];
+      break;
+    default:
+      break;
+    }
+    stk[++sp] = i;
+  }
+  root = stk[0];
+  FREE (stk);
+  return root;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Sum-of-products networks (sim.prs.sop_count)
+ *
+ *------------------------------------------------------------------------
+ */
+
+/* collect the roots of the OR tree at x */
+static void _sop_terms (struct code_node *n, int x, int *terms, int *nt)
+{
+  if (n[x].op == PRSSIM_OP_OR) {
+    _sop_terms (n, n[x].l, terms, nt);
+    _sop_terms (n, n[x].r, terms, nt);
+  }
+  else {
+    terms[(*nt)++] = x;
+  }
+}
+
+/* collect the literals of the AND tree at x; 0 if it is not one */
+static int _sop_lits (struct code_node *n, int x, int *lits, int *nl)
+{
+  switch (n[x].op) {
+  case PRSSIM_OP_AND:
+    return _sop_lits (n, n[x].l, lits, nl) && _sop_lits (n, n[x].r, lits, nl);
+
+  case PRSSIM_OP_VAR:
+    lits[(*nl)++] = 2*n[x].slot + 1;
+    return 1;
+
+  case PRSSIM_OP_NOT:
+    if (n[n[x].l].op == PRSSIM_OP_VAR) {
+      lits[(*nl)++] = 2*n[n[x].l].slot;
+      return 1;
+    }
+    return 0;
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Find the networks that are a flat OR of ANDs of (possibly negated)
+ * operands with at least minlits literals.
+ */
+void PrsSimGraph::_sopify (int minlits)
+{
+  for (prssim_stmt *s = _rules; s; s = s->next) {
+    if (s->type != PRSSIM_RULE) continue;
+
+    for (int w=0; w < 4; w++) {
+      const prssim_code *c = &s->code[w];
+      struct code_node *n;
+      int *terms, *lits, *tstart;
+      int nt = 0, nl = 0;
+      int ok = 1;
+
+      if (c->nops < 2*minlits - 1) {
+	/* n literals need at least n-1 binary operators */
+	continue;
+      }
+      MALLOC (n, struct code_node, c->nops);
+      MALLOC (terms, int, c->nops);
+      MALLOC (lits, int, c->nops);
+      _sop_terms (n, _code_tree (c, n), terms, &nt);
+      MALLOC (tstart, int, nt + 1);
+      for (int i=0; ok && i < nt; i++) {
+	tstart[i] = nl;
+	ok = _sop_lits (n, terms[i], lits, &nl);
+      }
+      tstart[nt] = nl;
+      if (ok && nl >= minlits) {
+	NEW (s->sop[w], prssim_sopcode);
+	s->sop[w]->nterms = nt;
+	s->sop[w]->tstart = tstart;
+	MALLOC (s->sop[w]->lit, int, nl);
+	for (int i=0; i < nl; i++) {
+	  s->sop[w]->lit[i] = lits[i];
+	}
+      }
+      else {
+	FREE (tstart);
+      }
+      FREE (n);
+      FREE (terms);
+      FREE (lits);
+    }
+  }
+}
+
+PrsSopIndex::PrsSopIndex (int minlits)
+{
+  _min = minlits;
+  A_INIT (_nets);
+  A_INIT (_pend);
+  _noff = 0;
+  _start = NULL;
+  _nref = 0;
+  _ref = NULL;
+}
+
+PrsSopIndex::~PrsSopIndex ()
+{
+  A_FREE (_nets);
+  A_FREE (_pend);
+  if (_start) {
+    FREE (_start);
+  }
+  if (_ref) {
+    FREE (_ref);
+  }
+}
+
+void PrsSopIndex::addNet (prssim_sopnet *n)
+{
+  A_NEW (_nets, prssim_sopnet *);
+  A_NEXT (_nets) = n;
+  A_INC (_nets);
+}
+
+void PrsSopIndex::add (int off, prssim_sopnet *n, int term, int pol)
+{
+  A_NEW (_pend, struct pending);
+  A_NEXT (_pend).off = off;
+  A_NEXT (_pend).r.net = n;
+  A_NEXT (_pend).r.term = term;
+  A_NEXT (_pend).r.pol = pol;
+  A_INC (_pend);
+}
+
+void PrsSopIndex::build (ActSimCore *sc)
+{
+  _noff = 0;
+  for (int i=0; i < A_LEN (_pend); i++) {
+    if (_pend[i].off >= _noff) {
+      _noff = _pend[i].off + 1;
+    }
+  }
+  MALLOC (_start, int, _noff + 1);
+  for (int i=0; i <= _noff; i++) {
+    _start[i] = 0;
+  }
+  for (int i=0; i < A_LEN (_pend); i++) {
+    _start[_pend[i].off+1]++;
+  }
+  for (int i=0; i < _noff; i++) {
+    _start[i+1] += _start[i];
+  }
+  _nref = A_LEN (_pend);
+  if (_nref > 0) {
+    MALLOC (_ref, prssim_sopref, _nref);
+  }
+  /* _start[off] is the next free slot of off until the fill is done */
+  for (int i=0; i < A_LEN (_pend); i++) {
+    _ref[_start[_pend[i].off]++] = _pend[i].r;
+  }
+  for (int i=_noff; i > 0; i--) {
+    _start[i] = _start[i-1];
+  }
+  _start[0] = 0;
+  A_FREE (_pend);
+  A_INIT (_pend);
+
+  resync (sc);
+}
+
+static int _sop_term_val (const prssim_sopterm *t)
+{
+  return t->nfalse > 0 ? 0 : (t->nx > 0 ? 2 : 1);
+}
+
+/* value of a literal */
+static inline int _sop_lit (int pol, int v)
+{
+  return (pol || v == 2) ? v : 1 - v;
+}
+
+void PrsSopIndex::resync (ActSimCore *sc)
+{
+  for (int i=0; i < A_LEN (_nets); i++) {
+    for (int j=0; j < _nets[i]->nterms; j++) {
+      _nets[i]->t[j].nfalse = 0;
+      _nets[i]->t[j].nx = 0;
+    }
+  }
+  for (int off=0; off < _noff; off++) {
+    int v;
+    if (_start[off] == _start[off+1]) continue;
+    v = sc->getBool (off);
+    for (int i=_start[off]; i < _start[off+1]; i++) {
+      prssim_sopterm *t = &_ref[i].net->t[_ref[i].term];
+      switch (_sop_lit (_ref[i].pol, v)) {
+      case 0:
+	t->nfalse++;
+	break;
+      case 2:
+	t->nx++;
+	break;
+      }
+    }
+  }
+  for (int i=0; i < A_LEN (_nets); i++) {
+    prssim_sopnet *n = _nets[i];
+    n->ntrue = 0;
+    n->nx = 0;
+    for (int j=0; j < n->nterms; j++) {
+      switch (_sop_term_val (&n->t[j])) {
+      case 1:
+	n->ntrue++;
+	break;
+      case 2:
+	n->nx++;
+	break;
+      }
+    }
+  }
+}
+
+void PrsSopIndex::_update (prssim_sopref *r, int oval, int nval)
+{
+  int lo = _sop_lit (r->pol, oval);
+  int ln = _sop_lit (r->pol, nval);
+  prssim_sopterm *t;
+  int before, after;
+
+  if (lo == ln) {
+    return;
+  }
+  t = &r->net->t[r->term];
+  before = _sop_term_val (t);
+  if (lo == 0) {
+    t->nfalse--;
+  }
+  else if (lo == 2) {
+    t->nx--;
+  }
+  if (ln == 0) {
+    t->nfalse++;
+  }
+  else if (ln == 2) {
+    t->nx++;
+  }
+  after = _sop_term_val (t);
+  if (before == after) {
+    return;
+  }
+  if (before == 1) {
+    r->net->ntrue--;
+  }
+  else if (before == 2) {
+    r->net->nx--;
+  }
+  if (after == 1) {
+    r->net->ntrue++;
+  }
+  else if (after == 2) {
+    r->net->nx++;
+  }
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Compiled rule evaluation (sim.prs.jit)
+ *
+ *  The postfix programs of each PrsSimGraph are turned into one C
+ *  function per rule, compiled into a shared object, and loaded with
+ *  dlopen(). The object is named by a hash of its source, so it is
+ *  shared by all runs that build the same graph and only compiled
+ *  the first time.
+ *
+ *------------------------------------------------------------------------
+ */
+const unsigned long *OnePrsSim::_jpv = NULL;
+const unsigned long *OnePrsSim::_jpx = NULL;
+
+void OnePrsSim::useJit (ActSimState *st)
+{
+  _jpv = st->valuePlane ();
+  _jpx = st->xPlane ();
+}
+
+struct jit_buf {
+  char *s;
+  int len, max;
+};
+
+static void _jit_printf (struct jit_buf *b, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start (ap, fmt);
+  n = vsnprintf (b->s + b->len, b->max - b->len, fmt, ap);
+  va_end (ap);
+  if (n >= b->max - b->len) {
+    while (n >= b->max - b->len) {
+      b->max = 2*b->max;
+    }
+    REALLOC (b->s, char, b->max);
+    va_start (ap, fmt);
+    vsnprintf (b->s + b->len, b->max - b->len, fmt, ap);
+    va_end (ap);
+  }
+  b->len += n;
+}
+
+/* emit code that leaves the value of node x in t<d> */
+static void _jit_expr (struct jit_buf *b, struct code_node *n, int x,
+		       int d, int *maxd)
+{
+  if (d > *maxd) {
+    *maxd = d;
+  }
+  switch (n[x].op) {
+  case PRSSIM_OP_VAR:
+    _jit_printf (b, "  t%d = _v (pv, px, g[%d]);\n", d, n[x].slot);
+    break;
+
+  case PRSSIM_OP_AND:
+    _jit_expr (b, n, n[x].l, d, maxd);
+    _jit_printf (b, "  if (t%d != 0) {\n", d);
+    _jit_expr (b, n, n[x].r, d+1, maxd);
+    _jit_printf (b, "  t%d = (t%d == 1 ? t%d : (t%d == 0 ? 0 : 2));\n  }\n",
+		 d, d, d+1, d+1);
+    break;
+
+  case PRSSIM_OP_OR:
+    _jit_expr (b, n, n[x].l, d, maxd);
+    _jit_printf (b, "  if (t%d != 1) {\n", d);
+    _jit_expr (b, n, n[x].r, d+1, maxd);
+    _jit_printf (b, "  t%d = (t%d == 0 ? t%d : (t%d == 1 ? 1 : 2));\n  }\n",
+		 d, d, d+1, d+1);
+    break;
+
+  case PRSSIM_OP_NOT:
+    _jit_expr (b, n, n[x].l, d, maxd);
+    _jit_printf (b, "  t%d = (t%d == 2 ? 2 : !t%d);\n", d, d, d);
+    break;
+
+  case PRSSIM_OP_TRUE:
+    _jit_printf (b, "  t%d = 1;\n", d);
+    break;
+
+  case PRSSIM_OP_FALSE:
+    _jit_printf (b, "  t%d = 0;\n", d);
+    break;
+
+  default:
+    fatal_error ("What?");
+    break;
+  }
+}
+
+/* C function for all four networks of a rule */
+static void _jit_rule (struct jit_buf *b, prssim_stmt *s, int idx)
+{
+  struct jit_buf body;
+  int maxd = 0;
+
+  body.max = 1024;
+  body.len = 0;
+  MALLOC (body.s, char, body.max);
+  body.s[0] = '\0';
+
+  for (int w=0; w < 4; w++) {
+    const prssim_code *c = &s->code[w];
+    struct code_node *n;
+
+    if (c->nops == 0) {
+      continue;
+    }
+    MALLOC (n, struct code_node, c->nops);
+    _jit_printf (&body, " case %d:\n", w);
+    _jit_expr (&body, n, _code_tree (c, n), 0, &maxd);
+    _jit_printf (&body, "  return t0;\n");
+    FREE (n);
+  }
+
+  _jit_printf (b, "int actsim_prs_%d (const unsigned long *pv, const unsigned long *px, const int *g, int w)\n{\n  int t0", idx);
+  for (int i=1; i <= maxd; i++) {
+    _jit_printf (b, ", t%d", i);
+  }
+  _jit_printf (b, ";\n  switch (w) {\n%s  default:\n  return 0;\n  }\n}\n\n",
+	       body.s);
+  FREE (body.s);
+}
+
+static unsigned long _jit_hash (const char *s, int len)
+{
+  unsigned long h = 14695981039346656037UL;
+  for (int i=0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+/*
+  mkdir -p. Directories we create are private; the cache directory
+  itself is then checked with _jit_private().
+*/
+static int _jit_mkdir (const char *dir)
+{
+  char *tmp = Strdup (dir);
+  int ret = 1;
+
+  for (char *p = tmp + 1; ; p++) {
+    if (*p == '/' || *p == '\0') {
+      char c = *p;
+      *p = '\0';
+      if (mkdir (tmp, 0700) != 0 && errno != EEXIST) {
+	ret = 0;
+	break;
+      }
+      *p = c;
+      if (c == '\0') {
+	break;
+      }
+    }
+  }
+  FREE (tmp);
+  return ret;
+}
+
+/*
+  Objects are only loaded from (and written to) a path that is not a
+  symbolic link, is owned by us, and cannot be written by anyone else;
+  otherwise another user could plant a library that we would load.
+*/
+static int _jit_private (const char *path, int isdir)
+{
+  struct stat sb;
+
+  if (lstat (path, &sb) != 0) {
+    return 0;
+  }
+  if (isdir ? !S_ISDIR (sb.st_mode) : !S_ISREG (sb.st_mode)) {
+    return 0;
+  }
+  if (sb.st_uid != getuid () || (sb.st_mode & (S_IWGRP|S_IWOTH))) {
+    return 0;
+  }
+  return 1;
+}
+
+/* the cached source next to an object must match src exactly */
+static int _jit_same_src (const char *cfile, struct jit_buf *src)
+{
+  FILE *fp;
+  char *buf;
+  int ret;
+
+  if (!_jit_private (cfile, 0)) {
+    return 0;
+  }
+  fp = fopen (cfile, "r");
+  if (!fp) {
+    return 0;
+  }
+  MALLOC (buf, char, src->len + 1);
+  ret = (fread (buf, 1, src->len + 1, fp) == (size_t)src->len &&
+	 memcmp (buf, src->s, src->len) == 0);
+  FREE (buf);
+  fclose (fp);
+  return ret;
+}
+
+/* append a shell-quoted copy of s */
+static void _jit_quote (struct jit_buf *b, const char *s)
+{
+  _jit_printf (b, "'");
+  for (; *s; s++) {
+    if (*s == '\'') {
+      _jit_printf (b, "'\\''");
+    }
+    else {
+      _jit_printf (b, "%c", *s);
+    }
+  }
+  _jit_printf (b, "'");
+}
+
+static const char *_jit_cache_dir (char *buf, int sz)
+{
+  const char *s;
+
+  if (config_exists ("sim.prs.jit_dir")) {
+    return config_get_string ("sim.prs.jit_dir");
+  }
+  if ((s = getenv ("XDG_CACHE_HOME")) && *s) {
+    snprintf (buf, sz, "%s/actsim", s);
+  }
+  else if ((s = getenv ("HOME")) && *s) {
+    snprintf (buf, sz, "%s/.cache/actsim", s);
+  }
+  else {
+    snprintf (buf, sz, "/tmp/actsim-%d", (int) getuid ());
+  }
+  return buf;
+}
+
+void PrsSimGraph::_jit ()
+{
+  struct jit_buf src;
+  prssim_stmt *s;
+  const char *cc, *dir;
+  char dbuf[1024], so[1200], csrc[1200], tmp[1200], cfile[1200];
+  unsigned long h;
+  int nrules;
+
+  cc = "cc -O2 -fPIC -shared";
+  if (config_exists ("sim.prs.jit_cc")) {
+    cc = config_get_string ("sim.prs.jit_cc");
+  }
+
+  src.max = 4096;
+  src.len = 0;
+  MALLOC (src.s, char, src.max);
+  src.s[0] = '\0';
+  _jit_printf (&src, "/* generated by actsim (%s); do not edit */\n", cc);
+  _jit_printf (&src, "#define PW (8*sizeof (unsigned long))\n\n");
+  _jit_printf (&src, "static inline int _v (const unsigned long *pv, const unsigned long *px, int o)\n{\n  if ((px[o/PW] >> (o%%PW)) & 1) return 2;\n  return (pv[o/PW] >> (o%%PW)) & 1;\n}\n\n");
+
+  nrules = 0;
+  for (s = _rules; s; s = s->next) {
+    if (s->type != PRSSIM_RULE) continue;
+    _jit_rule (&src, s, nrules++);
+  }
+  if (nrules == 0) {
+    FREE (src.s);
+    return;
+  }
+
+  h = _jit_hash (src.s, src.len);
+  dir = _jit_cache_dir (dbuf, sizeof (dbuf));
+  if (!_jit_mkdir (dir) || !_jit_private (dir, 1)) {
+    warning ("sim.prs.jit: `%s' is not a private directory; using the interpreter", dir);
+    FREE (src.s);
+    return;
+  }
+  snprintf (so, sizeof (so), "%s/prs_%016lx.so", dir, h);
+  snprintf (csrc, sizeof (csrc), "%s/prs_%016lx.c", dir, h);
+
+  /* the source is kept next to the object, so a hash collision is
+     a cache miss rather than the wrong rules */
+  if (!_jit_private (so, 0) || !_jit_same_src (csrc, &src)) {
+    struct jit_buf cmd;
+    FILE *fp;
+
+    /* cold start: compile into a private name, then rename so that
+       concurrent runs never load a partial object */
+    snprintf (cfile, sizeof (cfile), "%s/prs_%016lx.%d.c", dir, h, (int) getpid());
+    snprintf (tmp, sizeof (tmp), "%s/prs_%016lx.%d.so", dir, h, (int) getpid());
+    fp = fopen (cfile, "w");
+    if (!fp) {
+      warning ("sim.prs.jit: could not write `%s'; using the interpreter", cfile);
+      FREE (src.s);
+      return;
+    }
+    fwrite (src.s, 1, src.len, fp);
+    if (fclose (fp) != 0) {
+      warning ("sim.prs.jit: could not write `%s'; using the interpreter", cfile);
+      unlink (cfile);
+      FREE (src.s);
+      return;
+    }
+
+    cmd.max = 256;
+    cmd.len = 0;
+    MALLOC (cmd.s, char, cmd.max);
+    _jit_printf (&cmd, "%s -o ", cc);
+    _jit_quote (&cmd, tmp);
+    _jit_printf (&cmd, " ");
+    _jit_quote (&cmd, cfile);
+    if (system (cmd.s) != 0 || rename (cfile, csrc) != 0 ||
+	rename (tmp, so) != 0) {
+      warning ("sim.prs.jit: `%s' failed; using the interpreter", cmd.s);
+      unlink (tmp);
+      unlink (cfile);
+      FREE (cmd.s);
+      FREE (src.s);
+      return;
+    }
+    FREE (cmd.s);
+  }
+  FREE (src.s);
+
+  _jit_lib = dlopen (so, RTLD_NOW|RTLD_LOCAL);
+  if (!_jit_lib) {
+    warning ("sim.prs.jit: %s; using the interpreter", dlerror());
+    return;
+  }
+  nrules = 0;
+  for (s = _rules; s; s = s->next) {
+    char fn[32];
+    if (s->type != PRSSIM_RULE) continue;
+    snprintf (fn, sizeof (fn), "actsim_prs_%d", nrules++);
+    s->jit = (prssim_jitfn) dlsym (_jit_lib, fn);
+    if (!s->jit) {
+      warning ("sim.prs.jit: `%s' is missing %s; using the interpreter", so, fn);
+      for (s = _rules; s; s = s->next) {
+	s->jit = NULL;
+      }
+      dlclose (_jit_lib);
+      _jit_lib = NULL;
+      return;
+    }
+  }
+}
+
+
+/* 2 = X */
+static const int _not_table[3] = { 1, 0, 2 };
+
+static const int _and_table[3][3] = { { 0, 0, 0 },
+				      { 0, 1, 2 },
+				      { 0, 2, 2 } };
+
+static const int _or_table[3][3] = { { 0, 1, 2 },
+				     { 1, 1, 1 },
+				     { 2, 1, 2 } };
+
+#define PENDING_NONE 0
+#define PENDING_0    (1+0)
+#define PENDING_1    (1+1)
+#define PENDING_X    (1+2)
+
+int OnePrsSim::eval (const prssim_code *c)
+{
+  int stk[PRSSIM_MAX_STACK];
+  int sp = -1;
+  const unsigned char *op = c->op;
+  const unsigned char *end = c->op + c->nops;
+  const int *gid = _ops + c->vbase;
+
+  if (_sop) {
+    const prssim_sopnet *sn = _proc->sopNets (_idx) + (c - _me->code);
+    if (sn->t) {
+      return sn->ntrue > 0 ? 1 : (sn->nx > 0 ? 2 : 0);
+    }
+  }
+  if (_me->jit) {
+    return (*_me->jit) (_jpv, _jpx, _ops, c - _me->code);
+  }
+  if (c->nops == 0) {
+    return 0;
+  }
+  while (op < end) {
+    switch (*op++) {
+    case PRSSIM_OP_VAR:
+      stk[++sp] = _proc->getGlobalBool (*gid++);
+      break;
+
+    case PRSSIM_OP_AND:
+      sp--;
+      stk[sp] = _and_table[stk[sp]][stk[sp+1]];
+      break;
+
+    case PRSSIM_OP_OR:
+      sp--;
+      stk[sp] = _or_table[stk[sp]][stk[sp+1]];
+      break;
+
+    case PRSSIM_OP_NOT:
+      stk[sp] = _not_table[stk[sp]];
+      break;
+
+    case PRSSIM_OP_TRUE:
+      stk[++sp] = 1;
+      break;
+
+    case PRSSIM_OP_FALSE:
+      stk[++sp] = 0;
+      break;
+
+    default:
+      fatal_error ("What?");
+      break;
+    }
+  }
+  return stk[0];
+}
+
+
+static int _breakpt;
+
+
+void OnePrsSim::setVal(int nid, int value) {
+  // we only have to change value when the value we set to is different
+  // from our current value
+  if (_proc->getBool (nid) != (value)) {
+
+
+    if (flags != (1 + (value))) {
+	    flags = (1 + (value));
+
+      // We always need to call getDelay, even if we are currently 
+      // overriding the delay time. This is because the pseudorand 
+      // generator must be stepped for simulations to be reproducible.
+      int delay;
+      if (value) {
+        delay = _proc->getDelay (_me->delay_dn, _me->delay_dn_max);
+      } else {
+        delay = _proc->getDelay (_me->delay_up, _me->delay_up_max);
+      }
+
+      // create a new event to change the value
+      _schedule (value,
+		 _me->delay_override_length == 0 ? delay + _xdelay : _me->delay_override_length);
+
+      // we need to reset the delay override once it has fulfilled its purpose
+      _me->delay_override_length = 0;
+    }
+  }
+}
+
+
+void OnePrsSim::_schedule (int value, int delay)
+{
+  if (_wheel && (_wpending = _wheel->insert (this, value, delay))) {
+    _pending = NULL;
+  }
+  else {
+    _pending = ActEvent::make (this, SIM_EV_MKTYPE (value, 0), delay);
+    _wpending = NULL;
+  }
+  _pending_tm = CurTimeLo() + delay;
+}
+
+void OnePrsSim::_cancel ()
+{
+  if (_pending) {
+    _pending->Remove ();
+    _pending = NULL;
+  }
+  if (_wpending) {
+    _wpending->kill = 1;
+    _wpending = NULL;
+  }
+}
+
+
+int OnePrsSim::Step (Event *ev)
+{
+  int ev_type = ev->getType ();
+  int t = SIM_EV_TYPE (ev_type);
+
+  _pending = NULL;
+  _wpending = NULL;
+  return _step (t);
+}
+
+int OnePrsSim::wheelStep (prssim_wev *w)
 {
-  int ev_type = ev->getType ();
-  int t = SIM_EV_TYPE (ev_type);
+  int t = w->type;
 
-  _breakpt = 0;
   _pending = NULL;
+  _wpending = NULL;
+  return _step (t);
+}
+
+int OnePrsSim::_step (int t)
+{
+  _breakpt = 0;
 
   /*-- fire rule --*/
   switch (_me->type) {
@@ -726,18 +2207,18 @@ int OnePrsSim::Step (Event *ev)
       int u_state, d_state, u_weak, d_weak;
 
       // evaluate the pullup network
-      u_state = eval (_me->up[PRSSIM_NORM]);
+      u_state = eval (&_me->code[PRSSIM_UP (PRSSIM_NORM)]);
       if (u_state == 0) {
-	      u_state = eval (_me->up[PRSSIM_WEAK]);
+	      u_state = eval (&_me->code[PRSSIM_UP (PRSSIM_WEAK)]);
 	      if (u_state != 0) {
 	        u_weak = 1;
 	      }
       }
 
       // evaluate the pulldown network
-      d_state = eval (_me->dn[PRSSIM_NORM]);
+      d_state = eval (&_me->code[PRSSIM_DN (PRSSIM_NORM)]);
       if (d_state == 0) {
-	      d_state = eval (_me->dn[PRSSIM_WEAK]);
+	      d_state = eval (&_me->code[PRSSIM_DN (PRSSIM_WEAK)]);
 	      if (d_state != 0) {
 	        d_weak = 1;
 	      }
@@ -831,24 +2312,30 @@ int OnePrsSim::matches (int val)
   do {								\
     if (_proc->getBool (nid) != 2) {				\
       if (flags != PENDING_X) {					\
-	if (_pending) {						\
-	  _pending->Remove ();					\
-	}							\
+	_cancel ();						\
 	flags = PENDING_X;					\
-	_pending = new Event (this, SIM_EV_MKTYPE (2, 0), 1);	\
+	_schedule (2, 1);					\
       }								\
     }								\
     else {							\
       if (flags == PENDING_0 || flags == PENDING_1) {		\
 	flags = 0;						\
-	if (_pending) {						\
-	  _pending->Remove();					\
-	}							\
+	_cancel ();						\
       }								\
     }								\
   } while (0)
 
 void OnePrsSim::propagate ()
+{
+  if (_delta) {
+    _delta->mark (this);
+  }
+  else {
+    _propagate ();
+  }
+}
+
+void OnePrsSim::_propagate ()
 {
   int u_state, d_state;
   int u_weak = 0, d_weak = 0;
@@ -925,17 +2412,17 @@ void OnePrsSim::propagate ()
 
   case PRSSIM_RULE:
     /* evaluate up, up-weak and dn, dn-weak */
-    u_state = eval (_me->up[PRSSIM_NORM]);
+    u_state = eval (&_me->code[PRSSIM_UP (PRSSIM_NORM)]);
     if (u_state == 0) {
-      u_state = eval (_me->up[PRSSIM_WEAK]);
+      u_state = eval (&_me->code[PRSSIM_UP (PRSSIM_WEAK)]);
       if (u_state != 0) {
         u_weak = 1;
       }
     }
 
-    d_state = eval (_me->dn[PRSSIM_NORM]);
+    d_state = eval (&_me->code[PRSSIM_DN (PRSSIM_NORM)]);
     if (d_state == 0) {
-      d_state = eval (_me->dn[PRSSIM_WEAK]);
+      d_state = eval (&_me->code[PRSSIM_DN (PRSSIM_WEAK)]);
       if (d_state != 0) {
 	d_weak = 1;
       }
@@ -1080,6 +2567,73 @@ void OnePrsSim::propagate ()
   }
 }
 
+int OnePrsSim::_xdelay = 0;
+
+void OnePrsSim::propagateDelayed (int extra)
+{
+  _xdelay = extra;
+  _propagate ();
+  _xdelay = 0;
+}
+
+/*
+  The cases of propagate() that a combinational rule can reach; the
+  output is updated by the caller rather than scheduled.
+*/
+int OnePrsSim::combValue ()
+{
+  int u_state, d_state;
+  int cur = _proc->getBool (_me->vid);
+
+  u_state = eval (&_me->code[PRSSIM_UP (PRSSIM_NORM)]);
+  d_state = eval (&_me->code[PRSSIM_DN (PRSSIM_NORM)]);
+
+  if (u_state == 0) {
+    if (d_state == 1) {
+      return 0;
+    }
+    if (d_state == 2 && cur == 1) {
+      return 2;
+    }
+    return -1;
+  }
+  else if (u_state == 1) {
+    if (d_state == 0) {
+      return 1;
+    }
+    if (d_state == 1) {
+      WARNING_MSG ("interference", "");
+    }
+    else if (!_proc->isResetMode()) {
+      WARNING_MSG ("weak-interference", "");
+    }
+    return 2;
+  }
+  else {
+    if (d_state == 0) {
+      return (cur == 0 ? 2 : -1);
+    }
+    if (!_proc->isResetMode()) {
+      WARNING_MSG ("weak-interference", "");
+    }
+    return 2;
+  }
+}
+
+void OnePrsSim::propagateAll (SimDES **arr, int n)
+{
+  if (_delta) {
+    for (int i=0; i < n; i++) {
+      _delta->mark (static_cast<OnePrsSim *>(arr[i]));
+    }
+  }
+  else {
+    for (int i=0; i < n; i++) {
+      static_cast<OnePrsSim *>(arr[i])->_propagate ();
+    }
+  }
+}
+
 void PrsSim::printName (FILE *fp, int lid)
 {
   act_connection *c;
@@ -1104,7 +2658,6 @@ bool PrsSim::setBool (int lid, int v)
   // grab the global offset of this node
   int off = getGlobalOffset (lid, 0);
 
-  SimDES **arr;
   const ActSimCore::watchpt_bucket *nm;
   const char *nm2;
   int verb;
@@ -1175,39 +2728,12 @@ bool PrsSim::setBool (int lid, int v)
     // propagate the new value to the fanout of the node
     if (!_sc->isMasked (off)) {
       
-      // grab the fanout
-      arr = _sc->getFO (off, 0);
-
 #ifdef DUMP_ALL
       printf (" >>> fanout: %d\n", _sc->numFanout (off, 0));
 #endif
 
       // for every fanout connection, propagate the new value
-      for (int i=0; i < _sc->numFanout (off, 0); i++) {
-        ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-        Assert (p, "What?");
-
-#ifdef DUMP_ALL
-        printf ("   prop: ");
-        {
-        	ActSimObj *obj = dynamic_cast<ActSimObj *>(p);
-        	if (obj) {
-        	  if (obj->getName()) {
-        	    obj->getName()->Print (stdout);
-        	  }
-        	  else {
-        	    printf ("-none-");
-        	  }
-        	}
-        	else {
-        	  printf ("#%p", p);
-        	}
-        }
-        printf ("\n");
-#endif
-
-        p->propagate ();
-      }
+      _sc->propagateFanout (off, 0);
     }
     return true;
   }
@@ -1221,7 +2747,6 @@ void PrsSim::setForced (int lid, int v)
   // grab the global ID
   int off = getGlobalOffset (lid, 0);
 
-  SimDES **arr;
   const ActSimCore::watchpt_bucket *nm;
   const char *nm2;
   int verb;
@@ -1279,39 +2804,12 @@ void PrsSim::setForced (int lid, int v)
   // propagate the new value to the fanout of the node
   if (v != oval) {
     
-    // grab the fanout
-    arr = _sc->getFO (off, 0);
-
 #ifdef DUMP_ALL
     printf (" >>> fanout: %d\n", _sc->numFanout (off, 0));
 #endif
 
     // for every fanout connection, propagate the new value
-    for (int i=0; i < _sc->numFanout (off, 0); i++) {
-      ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-      Assert (p, "What?");
-
-#ifdef DUMP_ALL
-      printf ("   prop: ");
-      {
-        ActSimObj *obj = dynamic_cast<ActSimObj *>(p);
-        if (obj) {
-          if (obj->getName()) {
-            obj->getName()->Print (stdout);
-          }
-          else {
-            printf ("-none-");
-          }
-        }
-        else {
-          printf ("#%p", p);
-        }
-      }
-      printf ("\n");
-#endif
-
-      p->propagate ();
-    }
+    _sc->propagateFanout (off, 0);
   }
 }
 
@@ -1320,7 +2818,6 @@ bool PrsSim::unmask (int lid)
   // grab the global ID
   int off = getGlobalOffset (lid, 0);
 
-  SimDES **arr;
   const ActSimCore::watchpt_bucket *nm;
   const char *nm2;
   int verb;
@@ -1381,39 +2878,12 @@ bool PrsSim::unmask (int lid)
     // propagate the new value to the fanout of the node
     if (v != oval) {
       
-      // grab the fanout
-      arr = _sc->getFO (off, 0);
-
 #ifdef DUMP_ALL
       printf (" >>> fanout: %d\n", _sc->numFanout (off, 0));
 #endif
 
       // for every fanout connection, propagate the new value
-      for (int i=0; i < _sc->numFanout (off, 0); i++) {
-        ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-        Assert (p, "What?");
-
-#ifdef DUMP_ALL
-        printf ("   prop: ");
-        {
-        	ActSimObj *obj = dynamic_cast<ActSimObj *>(p);
-        	if (obj) {
-        	  if (obj->getName()) {
-        	    obj->getName()->Print (stdout);
-        	  }
-        	  else {
-        	    printf ("-none-");
-        	  }
-        	}
-        	else {
-        	  printf ("#%p", p);
-        	}
-        }
-        printf ("\n");
-#endif
-
-        p->propagate ();
-      }
+      _sc->propagateFanout (off, 0);
     }
     return true;
   }
@@ -1424,11 +2894,9 @@ bool PrsSim::unmask (int lid)
 
 OnePrsSim* PrsSim::findRule (int vid) 
 {
-  listitem_t *li;
-
   // find the node which corresponds to the given global ID
-  for (li = list_first (_sim); li; li = list_next (li)) {
-    OnePrsSim *rule = (OnePrsSim *)list_value (li);
+  for (int i=0; i < _nrules; i++) {
+    OnePrsSim *rule = &_rules[i];
 
     if (rule->getMyLocalID() == vid) return rule;
     
@@ -1521,12 +2989,17 @@ void PrsSim::dumpState (FILE *fp)
   fprintf (fp, "FIXME: prs dump state!\n");
 }
 
-OnePrsSim::OnePrsSim (PrsSim *p, struct prssim_stmt *x)
+OnePrsSim::OnePrsSim (PrsSim *p, struct prssim_stmt *x, int idx, int gidx)
 {
   _proc = p;
   _me = x;
   _pending = NULL;
-  
+  _wpending = NULL;
+  _pending_tm = 0;
+  _ops = p->ruleOperands() ? p->ruleOperands() + gidx : NULL;
+  _idx = idx;
+  _sop = 0;
+  _dirty = 0;
 }
 
 void OnePrsSim::registerExcl ()
@@ -1556,8 +3029,8 @@ bool OnePrsSim::registerSEU (int start_delay, int upset_duration, int force_valu
 
   // we don't really need to do anything beyond creating the events
   // the constructor automatically inserts them into the event queue
-  new Event (this, SIM_EV_MKTYPE ((start_event), 0), start_delay);
-  new Event (this, SIM_EV_MKTYPE ((0b10100), 0), start_delay + upset_duration);
+  ActEvent::make (this, SIM_EV_MKTYPE ((start_event), 0), start_delay);
+  ActEvent::make (this, SIM_EV_MKTYPE ((0b10100), 0), start_delay + upset_duration);
 
   return true;
 }
@@ -1570,7 +3043,7 @@ bool OnePrsSim::registerSED (int start_delay, int delay_duration) {
 
   // we don't really need to do anything beyond creating the events
   // the constructor automatically inserts them into the event queue
-  new Event (this, SIM_EV_MKTYPE ((delay_event), 0), start_delay);
+  ActEvent::make (this, SIM_EV_MKTYPE ((delay_event), 0), start_delay);
 
   return true;
 }
@@ -1580,18 +3053,466 @@ bool OnePrsSim::registerSED (int start_delay, int delay_duration) {
 
 void PrsSim::registerExcl ()
 {
-  listitem_t *li;
-  for (li = list_first (_sim); li; li = list_next (li)) {
-    OnePrsSim *one = (OnePrsSim *) list_value (li);
-    one->registerExcl ();
+  for (int i=0; i < _nrules; i++) {
+    _rules[i].registerExcl ();
   }
 }
 
 
 void OnePrsSim::flushPending ()
 {
-  if (_pending) {
-    _pending->Remove ();
+  if (isPending()) {
+    _cancel ();
     flags = PENDING_NONE;
   }
 }
+
+/*
+  A rule is saved as the value of its pending transition, the
+  pending flags, and its position in the delta-cycle list (-1 if it
+  is not waiting for an evaluation), followed by the absolute time
+  at which the pending transition fires.
+*/
+void OnePrsSim::saveState (act_ckpt *ck)
+{
+  int v[3];
+  phash_bucket_t *b;
+
+  b = ck->dirty ? phash_lookup (ck->dirty, this) : NULL;
+  v[2] = b ? b->i : -1;
+  if (!isPending()) {
+    v[0] = -1;
+    v[1] = flags;
+    ckpt_put (ck, v, sizeof (v));
+    return;
+  }
+  if (_pending) {
+    v[0] = SIM_EV_TYPE (_pending->getType());
+  }
+  else {
+    v[0] = _wpending->type;
+  }
+  v[1] = flags;
+  ckpt_put (ck, v, sizeof (v));
+  ckpt_put_ulong (ck, _pending_tm);
+}
+
+void OnePrsSim::restoreState (act_ckpt *ck)
+{
+  int v[3];
+  unsigned long tm = 0;
+
+  ckpt_get (ck, v, sizeof (v));
+  if (v[0] != -1) {
+    tm = ckpt_get_ulong (ck);
+  }
+  if (v[0] < -1 || v[0] > 2 || v[1] < PENDING_NONE || v[1] > PENDING_X ||
+      v[2] < -1 || v[2] >= ck->ndirty) {
+    ckpt_error (ck, "corrupt production rule state");
+    return;
+  }
+  if (ck->dry) {
+    return;
+  }
+  if (v[2] != -1) {
+    ck->dirty_rule[v[2]] = this;
+  }
+  flushPending ();
+  flags = v[1];
+  if (v[0] == -1) {
+    return;
+  }
+  if (tm < ck->now) {
+    tm = ck->now;
+  }
+  _schedule (v[0], tm - ck->now);
+}
+
+void PrsSim::saveState (act_ckpt *ck)
+{
+  ckpt_put_int (ck, _nrules);
+  for (int i=0; i < _nrules; i++) {
+    _rules[i].saveState (ck);
+  }
+}
+
+void PrsSim::restoreState (act_ckpt *ck)
+{
+  if (ckpt_get_int (ck) != _nrules) {
+    ckpt_error (ck, "production rules do not match the design");
+    return;
+  }
+  for (int i=0; i < _nrules && !ck->err; i++) {
+    _rules[i].restoreState (ck);
+  }
+  if (ck->dry) {
+    return;
+  }
+  for (listitem_t *li = list_first (_cones); li; li = list_next (li)) {
+    ((PrsSimCone *) list_value (li))->resync ();
+  }
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Timing wheel for production rule events
+ *
+ *------------------------------------------------------------------------
+ */
+PrsSimWheel *OnePrsSim::_wheel = NULL;
+
+void OnePrsSim::useWheel ()
+{
+  if (!_wheel) {
+    _wheel = new PrsSimWheel ();
+  }
+}
+
+void OnePrsSim::flushWheel ()
+{
+  if (_wheel) {
+    _wheel->flush ();
+  }
+}
+
+PrsSimWheel::PrsSimWheel ()
+{
+  for (int i=0; i < PRSSIM_WHEEL_SIZE; i++) {
+    _hd[i] = NULL;
+    _tl[i] = NULL;
+  }
+  _armed = bitset_new (PRSSIM_WHEEL_SIZE);
+  _free = NULL;
+  _slabs = list_new ();
+}
+
+PrsSimWheel::~PrsSimWheel ()
+{
+  listitem_t *li;
+  for (li = list_first (_slabs); li; li = list_next (li)) {
+    prssim_wev *w = (prssim_wev *) list_value (li);
+    FREE (w);
+  }
+  list_free (_slabs);
+  bitset_free (_armed);
+}
+
+prssim_wev *PrsSimWheel::_alloc ()
+{
+  prssim_wev *w;
+  
+  if (!_free) {
+    MALLOC (w, prssim_wev, PRSSIM_WHEEL_SLAB);
+    list_append (_slabs, w);
+    for (int i=0; i < PRSSIM_WHEEL_SLAB; i++) {
+      w[i].next = _free;
+      _free = &w[i];
+    }
+  }
+  w = _free;
+  _free = w->next;
+  return w;
+}
+
+prssim_wev *PrsSimWheel::insert (OnePrsSim *obj, int type, int delay)
+{
+  prssim_wev *w;
+  int s;
+
+  if (delay < 0 || delay >= PRSSIM_WHEEL_SIZE) {
+    /* far future: leave it to the event heap */
+    return NULL;
+  }
+
+  /* the slot only depends on the low-order bits of the time, so this
+     is also fine once time no longer fits in 64 bits */
+  s = (CurTimeLo() + delay) & (PRSSIM_WHEEL_SIZE-1);
+
+  w = _alloc ();
+  w->obj = obj;
+  w->type = type;
+  w->kill = 0;
+  w->next = NULL;
+  if (_tl[s]) {
+    _tl[s]->next = w;
+  }
+  else {
+    _hd[s] = w;
+  }
+  _tl[s] = w;
+
+  if (!bitset_tst (_armed, s)) {
+    /* one heap event per occupied time slot */
+    bitset_set (_armed, s);
+    ActEvent::make (this, SIM_EV_MKTYPE (0, 0), delay);
+  }
+  return w;
+}
+
+void PrsSimWheel::flush ()
+{
+  for (int i=0; i < PRSSIM_WHEEL_SIZE; i++) {
+    for (prssim_wev *w = _hd[i]; w; w = w->next) {
+      if (!w->kill) {
+	w->obj->flushPending ();
+      }
+    }
+  }
+}
+
+int PrsSimWheel::Step (Event */*ev*/)
+{
+  int s = CurTimeLo() & (PRSSIM_WHEEL_SIZE-1);
+  int ret = 1;
+  prssim_wev *w;
+
+  /*
+    The slot stays armed while it is being drained, so zero-delay
+    events scheduled from here are picked up by this loop.
+  */
+  while (ret && (w = _hd[s])) {
+    _hd[s] = w->next;
+    if (!_hd[s]) {
+      _tl[s] = NULL;
+    }
+    if (!w->kill) {
+      ret = w->obj->wheelStep (w);
+    }
+    w->next = _free;
+    _free = w;
+  }
+
+  if (_hd[s]) {
+    /* stopped at a breakpoint; the rest of the slot runs next */
+    ActEvent::make (this, SIM_EV_MKTYPE (0, 0), 0);
+  }
+  else {
+    bitset_clr (_armed, s);
+  }
+  return ret;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Delta-cycle evaluation of production rules
+ *
+ *------------------------------------------------------------------------
+ */
+PrsSimDelta *OnePrsSim::_delta = NULL;
+
+void OnePrsSim::useDelta ()
+{
+  if (!_delta) {
+    _delta = new PrsSimDelta ();
+  }
+}
+
+void OnePrsSim::flushDelta ()
+{
+  if (_delta) {
+    _delta->flush ();
+  }
+}
+
+int OnePrsSim::deltaPending (struct pHashtable *H)
+{
+  if (!_delta) {
+    return 0;
+  }
+  for (int i=0; i < _delta->nDirty(); i++) {
+    phash_bucket_t *b = phash_add (H, _delta->getDirty (i));
+    b->i = i;
+  }
+  return _delta->nDirty ();
+}
+
+int OnePrsSim::deltaStats (unsigned long *nreq, unsigned long *neval)
+{
+  if (!_delta) {
+    return 0;
+  }
+  *nreq = _delta->nReq ();
+  *neval = _delta->nEval ();
+  return 1;
+}
+
+PrsSimDelta::PrsSimDelta ()
+{
+  A_INIT (_cur);
+  A_INIT (_run);
+  _nreq = 0;
+  _neval = 0;
+}
+
+PrsSimDelta::~PrsSimDelta ()
+{
+  A_FREE (_cur);
+  A_FREE (_run);
+}
+
+void PrsSimDelta::mark (OnePrsSim *obj)
+{
+  _nreq++;
+  if (obj->_dirty) {
+    return;
+  }
+  obj->_dirty = 1;
+  if (A_LEN (_cur) == 0) {
+    /* first dirty rule in this delta cycle */
+    ActEvent::make (this, SIM_EV_MKTYPE (0, 0), 0);
+  }
+  A_NEW (_cur, OnePrsSim *);
+  A_NEXT (_cur) = obj;
+  A_INC (_cur);
+}
+
+void PrsSimDelta::flush ()
+{
+  /* the pending event finds an empty list and does nothing */
+  for (int i=0; i < A_LEN (_cur); i++) {
+    _cur[i]->_dirty = 0;
+  }
+  A_LEN_RAW (_cur) = 0;
+}
+
+int PrsSimDelta::Step (Event */*ev*/)
+{
+  OnePrsSim **tmp;
+  int tmax;
+
+  /* swap lists: rules marked from here on belong to the next delta */
+  tmp = _run;
+  _run = _cur;
+  _cur = tmp;
+  tmax = _run_max;
+  _run_max = _cur_max;
+  _cur_max = tmax;
+  A_LEN_RAW (_run) = A_LEN (_cur);
+  A_LEN_RAW (_cur) = 0;
+
+  for (int i=0; i < A_LEN (_run); i++) {
+    _run[i]->_dirty = 0;
+  }
+  for (int i=0; i < A_LEN (_run); i++) {
+    _neval++;
+    _run[i]->_propagate ();
+  }
+  A_LEN_RAW (_run) = 0;
+  return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Levelized combinational cones
+ *
+ *------------------------------------------------------------------------
+ */
+PrsSimCone::PrsSimCone (PrsSim *p, prssim_cone *c, OnePrsSim **rules)
+{
+  _proc = p;
+  _c = c;
+  _r = rules;
+  _busy = 0;
+  MALLOC (_arr, int, c->nr);
+  for (int i=0; i < c->nr; i++) {
+    _arr[i] = 0;
+  }
+  _last = NULL;
+  _chg = NULL;
+  if (c->nops > 0) {
+    MALLOC (_last, unsigned char, c->nops);
+    MALLOC (_chg, unsigned char, c->nops);
+  }
+  resync ();
+}
+
+PrsSimCone::~PrsSimCone ()
+{
+  FREE (_r);
+  FREE (_arr);
+  if (_last) {
+    FREE (_last);
+    FREE (_chg);
+  }
+}
+
+int PrsSimCone::Step (Event */*ev*/)
+{
+  fatal_error ("This should never be called!");
+  return 1;
+}
+
+void PrsSimCone::resync ()
+{
+  for (int j=0; j < _c->nops; j++) {
+    _last[j] = _proc->getBool (_c->ops[j]);
+  }
+}
+
+/*
+  Evaluate the rules in level order, skipping those whose operands
+  did not change. Internal outputs are set right away; the rest are
+  handed to the rule, delayed by the longest changed path into it.
+  Whether an output is internal is checked on every evaluation, as
+  watchpoints and traces can be added at any time.
+*/
+void PrsSimCone::propagate ()
+{
+  if (_busy) {
+    /* an internal output set below */
+    return;
+  }
+  _busy = 1;
+
+  for (int j=0; j < _c->nops; j++) {
+    int v = _proc->getBool (_c->ops[j]);
+    _chg[j] = (v != _last[j]);
+    _last[j] = v;
+  }
+
+  for (int i=0; i < _c->nr; i++) {
+    prssim_stmt *s = _c->r[i];
+    const int *oi = _c->opidx[i];
+    int dirty = 0;
+    int arr = 0;
+
+    for (int k=0; k < s->nvars; k++) {
+      int j = oi[k];
+      if (_chg[j]) {
+	dirty = 1;
+	if (_c->drv[j] >= 0 && _arr[_c->drv[j]] > arr) {
+	  arr = _arr[_c->drv[j]];
+	}
+      }
+    }
+    if (!dirty) {
+      continue;
+    }
+    if (_c->internal[i] && _proc->soleReader (s->vid, this)) {
+      int v = _r[i]->combValue ();
+      if (v != -1 && v != _proc->getBool (s->vid)) {
+	if (v == 2) {
+	  _arr[i] = arr + 1;
+	}
+	else if (v == 1) {
+	  _arr[i] = arr + _proc->getDelay (s->delay_dn, s->delay_dn_max);
+	}
+	else {
+	  _arr[i] = arr + _proc->getDelay (s->delay_up, s->delay_up_max);
+	}
+	_proc->setBool (s->vid, v);
+	_chg[_c->outidx[i]] = 1;
+	_last[_c->outidx[i]] = v;
+      }
+    }
+    else {
+      /* the transition is an event, so it carries the delay */
+      _arr[i] = 0;
+      _r[i]->propagateDelayed (arr);
+    }
+  }
+  _busy = 0;
+}
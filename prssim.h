@@ -56,34 +56,135 @@ struct prssim_expr {
 #define PRSSIM_NORM 0
 #define PRSSIM_WEAK 1
 
+/*
+ * Compiled form of a pull-up/pull-down network: a postfix program
+ * evaluated on a small value stack. PRSSIM_OP_VAR pushes the next
+ * operand; operands are numbered in order of use, and the table
+ * that maps them to global node offsets is per instance.
+ */
+#define PRSSIM_OP_VAR   0
+#define PRSSIM_OP_AND   1
+#define PRSSIM_OP_OR    2
+#define PRSSIM_OP_NOT   3
+#define PRSSIM_OP_TRUE  4
+#define PRSSIM_OP_FALSE 5
+
+/*
+ * Children of AND/OR are emitted deepest first, so the stack depth is
+ * bounded by log2(#leaves)+1.
+ */
+#define PRSSIM_MAX_STACK 32
+
+/* index into prssim_stmt::code[] */
+#define PRSSIM_UP(w) (w)
+#define PRSSIM_DN(w) (2+(w))
+
+/*
+ * Compiled rule evaluator (sim.prs.jit): returns the value of network
+ * PRSSIM_UP/PRSSIM_DN(w) given the value and X planes and the global
+ * offsets of the rule operands.
+ */
+typedef int (*prssim_jitfn) (const unsigned long *, const unsigned long *,
+			     const int *, int);
+
+struct prssim_code {
+  unsigned char *op;		/* postfix program */
+  int nops;			/* # of opcodes; 0 means constant false */
+  int vbase;			/* first operand slot for this program */
+};
+
+/*
+ * A network in flat sum-of-products form (sim.prs.sop_count). Term i
+ * is the AND of literals lit[tstart[i]] ... lit[tstart[i+1]-1]; a
+ * literal is 2*slot+1 for an operand slot, 2*slot for its negation.
+ */
+struct prssim_sopcode {
+  int nterms;
+  int *tstart;			/* nterms + 1 entries */
+  int *lit;
+};
+
+/*
+ * Per-instance counters for a prssim_sopcode. A term is false if
+ * nfalse > 0, X if nx > 0, and true otherwise; the network is true
+ * if ntrue > 0, X if nx > 0, and false otherwise.
+ */
+struct prssim_sopterm {
+  int nfalse, nx;
+};
+
+struct prssim_sopnet {
+  int nterms;
+  int ntrue, nx;
+  prssim_sopterm *t;		/* NULL if not counted */
+};
+
 struct prssim_stmt {
   unsigned int type:2; /* RULE, P, N, TRANSGATE */
   unsigned int unstab:1; /* is unstable? */
+  unsigned int incone:1; /* evaluated by a prssim_cone */
   struct prssim_stmt *next;
   int delay_up, delay_dn;
   int delay_up_max, delay_dn_max; /* used when delay for a node is random, then delay_up/down are used for minimum delay */
   int delay_override_length; /* The next event has a manually overridden delay */
+  prssim_jitfn jit;		/* compiled evaluator, if any */
 
   union {
     struct {
       prssim_expr *up[2], *dn[2];
       int vid;
       act_connection *c;
+
+      /* compiled up[], dn[]; see PRSSIM_UP/PRSSIM_DN */
+      struct prssim_code code[4];
+      int nvars;		/* # of operand slots */
+      int *vids;		/* local id for each operand slot */
+      prssim_sopcode *sop[4];	/* wide SOP networks, or NULL */
     };
     struct {
       int t1, t2, g, _g;
     };
   };
 };
-  
+
+
+/*
+ * Combinational cone (sim.prs.levelize): an acyclic group of rules
+ * whose pull-up and pull-down are complements, in level order. A
+ * cone is evaluated as one block when any of its operands changes.
+ * Local rule outputs only read inside the cone may be internal: in an
+ * instance where the cone is the only reader of the node and it is
+ * not watched, traced, or a breakpoint, the output is updated as soon
+ * as the cone is evaluated. The other outputs are scheduled after the
+ * sum of the gate delays along the path that changed them.
+ */
+struct prssim_cone {
+  int nr;			/* # of rules */
+  prssim_stmt **r;		/* rules, in level order */
+  unsigned char *internal;	/* 1 if the output may be internal */
+  int nops;			/* # of distinct operand nodes */
+  int *ops;			/* local id of each operand node */
+  int *drv;			/* rule driving each operand node, or -1 */
+  int *outidx;			/* ops[] index of each rule output, or -1 */
+  int **opidx;			/* per rule: operand slot -> ops[] index */
+  struct prssim_cone *next;
+};
 
 class PrsSimGraph {
 private:
   struct prssim_stmt *_rules, *_tail;
   struct Hashtable *_labels;
 
+  int _nvars;			/* total operand slots over all rules */
+  struct prssim_cone *_cones;	/* levelized combinational cones */
+  void *_jit_lib;		/* dlopen() handle for compiled rules */
+
   void _add_one_rule (ActSimCore *, act_prs_lang_t *);
   void _add_one_gate (ActSimCore *, act_prs_lang_t *);
+  void _compile ();
+  void _levelize ();
+  void _sopify (int minlits);
+  void _jit ();
   
 public:
   PrsSimGraph();
@@ -92,6 +193,8 @@ public:
   void addPrs (ActSimCore *, act_prs_lang_t *);
 
   prssim_stmt *getRules () { return _rules; }
+  int numOperands () { return _nvars; }
+  prssim_cone *getCones () { return _cones; }
 
 
   static PrsSimGraph *buildPrsSimGraph (ActSimCore *, act_prs *);
@@ -112,12 +215,29 @@ class PrsSim : public ActSimObj {
 
   void computeFanout ();
 
+  void saveState (act_ckpt *ck);
+  void restoreState (act_ckpt *ck);
+
   int getBool (int lid) { int off = getGlobalOffset (lid, 0); return _sc->getBool (off); }
   int isSpecialBool (int lid) { int off = getGlobalOffset (lid, 0); return _sc->isSpecialBool (off); }
 
   bool isHazard (int lid) { int off = getGlobalOffset (lid, 0); return _sc->isHazard (off); }
   
   int myGid (int lid) { return getGlobalOffset (lid, 0); }
+  int getGlobalBool (int off) { return _sc->getBool (off); }
+
+  /* 1 if who is the only object that reads the node, and nothing
+     is watching it */
+  int soleReader (int lid, SimDES *who) {
+    int off = getGlobalOffset (lid, 0);
+    SimDES **fo;
+    int n;
+    if (_sc->isObserved (0, off)) {
+      return 0;
+    }
+    fo = _sc->getFanout (off, 0, &n);
+    return n == 1 && fo[0] == who;
+  }
 
 
   /**
@@ -189,29 +309,71 @@ class PrsSim : public ActSimObj {
   void printStatus (int val, bool io_glob = false);
 
   void registerExcl ();
+
+  /* rule objects, one per rule of the graph, in order */
+  int numRules () { return _nrules; }
+  inline OnePrsSim *getRule (int i);
+
+  int *ruleOperands () { return _gids; }
+  prssim_sopnet *sopNets (int i) { return _sopn ? _sopn[i] : NULL; }
+
+  /* # of rule objects and bytes used for them over all instances */
+  static void memStats (unsigned long *ngates, unsigned long *state,
+			unsigned long *ops, unsigned long *sop);
   
  private:
   void _computeFanout (prssim_expr *, SimDES *);
+  void _computeCones ();
+  void _addSop (int, prssim_stmt *, int *);
   
   void varSet (int id, int type, BigInt &v);
   int varSend (int pc, int wakeup, int id, BigInt &v);
   int varRecv (int pc, int wakeup, int id, BigInt *v);
 
   PrsSimGraph *_g;
-  list_t *_sim;			// simulation objects
+  int _nrules;
+  OnePrsSim *_rules;		// rule objects, contiguous
+  prssim_sopnet **_sopn;	// per rule: counted networks (4), or NULL
+  unsigned long _sopbytes;
+  list_t *_cones;		// PrsSimCone objects
+  int *_gids;			// resolved operands for all rules
+
+  static unsigned long _mem_gates, _mem_state, _mem_ops, _mem_sop;
 };
 
 
+struct prssim_wev;
+class PrsSimWheel;
+class PrsSimDelta;
+
 /*-- not actsimobj so that it can be lightweight --*/
 class OnePrsSim : public ActSimDES {
 private:
+  unsigned int _idx:30;		// rule number within _proc
+  unsigned int _sop:1;		// has counted SOP networks
+  unsigned int _dirty:1;	// queued for a delta-cycle evaluation
   PrsSim *_proc;		// process core [maps, etc]
   struct prssim_stmt *_me;	// the rule
+  const int *_ops;		// resolved operands, in _proc's table
   Event *_pending;
-  int eval (prssim_expr *);
+  prssim_wev *_wpending;	// pending event in the timing wheel
+  unsigned long _pending_tm;	// time at which the pending event fires
+  int eval (const prssim_code *);
+  void _schedule (int val, int delay);
+  void _cancel ();
+  int _step (int t);
+  void _propagate ();
+
+  static int _xdelay;		// extra delay for transitions from a cone
+
+  static PrsSimWheel *_wheel;	// non-NULL if the timing wheel is used
+  static PrsSimDelta *_delta;	// non-NULL in delta-cycle mode
+  static const unsigned long *_jpv, *_jpx; // state planes for compiled rules
+
+  friend class PrsSimDelta;
 
 public:
-  OnePrsSim (PrsSim *p, struct prssim_stmt *x);
+  OnePrsSim (PrsSim *p, struct prssim_stmt *x, int idx, int gidx = 0);
 
 
   /**
@@ -236,6 +398,12 @@ public:
    */
   void propagate ();
 
+  /**
+   * @brief Propagate to a list of fanout destinations that are all
+   * OnePrsSim objects, without virtual dispatch.
+   */
+  static void propagateAll (SimDES **arr, int n);
+
 
   /**
    * @brief Set the node to a given value. 
@@ -256,10 +424,56 @@ public:
   
   void printName ();
   inline int getMyLocalID () { return _me->vid; };
+  PrsSim *getPrs () { return _proc; }
+  struct prssim_stmt *getStmt () { return _me; }
+  const int *getOperands () { return _ops; }
+
+  /* the rule has counted SOP networks in _proc */
+  void useSop () { _sop = 1; }
+
+  /* global offset of the node driven by this rule/gate */
+  int getOutput () {
+    return _proc->myGid (_me->type == PRSSIM_RULE ? _me->vid : _me->t2);
+  }
   int matches (int val);
   void registerExcl ();
   void flushPending ();
-  int isPending() { return _pending == NULL ? 0 : 1; }
+  void saveState (act_ckpt *ck);
+  void restoreState (act_ckpt *ck);
+  int isPending() { return (_pending == NULL && _wpending == NULL) ? 0 : 1; }
+  int isPendingEvent (Event *e) { return (e == _pending) ? 1 : 0; }
+
+  /* run a transition dispatched from the timing wheel */
+  int wheelStep (prssim_wev *w);
+
+  /* new output value of a combinational rule, or -1 for no change;
+     issues the same warnings as propagate() */
+  int combValue ();
+
+  /* propagate, with transitions delayed by an additional amount */
+  void propagateDelayed (int extra);
+
+  /* schedule near-term transitions on a timing wheel */
+  static void useWheel ();
+
+  /* cancel all transitions held in the timing wheel */
+  static void flushWheel ();
+
+  /* evaluate each rule at most once per delta cycle */
+  static void useDelta ();
+
+  /* evaluate rules with compiled code reading the state planes */
+  static void useJit (ActSimState *st);
+
+  /* drop all rules waiting for a delta-cycle evaluation */
+  static void flushDelta ();
+
+  /* map each rule waiting for a delta-cycle evaluation to its
+     position in the list; returns the length of the list */
+  static int deltaPending (struct pHashtable *H);
+
+  /* delta-cycle counters; returns 0 if delta-cycle mode is off */
+  static int deltaStats (unsigned long *nreq, unsigned long *neval);
 
   /**
   * @brief Create and register SEU start and end events and put them into the event queue
@@ -285,5 +499,172 @@ public:
 
 };
 
+inline OnePrsSim *PrsSim::getRule (int i) { return &_rules[i]; }
+
+
+/*
+ * Timing wheel for production rule transitions (sim.prs.timing_wheel).
+ *
+ * Transitions due fewer than PRSSIM_WHEEL_SIZE time units ahead are
+ * queued in the slot for their firing time, and a single SimDES event
+ * is scheduled per occupied slot instead of one per transition. Later
+ * transitions overflow to the SimDES event heap. Queue entries come
+ * from a freelist refilled a slab at a time; cancelled entries are
+ * marked and dropped when their slot is drained.
+ */
+#define PRSSIM_WHEEL_BITS 10
+#define PRSSIM_WHEEL_SIZE (1 << PRSSIM_WHEEL_BITS)
+#define PRSSIM_WHEEL_SLAB 1024
+
+struct prssim_wev {
+  OnePrsSim *obj;
+  struct prssim_wev *next;
+  unsigned int type:31;
+  unsigned int kill:1;
+};
+
+class PrsSimWheel : public SimDES {
+public:
+  PrsSimWheel ();
+  ~PrsSimWheel ();
+
+  /* returns NULL if the transition should go on the event heap */
+  prssim_wev *insert (OnePrsSim *obj, int type, int delay);
+
+  /* cancel every queued transition */
+  void flush ();
+
+  int Step (Event *ev);
+
+private:
+  prssim_wev *_hd[PRSSIM_WHEEL_SIZE], *_tl[PRSSIM_WHEEL_SIZE];
+  bitset_t *_armed;		// slot has a pending SimDES event
+  prssim_wev *_free;		// freelist
+  list_t *_slabs;		// allocated slabs
+
+  prssim_wev *_alloc ();
+};
+
+
+/*
+ * Delta-cycle evaluation of production rules (sim.prs.delta_cycle).
+ *
+ * A fanout change only marks the rule dirty. All rules marked in the
+ * same time step are evaluated once, from a single zero-delay SimDES
+ * event, so a gate whose inputs change together is evaluated once
+ * against the final input values. Rules marked while the list is
+ * being evaluated form the next delta cycle.
+ */
+class PrsSimDelta : public SimDES {
+public:
+  PrsSimDelta ();
+  ~PrsSimDelta ();
+
+  void mark (OnePrsSim *obj);
+  void flush ();
+
+  int Step (Event *ev);
+
+  unsigned long nReq () { return _nreq; }
+  unsigned long nEval () { return _neval; }
+
+  int nDirty () { return A_LEN (_cur); }
+  OnePrsSim *getDirty (int i) { return _cur[i]; }
+
+private:
+  A_DECL (OnePrsSim *, _cur);	// rules dirty in this delta cycle
+  A_DECL (OnePrsSim *, _run);	// list being evaluated
+  unsigned long _nreq;		// propagate requests
+  unsigned long _neval;		// rule evaluations
+};
+
+
+
+/*
+ * One instance of a prssim_cone.
+ */
+class PrsSimCone : public ActSimDES {
+public:
+  PrsSimCone (PrsSim *p, prssim_cone *c, OnePrsSim **rules);
+  ~PrsSimCone ();
+
+  int Step (Event *ev);
+  void propagate ();
+
+  /* re-read the operand values, e.g. after a checkpoint restore */
+  void resync ();
+
+private:
+  PrsSim *_proc;
+  prssim_cone *_c;
+  OnePrsSim **_r;		// per rule
+  int *_arr;			// per rule: delay along the changed path
+  unsigned char *_last;		// per operand: value at the last evaluation
+  unsigned char *_chg;		// per operand: changed in this evaluation
+  int _busy;
+};
+
+
+/*
+ * Counting evaluation of wide sum-of-products networks
+ * (sim.prs.sop_count). Each node lists the (network, term) pairs it
+ * is a literal of; a value change adjusts the false/X count of those
+ * terms and the true/X term count of their networks, so evaluating
+ * a counted network is a single lookup however wide it is.
+ */
+struct prssim_sopref {
+  prssim_sopnet *net;
+  int term;
+  int pol;			// 1 for a positive literal
+};
+
+class PrsSopIndex {
+public:
+  PrsSopIndex (int minlits);
+  ~PrsSopIndex ();
+
+  /* networks with fewer literals are left to the regular evaluator */
+  int minLiterals () { return _min; }
+
+  void addNet (prssim_sopnet *n);
+  void add (int off, prssim_sopnet *n, int term, int pol);
+
+  /* build the per-node index once all networks have been added, and
+     initialize the counters from the current state */
+  void build (ActSimCore *sc);
+
+  /* recompute all counters from the current state */
+  void resync (ActSimCore *sc);
+
+  /* node off changed from oval to nval */
+  void update (int off, int oval, int nval) {
+    if (off < _noff) {
+      for (int i=_start[off]; i < _start[off+1]; i++) {
+	_update (&_ref[i], oval, nval);
+      }
+    }
+  }
+
+  int numNets () { return A_LEN (_nets); }
+  int numRefs () { return _nref; }
+
+private:
+  int _min;
+  A_DECL (prssim_sopnet *, _nets);
+
+  struct pending {
+    int off;
+    prssim_sopref r;
+  };
+  A_DECL (struct pending, _pend);
+
+  int _noff;			// # of nodes in the index
+  int *_start;			// CSR offsets into _ref, _noff + 1 entries
+  int _nref;
+  prssim_sopref *_ref;
+
+  void _update (prssim_sopref *r, int oval, int nval);
+};
+
 
 #endif /* __ACT_CHP_SIM_H__ */
@@ -31,18 +31,80 @@
 #define FLAG_M1 4
 #define FLAG_MX 5
 
-ActSimState::ActSimState (int bools, int ints, int chantot)
+/* bit-plane layout: value and X planes, plus the cold flags */
+#define PLANE_W (8*sizeof (unsigned long))
+#define COLD_W 4
+
+inline int ActSimState::_tst (int x, int f)
+{
+  if (_planes) {
+    if (f == FLAG_1) {
+      return (_pv[x/PLANE_W] >> (x % PLANE_W)) & 1;
+    }
+    else if (f == FLAG_X) {
+      return (_px[x/PLANE_W] >> (x % PLANE_W)) & 1;
+    }
+  }
+  return bitset_tst (bits, _fl (x, f)) ? 1 : 0;
+}
+
+inline void ActSimState::_set (int x, int f)
+{
+  if (_planes) {
+    if (f == FLAG_1) {
+      _pv[x/PLANE_W] |= (1UL << (x % PLANE_W));
+      return;
+    }
+    else if (f == FLAG_X) {
+      _px[x/PLANE_W] |= (1UL << (x % PLANE_W));
+      return;
+    }
+  }
+  bitset_set (bits, _fl (x, f));
+}
+
+inline void ActSimState::_clr (int x, int f)
+{
+  if (_planes) {
+    if (f == FLAG_1) {
+      _pv[x/PLANE_W] &= ~(1UL << (x % PLANE_W));
+      return;
+    }
+    else if (f == FLAG_X) {
+      _px[x/PLANE_W] &= ~(1UL << (x % PLANE_W));
+      return;
+    }
+  }
+  bitset_clr (bits, _fl (x, f));
+}
+
+ActSimState::ActSimState (int bools, int ints, int chantot, int planes)
 {
 #if 0
   printf ("# bools=%d, ints=%d, chans=%d\n",
 	  bools, ints, chantot);
 #endif
   nbools = bools;
+  _planes = planes ? 1 : 0;
+  _pv = NULL;
+  _px = NULL;
   
   if (bools > 0) {
-    bits = bitset_new (bools * ENTRY_W);
-    for (int i=0; i < bools; i++) {
-      bitset_set (bits, ENTRY_W * i + FLAG_X);
+    if (_planes) {
+      int nw = (bools + PLANE_W - 1)/PLANE_W;
+      bits = bitset_new (bools * COLD_W);
+      MALLOC (_pv, unsigned long, nw);
+      MALLOC (_px, unsigned long, nw);
+      for (int i=0; i < nw; i++) {
+	_pv[i] = 0;
+	_px[i] = ~0UL;
+      }
+    }
+    else {
+      bits = bitset_new (bools * ENTRY_W);
+      for (int i=0; i < bools; i++) {
+	bitset_set (bits, ENTRY_W * i + FLAG_X);
+      }
     }
   }
   else {
@@ -81,6 +143,10 @@ ActSimState::~ActSimState()
   if (bits) {
     bitset_free (bits);
   }
+  if (_pv) {
+    FREE (_pv);
+    FREE (_px);
+  }
   if (ival) {
     FREE (ival);
   }
@@ -120,6 +186,14 @@ act_channel_state *ActSimState::getChan (int x)
 
 int ActSimState::getBool (int x)
 {
+  if (_planes) {
+    unsigned long m = 1UL << (x % PLANE_W);
+    if (_px[x/PLANE_W] & m) {
+      /* X */
+      return 2;
+    }
+    return (_pv[x/PLANE_W] & m) ? 1 : 0;
+  }
   if (bitset_tst (bits, ENTRY_W * x + FLAG_X)) {
     /* X */
     return 2;
@@ -132,6 +206,37 @@ int ActSimState::getBool (int x)
   }
 }
 
+int ActSimState::countBools (int v)
+{
+  int n = 0;
+  if (!_planes) {
+    for (int i=0; i < nbools; i++) {
+      if (getBool (i) == v) {
+	n++;
+      }
+    }
+    return n;
+  }
+  int nw = (nbools + PLANE_W - 1)/PLANE_W;
+  for (int i=0; i < nw; i++) {
+    unsigned long w;
+    if (v == 2) {
+      w = _px[i];
+    }
+    else if (v == 1) {
+      w = _pv[i] & ~_px[i];
+    }
+    else {
+      w = ~_pv[i] & ~_px[i];
+    }
+    if (i == nw-1 && (nbools % PLANE_W) != 0) {
+      w &= (1UL << (nbools % PLANE_W)) - 1;
+    }
+    n += __builtin_popcountl (w);
+  }
+  return n;
+}
+
 bool ActSimState::setBool (int x, int v)
 {
   int special = 0;
@@ -155,30 +260,30 @@ bool ActSimState::setBool (int x, int v)
   // only update the masked value
   if (isMasked (x)) {
     if (v == 1) {
-      bitset_set (bits, ENTRY_W * x + FLAG_M1);
-      bitset_clr (bits, ENTRY_W * x + FLAG_MX);
+      _set (x, FLAG_M1);
+      _clr (x, FLAG_MX);
     }
     else if (v == 0) {
-      bitset_clr (bits, ENTRY_W * x + FLAG_M1);
-      bitset_clr (bits, ENTRY_W * x + FLAG_MX);
+      _clr (x, FLAG_M1);
+      _clr (x, FLAG_MX);
     }
     else {
-      bitset_set (bits, ENTRY_W * x + FLAG_MX);
+      _set (x, FLAG_MX);
     }
     return true;
   }
 
   // nothing is masked and all is ok, change the observable value
   if (v == 1) {
-    bitset_set (bits, ENTRY_W * x + FLAG_1);
-    bitset_clr (bits, ENTRY_W * x + FLAG_X);
+    _set (x, FLAG_1);
+    _clr (x, FLAG_X);
   }
   else if (v == 0) {
-    bitset_clr (bits, ENTRY_W * x + FLAG_1);
-    bitset_clr (bits, ENTRY_W * x + FLAG_X);
+    _clr (x, FLAG_1);
+    _clr (x, FLAG_X);
   }
   else {
-    bitset_set (bits, ENTRY_W * x + FLAG_X);
+    _set (x, FLAG_X);
   }
   return true;
 }
@@ -188,29 +293,29 @@ void ActSimState::setForced (int x, int v)
   // if the exhibited value was not already hidden,
   // read the current value of the node and store it in the hidden value cache
   if (!isMasked (x)) {
-    if (bitset_tst (bits, ENTRY_W * x + FLAG_X)) {
+    if (_tst (x, FLAG_X)) {
       /* X */
-      bitset_set (bits, ENTRY_W * x + FLAG_MX);
+      _set (x, FLAG_MX);
     }
-    if (bitset_tst (bits, ENTRY_W * x + FLAG_1)) {
-      bitset_set (bits, ENTRY_W * x + FLAG_M1);
+    if (_tst (x, FLAG_1)) {
+      _set (x, FLAG_M1);
     }
   }
 
   // set the forced flag for the node
-  bitset_set (bits, ENTRY_W * x + FLAG_MASK);
+  _set (x, FLAG_MASK);
 
   // change the presented bit to be the forced value
   if (v == 1) {
-    bitset_set (bits, ENTRY_W * x + FLAG_1);
-    bitset_clr (bits, ENTRY_W * x + FLAG_X);
+    _set (x, FLAG_1);
+    _clr (x, FLAG_X);
   }
   else if (v == 0) {
-    bitset_clr (bits, ENTRY_W * x + FLAG_1);
-    bitset_clr (bits, ENTRY_W * x + FLAG_X);
+    _clr (x, FLAG_1);
+    _clr (x, FLAG_X);
   }
   else {
-    bitset_set (bits, ENTRY_W * x + FLAG_X);
+    _set (x, FLAG_X);
   }
 
 }
@@ -219,24 +324,24 @@ bool ActSimState::unmask (int x) {
   if (!isMasked (x)) return false;
 
   // restore the exhibited value from the hidden value cache
-  if (bitset_tst (bits, ENTRY_W * x + FLAG_M1)) {
-    bitset_set (bits, ENTRY_W * x + FLAG_1);
-    bitset_clr (bits, ENTRY_W * x + FLAG_M1);
+  if (_tst (x, FLAG_M1)) {
+    _set (x, FLAG_1);
+    _clr (x, FLAG_M1);
   }
   else {
-    bitset_clr (bits, ENTRY_W * x + FLAG_1);
+    _clr (x, FLAG_1);
   }
 
-  if (bitset_tst (bits, ENTRY_W * x + FLAG_MX)) {
-    bitset_set (bits, ENTRY_W * x + FLAG_X);
-    bitset_clr (bits, ENTRY_W * x + FLAG_MX);
+  if (_tst (x, FLAG_MX)) {
+    _set (x, FLAG_X);
+    _clr (x, FLAG_MX);
   }
   else {
-    bitset_clr (bits, ENTRY_W * x + FLAG_X);
+    _clr (x, FLAG_X);
   }
 
   // clear the masked flag from node
-  bitset_clr (bits, ENTRY_W * x + FLAG_MASK);
+  _clr (x, FLAG_MASK);
 
   return true;
 }
@@ -313,11 +418,7 @@ void expr_multires::_init (Data *d)
 {
   if (!d) return;
   _d = d;
-  nvals = _count (d);
-  MALLOC (v, BigInt, nvals);
-  for (int i=0; i < nvals; i++) {
-    new (&v[i]) BigInt;
-  }
+  _alloc (_count (d));
   int pos = 0;
   _init_helper (d, &pos);
   Assert (pos == nvals, "What?");
@@ -381,7 +482,11 @@ BigInt *expr_multires::getField (ActId *x)
 void expr_multires::setField (ActId *x, BigInt *val)
 {
   Assert (x, "setField with scalar called with NULL ID value");
-  int off = _d->getStructOffset (x, NULL);
+  setField (_d->getStructOffset (x, NULL), val);
+}
+
+void expr_multires::setField (int off, BigInt *val)
+{
   Assert (0 <= off && off < nvals, "Hmm");
 
   int w = v[off].getWidth();
@@ -398,14 +503,22 @@ void expr_multires::setField (ActId *x, expr_multires *m)
     *this = *m;
   }
   else {
-    int off = _d->getStructOffset (x, NULL);
-    Assert (0 <= off && off < nvals, "Hmm");
-    Assert (off + m->nvals <= nvals, "What?");
-    for (int i=0; i < m->nvals; i++) {
-      int w = v[off + i].getWidth ();
-      v[off + i] = m->v[i];
-      v[off + i].setWidth (w);
-    }
+    setField (_d->getStructOffset (x, NULL), m);
+  }
+}
+
+void expr_multires::setField (int off, expr_multires *m)
+{
+  if (off == -1) {
+    *this = *m;
+    return;
+  }
+  Assert (0 <= off && off < nvals, "Hmm");
+  Assert (off + m->nvals <= nvals, "What?");
+  for (int i=0; i < m->nvals; i++) {
+    int w = v[off + i].getWidth ();
+    v[off + i] = m->v[i];
+    v[off + i].setWidth (w);
   }
 }
 
@@ -447,3 +560,267 @@ expr_multires expr_multires::getStruct (ActId *x)
 
   return m;
 }
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Checkpoint stream
+ *
+ *------------------------------------------------------------------------
+ */
+void ckpt_put (act_ckpt *ck, const void *p, size_t sz)
+{
+  if (ck->err) {
+    return;
+  }
+  if (fwrite (p, 1, sz, ck->fp) != sz) {
+    ckpt_error (ck, "write failed");
+  }
+}
+
+void ckpt_get (act_ckpt *ck, void *p, size_t sz)
+{
+  if (ck->err || ck->pos + sz > ck->len) {
+    ckpt_error (ck, "unexpected end of file");
+    memset (p, 0, sz);
+    return;
+  }
+  memcpy (p, ck->buf + ck->pos, sz);
+  ck->pos += sz;
+}
+
+void ckpt_error (act_ckpt *ck, const char *msg)
+{
+  if (!ck->err) {
+    fprintf (stderr, "Checkpoint: %s\n", msg);
+    ck->err = 1;
+  }
+}
+
+void ckpt_put_int (act_ckpt *ck, int v)
+{
+  ckpt_put (ck, &v, sizeof (int));
+}
+
+int ckpt_get_int (act_ckpt *ck)
+{
+  int v;
+  ckpt_get (ck, &v, sizeof (int));
+  return v;
+}
+
+void ckpt_put_ulong (act_ckpt *ck, unsigned long v)
+{
+  ckpt_put (ck, &v, sizeof (unsigned long));
+}
+
+unsigned long ckpt_get_ulong (act_ckpt *ck)
+{
+  unsigned long v;
+  ckpt_get (ck, &v, sizeof (unsigned long));
+  return v;
+}
+
+void ckpt_put_bigint (act_ckpt *ck, BigInt *v)
+{
+  int len = v->getLen ();
+  ckpt_put_int (ck, v->getWidth ());
+  ckpt_put_int (ck, len);
+  for (int i=0; i < len; i++) {
+    ckpt_put_ulong (ck, v->getVal (i));
+  }
+}
+
+void ckpt_get_bigint (act_ckpt *ck, BigInt *v)
+{
+  int w, len;
+  w = ckpt_get_int (ck);
+  len = ckpt_get_int (ck);
+  if (w < 0 || len < 0 ||
+      (size_t)len > (ck->len - ck->pos)/sizeof (unsigned long)) {
+    ckpt_error (ck, "corrupt integer value");
+    return;
+  }
+  if (ck->dry) {
+    ck->pos += len*sizeof (unsigned long);
+    return;
+  }
+  v->setWidth (w);
+  for (int i=0; i < len; i++) {
+    unsigned long x = ckpt_get_ulong (ck);
+    if (i < v->getLen ()) {
+      v->setVal (i, x);
+    }
+  }
+}
+
+void ckpt_put_multires (act_ckpt *ck, expr_multires *v)
+{
+  ckpt_put_int (ck, v->nvals);
+  for (int i=0; i < v->nvals; i++) {
+    ckpt_put_bigint (ck, &v->v[i]);
+  }
+}
+
+void ckpt_get_multires (act_ckpt *ck, expr_multires *v)
+{
+  int n = ckpt_get_int (ck);
+  if (n < 0 || (size_t)n > (ck->len - ck->pos)/(2*sizeof (int))) {
+    ckpt_error (ck, "corrupt channel value");
+    return;
+  }
+  if (ck->dry) {
+    for (int i=0; i < n && !ck->err; i++) {
+      ckpt_get_bigint (ck, NULL);
+    }
+    return;
+  }
+  if (n != v->nvals) {
+    expr_multires tmp;
+    if (n > 0) {
+      MALLOC (tmp.v, BigInt, n);
+      for (int i=0; i < n; i++) {
+	new (&tmp.v[i]) BigInt;
+      }
+      tmp.nvals = n;
+    }
+    *v = tmp;
+  }
+  for (int i=0; i < n; i++) {
+    ckpt_get_bigint (ck, &v->v[i]);
+  }
+}
+
+
+/*
+  Booleans are saved as one byte per node holding all the ENTRY_W
+  flag bits, integers as their BigInt words. Channels save the
+  handshake state and both data buffers; probe waits are dropped on
+  restore, and the probing process re-evaluates its guards instead
+  (see ChpSim::restoreState).
+*/
+void ActSimState::saveState (act_ckpt *ck)
+{
+  unsigned char *b;
+
+  ckpt_put_int (ck, nbools);
+  ckpt_put_int (ck, nints);
+  ckpt_put_int (ck, nchans);
+
+  if (nbools > 0) {
+    MALLOC (b, unsigned char, nbools);
+    for (int i=0; i < nbools; i++) {
+      b[i] = 0;
+      for (int j=0; j < ENTRY_W; j++) {
+	if (_tst (i, j)) {
+	  b[i] |= (1 << j);
+	}
+      }
+    }
+    ckpt_put (ck, b, nbools);
+    FREE (b);
+  }
+
+  for (int i=0; i < nints; i++) {
+    ckpt_put_bigint (ck, &ival[i]);
+  }
+
+  for (int i=0; i < nchans; i++) {
+    act_channel_state *c = &chans[i];
+    int x[15];
+    x[0] = c->send_here;
+    x[1] = c->sender_probe;
+    x[2] = c->recv_here;
+    x[3] = c->receiver_probe;
+    x[4] = c->sfrag_st;
+    x[5] = c->rfrag_st;
+    x[6] = c->frag_warn;
+    x[7] = c->sufrag_st;
+    x[8] = c->rufrag_st;
+    x[9] = c->use_flavors;
+    x[10] = c->send_flavor;
+    x[11] = c->recv_flavor;
+    x[12] = c->skip_action;
+    x[13] = c->width;
+    x[14] = c->len;
+    ckpt_put (ck, x, sizeof (x));
+    ckpt_put_ulong (ck, c->count);
+    ckpt_put_multires (ck, &c->data);
+    ckpt_put_multires (ck, &c->data2);
+  }
+}
+
+void ActSimState::restoreState (act_ckpt *ck)
+{
+  const unsigned char *b;
+  int n[3];
+
+  n[0] = ckpt_get_int (ck);
+  n[1] = ckpt_get_int (ck);
+  n[2] = ckpt_get_int (ck);
+  if (n[0] != nbools || n[1] != nints || n[2] != nchans) {
+    ckpt_error (ck, "state vector does not match the design");
+    return;
+  }
+
+  if (nbools > 0) {
+    if (ck->pos + nbools > ck->len) {
+      ckpt_error (ck, "unexpected end of file");
+      return;
+    }
+    b = ck->buf + ck->pos;
+    for (int i=0; !ck->dry && i < nbools; i++) {
+      for (int j=0; j < ENTRY_W; j++) {
+	if (b[i] & (1 << j)) {
+	  _set (i, j);
+	}
+	else {
+	  _clr (i, j);
+	}
+      }
+    }
+    ck->pos += nbools;
+  }
+
+  for (int i=0; i < nints && !ck->err; i++) {
+    ckpt_get_bigint (ck, &ival[i]);
+  }
+
+  for (int i=0; i < nchans && !ck->err; i++) {
+    act_channel_state *c = &chans[i];
+    int x[15];
+    ckpt_get (ck, x, sizeof (x));
+    if (ck->dry) {
+      ckpt_get_ulong (ck);
+      ckpt_get_multires (ck, NULL);
+      ckpt_get_multires (ck, NULL);
+      continue;
+    }
+    c->send_here = x[0];
+    c->sender_probe = x[1];
+    c->recv_here = x[2];
+    c->receiver_probe = x[3];
+    c->sfrag_st = x[4];
+    c->rfrag_st = x[5];
+    c->frag_warn = x[6];
+    c->sufrag_st = x[7];
+    c->rufrag_st = x[8];
+    c->use_flavors = x[9];
+    c->send_flavor = x[10];
+    c->recv_flavor = x[11];
+    c->skip_action = x[12];
+    c->width = x[13];
+    c->len = x[14];
+    if (c->sender_probe) {
+      c->send_here = 0;
+      c->sender_probe = 0;
+    }
+    if (c->receiver_probe) {
+      c->recv_here = 0;
+      c->receiver_probe = 0;
+    }
+    c->count = ckpt_get_ulong (ck);
+    ckpt_get_multires (ck, &c->data);
+    ckpt_get_multires (ck, &c->data2);
+  }
+}
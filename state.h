@@ -25,6 +25,13 @@
 #include <act/act.h>
 
 class ActSimCore;
+class OnePrsSim;
+
+/*
+ * Up to EXPR_MULTIRES_INLINE values are stored inside the object, so
+ * scalars and small structures need no heap allocation.
+ */
+#define EXPR_MULTIRES_INLINE 4
 
 class expr_multires {
  public:
@@ -42,9 +49,7 @@ class expr_multires {
     _d = NULL;
     if (nvals != 1) {
       _delete_objects ();
-      nvals = 1;
-      NEW (v, BigInt);
-      new (v) BigInt;
+      _alloc (1);
     }
     *v = x;
   }
@@ -53,28 +58,25 @@ class expr_multires {
     _d = NULL;
     if (nvals != 1) {
       _delete_objects ();
-      nvals = 1;
-      NEW (v, BigInt);
-      new (v) BigInt;
+      _alloc (1);
     }
     v->setWidth (BIGINT_BITS_ONE);
     v->setVal (0, val);
   }
 
   expr_multires (expr_multires &&m) {
-    v = m.v;
-    nvals = m.nvals;
-    m.nvals = 0;
-    m.v = NULL;
+    nvals = 0;
+    v = NULL;
+    _take (m);
     _d = m._d;
   }
   
   expr_multires (expr_multires &m) {
-    nvals = m.nvals;
-    if (nvals > 0) {
-      MALLOC (v, BigInt, nvals);
+    nvals = 0;
+    v = NULL;
+    if (m.nvals > 0) {
+      _alloc (m.nvals);
       for (int i=0; i < nvals; i++) {
-	new (&v[i]) BigInt;
 	v[i] = m.v[i];
       }
     }
@@ -84,31 +86,27 @@ class expr_multires {
   void Print (FILE *fp);
   
   expr_multires &operator=(expr_multires &&m) {
-    if (nvals > 0) {
-      FREE (v);
+    if (&m == this) {
+      return *this;
     }
-    v = m.v;
-    nvals = m.nvals;
-    m.nvals = 0;
+    _delete_objects ();
+    _take (m);
     _d = m._d;
     return *this;
   }
   
   expr_multires &operator=(expr_multires &m) {
+    if (&m == this) {
+      return *this;
+    }
     if (nvals != m.nvals) {
       _delete_objects ();
       if (m.nvals > 0) {
-	MALLOC (v, BigInt, m.nvals);
-	for (int i=0; i < m.nvals; i++) {
-	  new (&v[i]) BigInt;
-	}
+	_alloc (m.nvals);
       }
     }
-    nvals = m.nvals;
-    if (nvals > 0) {
-      for (int i=0; i < nvals; i++) {
-	v[i] = m.v[i];
-      }
+    for (int i=0; i < nvals; i++) {
+      v[i] = m.v[i];
     }
     _d = m._d;
     return *this;
@@ -118,6 +116,8 @@ class expr_multires {
 
   void setField (ActId *field, BigInt *v);
   void setField (ActId *field, expr_multires *v);
+  void setField (int off, BigInt *v);	// off from getStructOffset()
+  void setField (int off, expr_multires *v); // -1 = the whole value
   BigInt *getField (ActId *x);
   expr_multires getStruct (ActId *x);
 
@@ -125,12 +125,49 @@ class expr_multires {
   int nvals;
 
 private:
+  alignas (BigInt) unsigned char _buf[EXPR_MULTIRES_INLINE*sizeof (BigInt)];
+
+  BigInt *_inline () { return (BigInt *)_buf; }
+
+  /* storage for n default-constructed values; must be empty */
+  void _alloc (int n) {
+    if (n <= EXPR_MULTIRES_INLINE) {
+      v = _inline ();
+    }
+    else {
+      MALLOC (v, BigInt, n);
+    }
+    for (int i=0; i < n; i++) {
+      new (&v[i]) BigInt;
+    }
+    nvals = n;
+  }
+
+  /* take the values of m, leaving m empty; must be empty */
+  void _take (expr_multires &m) {
+    if (m.nvals > 0 && m.v == m._inline ()) {
+      _alloc (m.nvals);
+      for (int i=0; i < nvals; i++) {
+	v[i] = m.v[i];
+      }
+      m._delete_objects ();
+    }
+    else {
+      v = m.v;
+      nvals = m.nvals;
+      m.v = NULL;
+      m.nvals = 0;
+    }
+  }
+
   void _delete_objects () {
     if (nvals > 0) {
       for (int i=0; i < nvals; i++) {
 	v[i].~BigInt();
       }
-      FREE (v);
+      if (v != _inline ()) {
+	FREE (v);
+      }
     }
     v = NULL;
     nvals = 0;
@@ -148,4 +185,61 @@ struct extra_state_alloc {
 };
 
 
+/*
+ * Binary checkpoint stream (see ActSim::saveSim/restoreSim).
+ *
+ * A checkpoint is written sequentially to a FILE; it is read back
+ * from a single in-memory image of the file, which is mmap()'d when
+ * possible so that large states are paged in on demand.
+ *
+ * A restore reads the image twice. The first pass has dry set: the
+ * restoreState() methods parse and check their part of the image
+ * without changing any simulation state, and report problems with
+ * ckpt_error(). The image is only applied if that pass succeeds.
+ */
+struct act_ckpt {
+  FILE *fp;			/* output stream (save) */
+
+  const unsigned char *buf;	/* input image (restore) */
+  size_t len, pos;
+
+  struct pHashtable *ev;	/* object -> list of pending event
+				   types, gathered before a save */
+  unsigned long now;		/* simulation time of the checkpoint */
+
+  struct pHashtable *dirty;	/* save: rule -> position in the
+				   delta-cycle list */
+  int ndirty;			/* # of rules in the delta-cycle list */
+  OnePrsSim **dirty_rule;	/* restore: those rules, by position */
+
+  unsigned int dry:1;		/* restore: only check the image */
+  unsigned int err:1;		/* save: a write failed;
+				   restore: the image is not usable */
+};
+
+/* what a checkpoint records about the design it was taken from */
+struct act_ckpt_design {
+  const char *top;		/* top-level process, "" if global */
+  int nbools, nints, nchans;	/* state vector sizes */
+  int nobj[3];			/* # of CHP, PRS, and other objects */
+  unsigned long inst;		/* hash of the instance table */
+};
+
+void ckpt_put (act_ckpt *ck, const void *p, size_t sz);
+void ckpt_get (act_ckpt *ck, void *p, size_t sz);
+
+/* report the first problem found in a checkpoint image */
+void ckpt_error (act_ckpt *ck, const char *msg);
+
+void ckpt_put_int (act_ckpt *ck, int v);
+int ckpt_get_int (act_ckpt *ck);
+void ckpt_put_ulong (act_ckpt *ck, unsigned long v);
+unsigned long ckpt_get_ulong (act_ckpt *ck);
+
+void ckpt_put_bigint (act_ckpt *ck, BigInt *v);
+void ckpt_get_bigint (act_ckpt *ck, BigInt *v);
+void ckpt_put_multires (act_ckpt *ck, expr_multires *v);
+void ckpt_get_multires (act_ckpt *ck, expr_multires *v);
+
+
 #endif /* __ACTSIM_STATE_H__ */
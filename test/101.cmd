@@ -0,0 +1,6 @@
+advance 1000
+save runs/101.ckpt
+cycle
+initialize test<>
+restore runs/101.ckpt
+cycle
@@ -0,0 +1,9 @@
+lanes_init
+lanes_set a 0101
+lanes_set b 0011
+lanes_advance 100
+lanes_get c
+lanes_source 105.lanes
+lanes_advance 100
+lanes_get a
+lanes_get c
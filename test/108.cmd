@@ -0,0 +1,6 @@
+set a 1
+set b 1
+cycle
+get c
+get d
+prs_stats
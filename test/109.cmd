@@ -0,0 +1,10 @@
+watch d
+set a 0
+get b
+get c
+get d
+cycle
+set a 1
+get b
+get c
+cycle
@@ -0,0 +1,3 @@
+cycle
+get r.t
+chp_events
@@ -0,0 +1,3 @@
+watch a b c d e
+set a 0
+cycle
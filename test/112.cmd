@@ -0,0 +1,10 @@
+watch c
+set a 0
+set b 1
+cycle
+set b 0
+set a X
+cycle
+set a 1
+cycle
+get c
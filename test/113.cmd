@@ -0,0 +1,9 @@
+watch d
+set c 0
+set a 0
+cycle
+set c 1
+cycle
+set b 1
+cycle
+get d
@@ -0,0 +1,20 @@
+watch y
+set en 1
+set a0 0
+set a1 0
+set b0 0
+set b1 0
+set c0 0
+set c1 0
+set d0 0
+set d1 0
+set en 0
+cycle
+set en 1
+set c0 1
+set c1 1
+cycle
+set c0 0
+set en 0
+cycle
+get y
@@ -0,0 +1,9 @@
+random_seed 1
+random
+set a 0
+cycle
+get d
+random 5 50
+set a 1
+cycle
+get d
@@ -0,0 +1,2 @@
+cycle
+get t.s
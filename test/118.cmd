@@ -0,0 +1,9 @@
+watch a b
+trace_start -ctr runs/118.ctr
+set a 0
+cycle
+set a 1
+cycle
+set a 0
+cycle
+trace_stop -ctr
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Generate an array of ring oscillators
+#
+#   gen_ring.sh <#rings> <#stages> > file.act
+#
+# The top-level process is "bench"; each ring is a NAND gate followed
+# by <#stages>-1 inverters, enabled by the global-ish signal "en".
+# <#stages> must be odd. With the default delay of 10, the array makes
+# about <#rings>/10 transitions per unit of simulation time.
+#
+
+if [ $# -ne 2 ]
+then
+	echo "Usage: $0 <#rings> <#stages>" 1>&2
+	exit 1
+fi
+
+nrings=$1
+nstages=$2
+
+if [ `expr $nstages % 2` -ne 1 ]
+then
+	echo "$0: number of stages must be odd" 1>&2
+	exit 1
+fi
+
+last=`expr $nstages - 1`
+
+cat <<ACTEOF
+defproc ring (bool? en)
+{
+  bool x[$nstages];
+  prs {
+    en & x[$last] -> x[0]-
+    ~en | ~x[$last] -> x[0]+
+    (i:1..$last: x[i-1] => x[i]-)
+  }
+}
+
+defproc bench ()
+{
+  bool en;
+  ring r[$nrings];
+  (i:$nrings: r[i].en = en;)
+}
+ACTEOF
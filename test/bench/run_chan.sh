@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+# Measure struct-typed channel throughput between CHP processes.
+#
+#   run_chan.sh [#messages] [#pairs]
+#
+# Runs <#pairs> producer/consumer pairs, each passing <#messages>
+# structures over a channel, for a 3-field structure (stored inline
+# in expr_multires) and an 8-field structure (heap allocated), and
+# reports messages/second. If ACTSIM_BASE names another actsim
+# binary, it is run on the same designs for comparison.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nmsg=${1:-200000}
+npairs=${2:-10}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+cat > $tmp/b.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+  end
+end
+CONFEOF
+
+now()
+{
+	date +%s.%N
+}
+
+# gen <#fields>
+gen()
+{
+	nf=$1
+	echo "deftype msg (int<32> f0"
+	i=1
+	while [ $i -lt $nf ]
+	do
+		echo "; int<16> f$i"
+		i=`expr $i + 1`
+	done
+	echo ") { }"
+	cat <<ACTEOF
+
+defproc prod (chan!(msg) C)
+{
+  msg m;
+  int<32> n;
+  chp {
+    n := 0; m.f0 := 0;
+    *[ n < $nmsg -> m.f0 := m.f0 + 1; C!m; n := n + 1 ]
+  }
+}
+
+defproc cons (chan?(msg) C)
+{
+  msg m;
+  int<32> n, s;
+  chp {
+    n := 0; s := 0;
+    *[ n < $nmsg -> C?m; s := s + m.f0; n := n + 1 ];
+    log ("sum ", s)
+  }
+}
+
+defproc bench ()
+{
+  prod p[$npairs];
+  cons c[$npairs];
+  (i:$npairs: p[i].C = c[i].C;)
+}
+ACTEOF
+}
+
+for nf in 3 8
+do
+	gen $nf > $tmp/s$nf.act
+	echo "*** $nf-field struct: $npairs pairs x $nmsg messages"
+	for tool in $ACTTOOL $ACTSIM_BASE
+	do
+		start=`now`
+		$tool -cnf=$tmp/b.conf $tmp/s$nf.act bench > $tmp/s$nf.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+		end=`now`
+		echo $start $end $nmsg $npairs | awk -v t=`basename $tool` '{ d = $2 - $1; m = $3*$4; printf "%s: %.3f s, %.3g messages/s\n", t, d, m/d }'
+	done
+done
+
+rm -rf $tmp
@@ -0,0 +1,123 @@
+#!/bin/sh
+#
+# Measure the 64-bit CHP expression fast path (sim.chp.int64_fast).
+#
+#   run_chp.sh [#repeat] [#iterations]
+#
+# 1. Runs the CHP tests in the test/ corpus <#repeat> times with the
+#    fast path off and on, reports wall-clock time, and checks that
+#    both produce the same output.
+# 2. Runs a synthetic CHP counter loop for <#iterations> iterations
+#    and reports iterations/second.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nrep=${1:-5}
+niter=${2:-1000000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for f in 0 1
+do
+	cat > $tmp/f$f.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+    int int64_fast $f
+  end
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+#
+# test corpus: CHP tests only
+#
+echo "*** CHP tests x $nrep"
+for f in 0 1
+do
+	start=`now`
+	(cd ..; rep=0; while [ $rep -lt $nrep ]
+	do
+		count=0
+		while [ -f ${count}.act ]
+		do
+			if grep -q chp ${count}.act
+			then
+				$ACTTOOL -cnf=bench/$tmp/f$f.conf ${count}.act test > bench/$tmp/$count.f$f.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+			fi
+			count=`expr $count + 1`
+		done
+		rep=`expr $rep + 1`
+	done)
+	end=`now`
+	echo "int64_fast=$f: `echo $start $end | awk '{printf "%.3f", $2-$1}'` s"
+done
+
+count=0
+diffs=0
+while [ -f ../${count}.act ]
+do
+	if [ -f $tmp/$count.f0.out ] && ! cmp $tmp/$count.f0.out $tmp/$count.f1.out >/dev/null 2>&1
+	then
+		echo "  output differs: ${count}.act"
+		diffs=`expr $diffs + 1`
+	fi
+	count=`expr $count + 1`
+done
+echo "outputs that differ: $diffs"
+
+#
+# counter loop
+#
+echo
+echo "*** counter loop: $niter iterations"
+cat > $tmp/loop.act <<ACTEOF
+defproc bench()
+{
+  int<8> x;
+  int<32> n;
+  int<8> a[16];
+  bool b;
+  chp {
+    n := 0; x := 0; b+;
+    *[ n < $niter ->
+         x := x + 1;
+         a[x & 15] := (x ^ a[x & 15]) | 1;
+         [ x = 0 & b -> b- [] else -> b+ ];
+         n := n + 1
+    ];
+    log ("done ", x)
+  }
+}
+ACTEOF
+for f in 0 1
+do
+	start=`now`
+	$ACTTOOL -cnf=$tmp/f$f.conf $tmp/loop.act bench > $tmp/loop.f$f.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+	end=`now`
+	echo $start $end $niter | awk -v f=$f '{ t = $2 - $1; printf "int64_fast=%d: %.3f s, %.3g iterations/s\n", f, t, $3/t }'
+done
+if ! cmp $tmp/loop.f0.out $tmp/loop.f1.out >/dev/null 2>&1
+then
+	echo "  counter loop output differs!"
+fi
+
+rm -rf $tmp
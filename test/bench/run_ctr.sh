@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Measure time-window extraction from a ctr trace file.
+#
+#   run_ctr.sh [#counters] [#iterations]
+#
+# Writes a ctr trace of <#counters> CHP counters running for
+# <#iterations> steps each, then times ctr2vcd on the whole trace and
+# on a short window near its end. The window should take a small,
+# roughly constant time irrespective of the length of the trace.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+  CTR2VCD=$ACT_HOME/bin/ctr2vcd
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+  CTR2VCD=`pwd`/../../ctrace/ctr2vcd.$EXT
+fi
+
+ncnt=${1:-200}
+niter=${2:-20000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+now()
+{
+	date +%s.%N
+}
+
+cat > $tmp/cnt.act <<ACTEOF
+defproc cnt ()
+{
+  int<16> x;
+  int<32> n;
+  chp {
+    n := 0; x := 0;
+    *[ n < $niter -> x := x + 1; n := n + 1 ]
+  }
+}
+
+defproc bench ()
+{
+  cnt c[$ncnt];
+}
+ACTEOF
+
+i=0
+while [ $i -lt $ncnt ]
+do
+	echo "watch c[$i].x"
+	i=`expr $i + 1`
+done > $tmp/run.cmd
+(echo "trace_start -ctr $tmp/cnt.ctr"; echo cycle; echo "trace_stop -ctr") >> $tmp/run.cmd
+
+echo "*** $ncnt traced counters x $niter iterations"
+$ACTTOOL $tmp/cnt.act bench < $tmp/run.cmd > $tmp/run.out 2>&1
+if [ ! -f $tmp/cnt.ctr ]; then
+	echo "  no trace file written"
+	rm -rf $tmp
+	exit 1
+fi
+ls -l $tmp/cnt.ctr | awk '{ printf "trace: %d bytes\n", $5 }'
+
+tend=`$CTR2VCD -l $tmp/cnt.ctr | awk 'NR == 1 { print $8 }' | tr -d ,`
+t0=`expr $tend - $tend / 100`
+
+start=`now`
+$CTR2VCD -o $tmp/all.vcd $tmp/cnt.ctr
+end=`now`
+echo $start $end | awk '{ printf "full trace:   %.3f s\n", $2 - $1 }'
+
+start=`now`
+$CTR2VCD -s $t0 -e $tend -o $tmp/win.vcd $tmp/cnt.ctr
+end=`now`
+echo $start $end $t0 $tend | awk '{ printf "window %d-%d: %.3f s\n", $3, $4, $2 - $1 }'
+
+rm -rf $tmp
@@ -0,0 +1,131 @@
+#!/bin/sh
+#
+# Measure direct channel hand-off (sim.chp.direct_handoff).
+#
+#   run_handoff.sh [#stages] [#messages]
+#
+# 1. Runs the CHP tests in the test/ corpus with hand-off off and on,
+#    and reports tests whose output differs.
+# 2. Runs a pipeline of <#stages> CHP buffers passing <#messages>
+#    values, and reports wall-clock time and CHP event counts.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nstages=${1:-1000}
+nmsg=${2:-1000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for f in 0 1
+do
+	cat > $tmp/f$f.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+    int direct_handoff $f
+  end
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+#
+# test corpus: CHP tests only
+#
+echo "*** CHP tests"
+count=0
+diffs=0
+while [ -f ../${count}.act ]
+do
+	if grep -q chp ../${count}.act
+	then
+		for f in 0 1
+		do
+			(cd ..; $ACTTOOL -cnf=bench/$tmp/f$f.conf ${count}.act test > bench/$tmp/$count.f$f.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+)
+		done
+		if ! cmp $tmp/$count.f0.out $tmp/$count.f1.out >/dev/null 2>&1
+		then
+			echo "  output differs: ${count}.act"
+			diffs=`expr $diffs + 1`
+		fi
+	fi
+	count=`expr $count + 1`
+done
+echo "outputs that differ: $diffs"
+
+#
+# buffer pipeline
+#
+echo
+echo "*** pipeline: $nstages stages, $nmsg messages"
+cat > $tmp/pipe.act <<ACTEOF
+defproc src (chan!(int<32>) O)
+{
+  int<32> n;
+  chp {
+    n := 0;
+    *[ n < $nmsg -> O!n; n := n + 1 ]
+  }
+}
+
+defproc buf (chan?(int<32>) I; chan!(int<32>) O)
+{
+  int<32> x;
+  chp {
+    *[ I?x; O!x ]
+  }
+}
+
+defproc sink (chan?(int<32>) I)
+{
+  int<32> n, x, s;
+  chp {
+    n := 0; s := 0;
+    *[ n < $nmsg -> I?x; s := s + x; n := n + 1 ];
+    log ("sum ", s)
+  }
+}
+
+defproc bench ()
+{
+  src s;
+  buf b[$nstages];
+  sink k;
+  s.O = b[0].I;
+  (i:$nstages-1: b[i].O = b[i+1].I;)
+  b[$nstages-1].O = k.I;
+}
+ACTEOF
+for f in 0 1
+do
+	start=`now`
+	$ACTTOOL -cnf=$tmp/f$f.conf $tmp/pipe.act bench > $tmp/pipe.f$f.out 2>&1 <<CMDEOF
+cycle
+chp_events
+CMDEOF
+	end=`now`
+	echo $start $end | awk -v f=$f '{ printf "direct_handoff=%d: %.3f s\n", f, $2 - $1 }'
+	grep -A3 "^chp events" $tmp/pipe.f$f.out | sed 's/^/  /'
+done
+if [ "`grep sum $tmp/pipe.f0.out`" != "`grep sum $tmp/pipe.f1.out`" ]
+then
+	echo "  pipeline output differs!"
+fi
+
+rm -rf $tmp
@@ -0,0 +1,148 @@
+#!/bin/sh
+#
+# Compare event-driven PRS evaluation against levelized combinational
+# cones (sim.prs.levelize).
+#
+#   run_levelize.sh [#cells] [time]
+#
+# 1. Runs the test/ corpus in both modes, reports wall-clock time, and
+#    counts outputs that differ.
+# 2. Runs an array of cells, each a ring oscillator driving a 3-to-8
+#    decoder and an OR tree over the decoder outputs, for <time> units
+#    and reports the wall-clock time in each mode.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+ncells=${1:-10000}
+simtime=${2:-100000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for l in 0 1
+do
+	cat > $tmp/l$l.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+  end
+  begin prs
+    int levelize $l
+  end
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+#
+# test corpus
+#
+echo "*** test corpus"
+for l in 0 1
+do
+	start=`now`
+	count=0
+	(cd ..; while [ -f ${count}.act ]
+	do
+		$ACTTOOL -cnf=bench/$tmp/l$l.conf ${count}.act test > bench/$tmp/$count.l$l.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+		count=`expr $count + 1`
+	done)
+	end=`now`
+	echo "levelize=$l: `echo $start $end | awk '{printf "%.3f", $2-$1}'` s"
+done
+
+count=0
+diffs=0
+while [ -f ../${count}.act ]
+do
+	if ! cmp $tmp/$count.l0.out $tmp/$count.l1.out >/dev/null 2>&1
+	then
+		diffs=`expr $diffs + 1`
+	fi
+	count=`expr $count + 1`
+done
+echo "outputs that differ: $diffs / $count (internal cone nodes switch early)"
+
+#
+# ring oscillators with combinational decoders
+#
+(
+cat <<ACTEOF
+defproc dec (bool? a, b, c; bool! done)
+{
+  bool _a, _b, _c, _o[8], o[8], _t[4], t[2];
+  prs {
+    a => _a-
+    b => _b-
+    c => _c-
+ACTEOF
+for i in 0 1 2 3 4 5 6 7
+do
+	la=a; lb=b; lc=c
+	[ `expr $i % 2` -eq 0 ] && la=_a
+	[ `expr $i / 2 % 2` -eq 0 ] && lb=_b
+	[ `expr $i / 4` -eq 0 ] && lc=_c
+	echo "    $la & $lb & $lc -> _o[$i]-"
+	echo "    ~$la | ~$lb | ~$lc -> _o[$i]+"
+	echo "    _o[$i] => o[$i]-"
+done
+cat <<ACTEOF
+    (i:4: o[2*i] | o[2*i+1] -> _t[i]-
+          ~o[2*i] & ~o[2*i+1] -> _t[i]+)
+    (i:2: _t[2*i] & _t[2*i+1] -> t[i]-
+          ~_t[2*i] | ~_t[2*i+1] -> t[i]+)
+    t[0] | t[1] -> done-
+    ~t[0] & ~t[1] -> done+
+  }
+}
+
+defproc cell (bool? en; bool! done)
+{
+  bool x[11];
+  dec d(x[0], x[2], x[4], done);
+  prs {
+    en & x[10] -> x[0]-
+    ~en | ~x[10] -> x[0]+
+    (i:1..10: x[i-1] => x[i]-)
+  }
+}
+
+defproc bench ()
+{
+  bool en, done[$ncells];
+  cell c[$ncells];
+  (i:$ncells: c[i].en = en; c[i].done = done[i];)
+}
+ACTEOF
+) > $tmp/dec.act
+
+echo
+echo "*** decoders: $ncells cells, time $simtime"
+for l in 0 1
+do
+	start=`now`
+	$ACTTOOL -cnf=$tmp/l$l.conf $tmp/dec.act bench > $tmp/dec.l$l.out 2>&1 <<CMDEOF
+set en 0
+cycle
+set en 1
+advance $simtime
+CMDEOF
+	end=`now`
+	echo $start $end | awk -v l=$l '{ printf "levelize=%d: %.3f s\n", l, $2 - $1 }'
+done
+
+rm -rf $tmp
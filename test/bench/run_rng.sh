@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Compare random-delay generation with rand_r() and exp() against the
+# xoshiro256** generator with a log-uniform table (sim.fast_rng).
+#
+#   run_rng.sh [#rings] [#stages] [time]
+#
+# Runs a synthetic ring-oscillator array with random delays in each
+# random mode and reports the wall-clock time.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nrings=${1:-10000}
+nstages=${2:-11}
+simtime=${3:-1000000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for f in 0 1
+do
+	cat > $tmp/f$f.conf <<CONFEOF
+begin sim
+  int fast_rng $f
+  begin chp
+    int inf_loop_opt 1
+  end
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+echo "*** ring oscillators: $nrings x $nstages stages, time $simtime"
+./gen_ring.sh $nrings $nstages > $tmp/ring.act || exit 1
+for mode in "random" "random 10 100"
+do
+	for f in 0 1
+	do
+		start=`now`
+		$ACTTOOL -cnf=$tmp/f$f.conf $tmp/ring.act bench > $tmp/ring.f$f.out 2>&1 <<CMDEOF
+random_seed 1
+$mode
+set en 0
+cycle
+set en 1
+advance $simtime
+CMDEOF
+		end=`now`
+		echo $start $end | awk -v f=$f -v m="$mode" '{ printf "%-14s fast_rng=%d: %.3f s\n", m, f, $2 - $1 }'
+	done
+done
+
+rm -rf $tmp
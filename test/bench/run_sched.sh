@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Compare the default event heap against the PRS timing wheel
+# (sim.prs.timing_wheel).
+#
+#   run_sched.sh [#rings] [#stages] [time]
+#
+# 1. Runs the test/ corpus with both schedulers, reports wall-clock
+#    time, and checks that both produce the same output.
+# 2. Runs a synthetic ring-oscillator array for <time> units and reports
+#    events/second for each scheduler.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nrings=${1:-10000}
+nstages=${2:-11}
+simtime=${3:-100000}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for w in 0 1
+do
+	cat > $tmp/w$w.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+  end
+  begin prs
+    int timing_wheel $w
+  end
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+#
+# test corpus
+#
+echo "*** test corpus"
+for w in 0 1
+do
+	start=`now`
+	count=0
+	(cd ..; while [ -f ${count}.act ]
+	do
+		$ACTTOOL -cnf=bench/$tmp/w$w.conf ${count}.act test > bench/$tmp/$count.w$w.out 2>&1 <<CMDEOF
+cycle
+CMDEOF
+		count=`expr $count + 1`
+	done)
+	end=`now`
+	echo "timing_wheel=$w: `echo $start $end | awk '{printf "%.3f", $2-$1}'` s"
+done
+
+count=0
+diffs=0
+while [ -f ../${count}.act ]
+do
+	if ! cmp $tmp/$count.w0.out $tmp/$count.w1.out >/dev/null 2>&1
+	then
+		diffs=`expr $diffs + 1`
+	fi
+	count=`expr $count + 1`
+done
+echo "outputs that differ: $diffs / $count (same-time event order may differ)"
+
+#
+# ring oscillator array
+#
+echo
+echo "*** ring oscillators: $nrings x $nstages stages, time $simtime"
+./gen_ring.sh $nrings $nstages > $tmp/ring.act || exit 1
+for w in 0 1
+do
+	start=`now`
+	$ACTTOOL -cnf=$tmp/w$w.conf $tmp/ring.act bench > $tmp/ring.w$w.out 2>&1 <<CMDEOF
+set en 0
+cycle
+set en 1
+advance $simtime
+CMDEOF
+	end=`now`
+	echo $start $end $nrings $simtime | awk -v w=$w '{ t = $2 - $1; ev = $3*$4/10; printf "timing_wheel=%d: %.3f s, %.0f events, %.3g events/s\n", w, t, ev, ev/t }'
+done
+
+rm -rf $tmp
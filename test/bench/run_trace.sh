@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Measure background trace writing (sim.trace_async).
+#
+#   run_trace.sh [#counters] [#iterations]
+#
+# Runs <#counters> CHP counters for <#iterations> steps each with all
+# counter values written to a VCD file, with synchronous and with
+# background trace writing. Reports wall-clock time and checks that
+# both produce the same VCD file.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+ncnt=${1:-2000}
+niter=${2:-500}
+
+tmp=bench.$$
+mkdir -p $tmp
+
+for f in 0 1
+do
+	cat > $tmp/f$f.conf <<CONFEOF
+begin sim
+  int trace_async $f
+end
+CONFEOF
+done
+
+now()
+{
+	date +%s.%N
+}
+
+cat > $tmp/cnt.act <<ACTEOF
+defproc cnt ()
+{
+  int<16> x;
+  int<32> n;
+  chp {
+    n := 0; x := 0;
+    *[ n < $niter -> x := x + 1; n := n + 1 ]
+  }
+}
+
+defproc bench ()
+{
+  cnt c[$ncnt];
+}
+ACTEOF
+
+i=0
+while [ $i -lt $ncnt ]
+do
+	echo "watch c[$i].x"
+	i=`expr $i + 1`
+done > $tmp/watch.cmd
+
+echo "*** $ncnt traced counters x $niter iterations"
+for f in 0 1
+do
+	(cat $tmp/watch.cmd; echo "vcd_start $tmp/f$f.vcd"; echo cycle; echo vcd_stop) > $tmp/f$f.cmd
+	start=`now`
+	$ACTTOOL -cnf=$tmp/f$f.conf $tmp/cnt.act bench < $tmp/f$f.cmd > $tmp/f$f.out 2>&1
+	end=`now`
+	echo $start $end | awk -v f=$f '{ printf "trace_async=%d: %.3f s\n", f, $2 - $1 }'
+done
+if ! cmp $tmp/f0.vcd $tmp/f1.vcd >/dev/null 2>&1
+then
+	echo "  VCD output differs!"
+fi
+
+rm -rf $tmp
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# Measure the cost of watchpoint checks on the PRS transition path.
+#
+#   run_watch.sh [#rings] [#stages] [time]
+#
+# Runs a ring-oscillator array for <time> units with 0, 100 and
+# 100000 watchpoints on nodes that never switch, and reports
+# events/second. The watched nodes do not produce output, so the
+# numbers measure only the per-transition watch/breakpoint filter.
+#
+
+ARCH=`$ACT_HOME/scripts/getarch`
+OS=`$ACT_HOME/scripts/getos`
+EXT=${ARCH}_${OS}
+if [ ! x$ACT_TEST_INSTALL = x ] || [ ! -f ../../actsim.$EXT ]; then
+  ACTTOOL=$ACT_HOME/bin/actsim
+else
+  ACTTOOL=`pwd`/../../actsim.$EXT
+fi
+
+nrings=${1:-10000}
+nstages=${2:-11}
+simtime=${3:-100000}
+nidle=100000
+
+tmp=bench.$$
+mkdir -p $tmp
+
+cat > $tmp/w.conf <<CONFEOF
+begin sim
+  begin chp
+    int inf_loop_opt 1
+  end
+end
+CONFEOF
+
+now()
+{
+	date +%s.%N
+}
+
+#
+# the ring array, plus a set of idle nodes to watch (driven by a
+# rule that never fires, so that they are allocated)
+#
+./gen_ring.sh $nrings $nstages | sed 's/^defproc bench ()/defproc bench0 ()/' > $tmp/watch.act || exit 1
+cat >> $tmp/watch.act <<ACTEOF
+
+defproc bench ()
+{
+  bool z, idle[$nidle];
+  bench0 b;
+  prs {
+    (i:$nidle: z -> idle[i]-)
+  }
+}
+ACTEOF
+
+echo "*** ring oscillators: $nrings x $nstages stages, time $simtime"
+for nw in 0 100 $nidle
+do
+	echo "set b.en 0" > $tmp/cmd.$nw
+	awk -v n=$nw 'BEGIN { for (i=0; i < n; i++) { printf "%s idle[%d]", (i % 100 == 0 ? "watch" : ""), i; if (i % 100 == 99 || i == n-1) printf "\n"; } }' >> $tmp/cmd.$nw
+	cat >> $tmp/cmd.$nw <<CMDEOF
+cycle
+set b.en 1
+advance $simtime
+CMDEOF
+	start=`now`
+	$ACTTOOL -cnf=$tmp/w.conf $tmp/watch.act bench < $tmp/cmd.$nw > $tmp/watch.$nw.out 2>&1
+	end=`now`
+	echo $start $end $nrings $simtime | awk -v w=$nw '{ t = $2 - $1; ev = $3*$4/10; printf "watched=%d: %.3f s, %.0f events, %.3g events/s\n", w, t, ev, ev/t }'
+done
+
+rm -rf $tmp
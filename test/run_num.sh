@@ -62,9 +62,23 @@ do
         else
 	   myecho ".[$bname]"
         fi
-	$ACTTOOL -cnf=sim.conf $i test > runs/$i.t.stdout 2> runs/$i.t.stderr <<EOF
+	conf=sim.conf
+	if [ -f $bname.conf ]
+	then
+		conf=$bname.conf
+	fi
+	if [ -f $bname.cmd ]
+	then
+		$ACTTOOL -cnf=$conf $i test < $bname.cmd > runs/$i.t.stdout 2> runs/$i.t.stderr
+	else
+		$ACTTOOL -cnf=$conf $i test > runs/$i.t.stdout 2> runs/$i.t.stderr <<EOF
 cycle
 EOF
+	fi
+	if [ -f $bname.post ]
+	then
+		EXT=$EXT sh $bname.post >> runs/$i.t.stdout 2>> runs/$i.t.stderr
+	fi
 	ok=1
 	if ! cmp runs/$i.t.stdout runs/$i.stdout >/dev/null 2>/dev/null
 	then
@@ -25,7 +25,22 @@ fi
 
 for i in $list
 do
-	$ACTTOOL -cnf=sim.conf $i test > runs/$i.stdout 2> runs/$i.stderr <<EOF
+	bname=`expr $i : '\(.*\).act'`
+	conf=sim.conf
+	if [ -f $bname.conf ]
+	then
+		conf=$bname.conf
+	fi
+	if [ -f $bname.cmd ]
+	then
+		$ACTTOOL -cnf=$conf $i test < $bname.cmd > runs/$i.stdout 2> runs/$i.stderr
+	else
+		$ACTTOOL -cnf=$conf $i test > runs/$i.stdout 2> runs/$i.stderr <<EOF
 cycle
 EOF
+	fi
+	if [ -f $bname.post ]
+	then
+		EXT=$EXT sh $bname.post >> runs/$i.stdout 2>> runs/$i.stderr
+	fi
 done
@@ -0,0 +1,253 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <common/misc.h>
+#include "trwriter.h"
+
+#define TRW_HDR 3
+
+TraceWriter *TraceWriter::_live = NULL;
+
+static int _atexit_done = 0;
+
+static void _trw_atexit (void)
+{
+  TraceWriter::flushAll ();
+}
+
+TraceWriter::TraceWriter (act_trace_t *tr, int nwords)
+{
+  unsigned long sz = 1024;
+
+  while (sz < (unsigned long)nwords) {
+    sz <<= 1;
+  }
+  _tr = tr;
+  MALLOC (_buf, unsigned long, sz);
+  _mask = sz - 1;
+  _head = 0;
+  _tail = 0;
+  _stop = 0;
+  _sleeping = 0;
+  _nrec = 0;
+  _nstall = 0;
+
+  _next = _live;
+  _live = this;
+  if (!_atexit_done) {
+    atexit (_trw_atexit);
+    _atexit_done = 1;
+  }
+
+  _th = std::thread (&TraceWriter::_run, this);
+}
+
+TraceWriter::~TraceWriter ()
+{
+  TraceWriter *prev;
+
+  flush ();
+  _stop.store (1, std::memory_order_release);
+  _wake ();
+  _th.join ();
+
+  if (_live == this) {
+    _live = _next;
+  }
+  else {
+    for (prev = _live; prev && prev->_next != this; prev = prev->_next)
+      ;
+    if (prev) {
+      prev->_next = _next;
+    }
+  }
+  FREE (_buf);
+}
+
+void TraceWriter::flushAll ()
+{
+  for (TraceWriter *w = _live; w; w = w->_next) {
+    w->flush ();
+  }
+}
+
+void TraceWriter::_wake ()
+{
+  /* either the writer sees the new tail before it sleeps, or we see
+     _sleeping. The writer holds _mu from setting _sleeping until it
+     is waiting, so taking _mu here means the notify cannot be lost */
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  if (_sleeping.load (std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lk (_mu);
+    _cv.notify_one ();
+  }
+}
+
+void TraceWriter::change (int kind, void *node, float tm,
+			  int tlen, unsigned long *ptm,
+			  int state, int vlen, unsigned long *val)
+{
+  unsigned long need = TRW_HDR + tlen + vlen;
+  unsigned long t = _tail.load (std::memory_order_relaxed);
+  unsigned long w0;
+
+  if (need > _mask + 1) {
+    /* does not fit in the ring at all: write it ourselves */
+    flush ();
+    emit (_tr, kind, node, tm, tlen, ptm, state, vlen, val);
+    return;
+  }
+
+  if (t + need - _head.load (std::memory_order_acquire) > _mask + 1) {
+    _nstall++;
+    _wake ();
+    while (t + need - _head.load (std::memory_order_acquire) > _mask + 1) {
+      std::this_thread::yield ();
+    }
+  }
+
+  w0 = (unsigned long)kind | ((unsigned long)(state & 0xff) << 8) |
+    ((unsigned long)(tlen & 0xffff) << 16) | ((unsigned long)vlen << 32);
+  _buf[t & _mask] = w0;
+  _buf[(t+1) & _mask] = (unsigned long) node;
+  _buf[(t+2) & _mask] = 0;
+  memcpy (&_buf[(t+2) & _mask], &tm, sizeof (float));
+  t += TRW_HDR;
+  for (int i=0; i < tlen; i++) {
+    _buf[t++ & _mask] = ptm[i];
+  }
+  for (int i=0; i < vlen; i++) {
+    _buf[t++ & _mask] = val[i];
+  }
+  _tail.store (t, std::memory_order_release);
+  _nrec++;
+  _wake ();
+}
+
+void TraceWriter::flush ()
+{
+  unsigned long t = _tail.load (std::memory_order_relaxed);
+
+  while (_head.load (std::memory_order_acquire) != t) {
+    _wake ();
+    std::this_thread::yield ();
+  }
+}
+
+void TraceWriter::_run ()
+{
+  unsigned long *rec = NULL;
+  unsigned long rmax = 0;
+
+  while (1) {
+    unsigned long h = _head.load (std::memory_order_relaxed);
+    unsigned long t = _tail.load (std::memory_order_acquire);
+
+    if (h == t) {
+      if (_stop.load (std::memory_order_acquire) &&
+	  _tail.load (std::memory_order_acquire) == h) {
+	break;
+      }
+      std::unique_lock<std::mutex> lk (_mu);
+      _sleeping.store (1);
+      _cv.wait (lk, [&] {
+	  return _tail.load () != h || _stop.load ();
+	});
+      _sleeping.store (0, std::memory_order_relaxed);
+      continue;
+    }
+
+    while (h != t) {
+      unsigned long w0 = _buf[h & _mask];
+      int kind = w0 & 0xff;
+      int state = (w0 >> 8) & 0xff;
+      int tlen = (w0 >> 16) & 0xffff;
+      int vlen = w0 >> 32;
+      void *node = (void *) _buf[(h+1) & _mask];
+      float tm;
+      unsigned long n = tlen + vlen;
+
+      memcpy (&tm, &_buf[(h+2) & _mask], sizeof (float));
+      if (n > rmax) {
+	rmax = n;
+	REALLOC (rec, unsigned long, rmax);
+      }
+      for (unsigned long i=0; i < n; i++) {
+	rec[i] = _buf[(h + TRW_HDR + i) & _mask];
+      }
+      emit (_tr, kind, node, tm, tlen, rec, state, vlen, rec + tlen);
+      h += TRW_HDR + n;
+      _head.store (h, std::memory_order_release);
+    }
+  }
+  if (rec) {
+    FREE (rec);
+  }
+}
+
+void TraceWriter::emit (act_trace_t *tr, int kind, void *node, float tm,
+			int tlen, unsigned long *ptm,
+			int state, int vlen, unsigned long *val)
+{
+  act_chan_state_t st = (act_chan_state_t) state;
+
+  if (act_trace_has_alt (tr->t)) {
+    switch (kind) {
+    case TRW_DIGITAL:
+      act_trace_digital_change_alt (tr, node, tlen, ptm, val[0]);
+      break;
+    case TRW_WIDE_DIGITAL:
+      act_trace_wide_digital_change_alt (tr, node, tlen, ptm, vlen, val);
+      break;
+    case TRW_CHAN:
+      act_trace_chan_change_alt (tr, node, tlen, ptm, st, val[0]);
+      break;
+    case TRW_WIDE_CHAN:
+      act_trace_wide_chan_change_alt (tr, node, tlen, ptm, st, vlen, val);
+      break;
+    default:
+      fatal_error ("Unknown trace record %d", kind);
+      break;
+    }
+  }
+  else {
+    switch (kind) {
+    case TRW_DIGITAL:
+      act_trace_digital_change (tr, node, tm, val[0]);
+      break;
+    case TRW_WIDE_DIGITAL:
+      act_trace_wide_digital_change (tr, node, tm, vlen, val);
+      break;
+    case TRW_CHAN:
+      act_trace_chan_change (tr, node, tm, st, val[0]);
+      break;
+    case TRW_WIDE_CHAN:
+      act_trace_wide_chan_change (tr, node, tm, st, vlen, val);
+      break;
+    default:
+      fatal_error ("Unknown trace record %d", kind);
+      break;
+    }
+  }
+}
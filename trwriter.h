@@ -0,0 +1,108 @@
+/*************************************************************************
+ *
+ *  Copyright (c) 2020 Rajit Manohar
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA  02110-1301, USA.
+ *
+ **************************************************************************
+ */
+#ifndef __ACT_TRACE_WRITER_H__
+#define __ACT_TRACE_WRITER_H__
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <act/tracelib.h>
+
+/*
+ * Background trace writer.
+ *
+ * The simulation thread appends compact change records to a
+ * single-producer/single-consumer ring of words; a writer thread
+ * drains the ring and calls the trace format plugin. Each record is
+ * three header words (kind/state/lengths, signal node, float time)
+ * followed by the integer time and the value words.
+ *
+ * When the ring is full the simulation thread waits for the writer
+ * (back-pressure). Once the ring has been drained by flush(), the
+ * writer thread does not touch the trace, so the caller may use it
+ * directly until the next record is queued.
+ */
+
+enum trwriter_kind {
+  TRW_DIGITAL = 0,		/* digital change, one value word */
+  TRW_WIDE_DIGITAL = 1,		/* digital change, vlen value words */
+  TRW_CHAN = 2,			/* channel change, one value word */
+  TRW_WIDE_CHAN = 3		/* channel change, vlen value words */
+};
+
+class TraceWriter {
+public:
+  /* ring of at least nwords words; starts the writer thread */
+  TraceWriter (act_trace_t *tr, int nwords);
+
+  /* drains the ring and stops the writer thread; the trace itself
+     is not closed */
+  ~TraceWriter ();
+
+  /* queue a change; waits while the ring is full */
+  void change (int kind, void *node, float tm,
+	       int tlen, unsigned long *ptm,
+	       int state, int vlen, unsigned long *val);
+
+  /* wait until every queued change has been written */
+  void flush ();
+
+  unsigned long numRecords () { return _nrec; }
+  unsigned long numStalls () { return _nstall; }
+
+  /* write a change straight to the format plugin */
+  static void emit (act_trace_t *tr, int kind, void *node, float tm,
+		    int tlen, unsigned long *ptm,
+		    int state, int vlen, unsigned long *val);
+
+  /* drain all live writers; called at exit */
+  static void flushAll ();
+
+private:
+  act_trace_t *_tr;
+
+  unsigned long *_buf;		/* ring */
+  unsigned long _mask;		/* ring size - 1 */
+
+  /* _head is only written by the writer, _tail only by the
+     simulation thread */
+  std::atomic<unsigned long> _head;
+  std::atomic<unsigned long> _tail;
+  std::atomic<int> _stop;
+  std::atomic<int> _sleeping;
+
+  std::mutex _mu;
+  std::condition_variable _cv;
+  std::thread _th;
+
+  unsigned long _nrec;		/* records queued */
+  unsigned long _nstall;	/* times the producer found the ring full */
+
+  TraceWriter *_next;		/* live writers */
+  static TraceWriter *_live;
+
+  void _run ();
+  void _wake ();
+};
+
+#endif /* __ACT_TRACE_WRITER_H__ */
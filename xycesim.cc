@@ -442,7 +442,7 @@ void XyceActInterface::_addProcess (XyceSim *xc)
   A_INC (_analog_inst);
 
   if (!_pending) {
-    _pending = new Event (xc, SIM_EV_MKTYPE (0,0), 0);
+    _pending = ActEvent::make (xc, SIM_EV_MKTYPE (0,0), 0);
   }
 }
 
@@ -1142,7 +1142,7 @@ void XyceActInterface::step()
       }
     }
   }
-  _pending = new Event (_analog_inst[0], SIM_EV_MKTYPE (0, 0), sim_dt);
+  _pending = ActEvent::make (_analog_inst[0], SIM_EV_MKTYPE (0, 0), sim_dt);
 #endif
 }
 
@@ -1209,10 +1209,5 @@ void XyceSim::setBool (int lid, int v)
 void XyceSim::setGlobalBool (int off, int v)
 {
   _sc->setBool (off, v);
-  SimDES **arr = _sc->getFO (off, 0);
-  for (int i=0; i < _sc->numFanout (off, 0); i++) {
-    ActSimDES *p = dynamic_cast<ActSimDES *>(arr[i]);
-    Assert (p, "What?");
-    p->propagate ();
-  }
+  _sc->propagateFanout (off, 0);
 }